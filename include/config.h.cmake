@@ -0,0 +1,14 @@
+/*
+ *  THIS FILE IS AUTOMATICALLY CREATED BY cmake!
+ *  DON'T EDIT THIS FILE MANUALLY, IT WILL BE OVERWRITTEN.
+ */
+
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+#define VERSION "@PROJECT_VERSION@"
+#cmakedefine HAVE_XFT_H 1
+#cmakedefine HAVE_XRANDR_H 1
+#cmakedefine HAVE_XSHM_H 1
+
+#endif /* __CONFIG_H__ */
@@ -96,10 +96,12 @@ extern "C" {
 
 typedef unsigned char BYTE;
 typedef unsigned short WORD;
+typedef WORD ATOM;
 typedef int BOOL;
 typedef int LONG;
 typedef unsigned int DWORD;
 typedef unsigned int UINT;
+typedef int *LPINT;
 
 typedef long LONG_PTR; // 32 bit on 32 bit, 64 bit on 64 bit.
 typedef unsigned long ULONG_PTR; // 32 bit on 32 bit, 64 bit on 64 bit.
@@ -111,13 +113,25 @@ typedef LONG_PTR LRESULT;
 typedef char *LPTSTR;
 typedef char *LPSTR;
 typedef char *LPCSTR;
+typedef uint16_t WCHAR; // UTF-16 code unit
+typedef WCHAR *LPWSTR;
+typedef const WCHAR *LPCWSTR;
 typedef void *LPVOID;
 
 typedef UINT_PTR WPARAM;
 typedef LONG_PTR LPARAM;
 
+#define MAKELONG(a, b) ((LONG)(((WORD)(a)) | ((DWORD)((WORD)(b))) << 16))
+#define MAKELPARAM(l, h) ((LPARAM)(DWORD)MAKELONG(l, h))
+#define MAKEWPARAM(l, h) ((WPARAM)(DWORD)MAKELONG(l, h))
+#define LOWORD(l) ((WORD)((DWORD_PTR)(l) & 0xffff))
+#define HIWORD(l) ((WORD)((DWORD_PTR)(l) >> 16))
+
 typedef DWORD COLORREF;
 #define RGB(r,g,b) ((COLORREF)((r) | ((g) << 8) | ((b) << 16)))
+#define GetRValue(rgb) ((BYTE)(rgb))
+#define GetGValue(rgb) ((BYTE)((rgb) >> 8))
+#define GetBValue(rgb) ((BYTE)((rgb) >> 16))
 
 /* Events */
 #define WM_CREATE                       0x0001
@@ -128,8 +142,72 @@ typedef DWORD COLORREF;
 #define WM_QUIT                         0x0012
 #define WM_ERASEBKGND                   0x0014
 #define WM_NCPAINT                      0x0085
+#define WM_KEYDOWN                      0x0100
+#define WM_KEYUP                        0x0101
+#define WM_CHAR                         0x0102
+#define WM_COMMAND                      0x0111
+#define WM_TIMER                        0x0113
+#define WM_INITMENU                     0x0116
+#define WM_INITMENUPOPUP                0x0117
+#define WM_MOUSEMOVE                    0x0200
 #define WM_LBUTTONDOWN                  0x0201
 #define WM_LBUTTONUP                    0x0202
+#define WM_RBUTTONDOWN                  0x0204
+#define WM_RBUTTONUP                    0x0205
+#define WM_MBUTTONDOWN                  0x0207
+#define WM_MBUTTONUP                    0x0208
+#define WM_MOUSEWHEEL                   0x020A
+#define WM_MOUSEHWHEEL                  0x020E
+#define WM_USER                         0x0400
+#define WM_APP                          0x8000
+
+/* PeekMessage options */
+#define PM_NOREMOVE                     0x0000
+#define PM_REMOVE                       0x0001
+#define PM_NOYIELD                      0x0002
+
+/* Error codes */
+#define ERROR_SUCCESS                   0
+#define ERROR_ACCESS_DENIED             5
+#define ERROR_INVALID_HANDLE            6
+#define ERROR_NOT_ENOUGH_MEMORY         8
+#define ERROR_NOT_SUPPORTED             50
+#define ERROR_INVALID_PARAMETER         87
+#define ERROR_INVALID_WINDOW_HANDLE     1400
+#define ERROR_INVALID_MENU_HANDLE       1401
+#define ERROR_CANNOT_FIND_WND_CLASS     1407
+#define ERROR_CLASS_ALREADY_EXISTS      1410
+#define ERROR_POINT_NOT_FOUND           1171
+#define ERROR_MENU_ITEM_NOT_FOUND       1456
+#define ERROR_INVALID_THREAD_ID         1444
+#define ERROR_TIMEOUT                   1460
+#define ERROR_NOT_ENOUGH_QUOTA          1816
+
+/* Wait results */
+#define INFINITE                        0xFFFFFFFF
+#define WAIT_OBJECT_0                   0x00000000
+#define WAIT_TIMEOUT                    0x00000102
+#define WAIT_FAILED                     0xFFFFFFFF
+#define MAXIMUM_WAIT_OBJECTS            64
+
+/* Queue status (MsgWaitForMultipleObjects wake masks) */
+#define QS_KEY                          0x0001
+#define QS_MOUSEMOVE                    0x0002
+#define QS_MOUSEBUTTON                  0x0004
+#define QS_POSTMESSAGE                  0x0008
+#define QS_TIMER                        0x0010
+#define QS_PAINT                        0x0020
+#define QS_SENDMESSAGE                  0x0040
+#define QS_HOTKEY                       0x0080
+#define QS_MOUSE (QS_MOUSEMOVE | QS_MOUSEBUTTON)
+#define QS_INPUT (QS_MOUSE | QS_KEY)
+#define QS_ALLEVENTS (QS_INPUT | QS_POSTMESSAGE | QS_TIMER | QS_PAINT | QS_HOTKEY)
+#define QS_ALLINPUT (QS_ALLEVENTS | QS_SENDMESSAGE)
+
+/* WSAAsyncSelect events */
+#define FD_READ                         0x01
+#define FD_WRITE                        0x02
+#define FD_CLOSE                        0x20
 
 /* Type declarations */
 typedef void *HINSTANCE;
@@ -140,6 +218,7 @@ typedef struct WndDC *HDC;
 typedef struct Wnd *HWND;
 typedef struct WndMenu *HMENU;
 typedef LRESULT (*WNDPROC)(HWND, UINT, WPARAM, LPARAM);
+typedef void (*TIMERPROC)(HWND, UINT, UINT_PTR, DWORD);
 
 /* GDI objects */
 typedef struct GDIOBJ *HGDIOBJ;
@@ -147,10 +226,10 @@ typedef struct GDIOBJ *HFONT;
 typedef struct GDIOBJ *HBRUSH;
 typedef struct GDIOBJ *HPEN;
 typedef struct GDIOBJ *HRGN;
+typedef struct GDIOBJ *HBITMAP;
 
 /* XXX: Fix */
 typedef void *HCURSOR;
-typedef void *HBITMAP;
 
 typedef struct tagWNDCLASS {
   const char *lpszClassName;
@@ -160,6 +239,19 @@ typedef struct tagWNDCLASS {
   size_t cbWndExtra;
 } WNDCLASS;
 
+typedef struct tagWNDCLASSEX {
+  UINT cbSize;
+  UINT style;
+  WNDPROC lpfnWndProc;
+  int cbClsExtra;
+  int cbWndExtra;
+  HINSTANCE hInstance;
+  HCURSOR hCursor;
+  HBRUSH hbrBackground;
+  const char *lpszMenuName;
+  const char *lpszClassName;
+} WNDCLASSEX;
+
 typedef struct tagLOGBRUSH {
   UINT      lbStyle;
   COLORREF  lbColor;
@@ -171,6 +263,11 @@ typedef struct tagPOINT {
   LONG y;
 } POINT, *PPOINT;
 
+typedef struct tagSIZE {
+  LONG cx;
+  LONG cy;
+} SIZE, *LPSIZE;
+
 typedef struct tagRECT {
   LONG left;
   LONG top;
@@ -205,7 +302,8 @@ typedef MENUITEMINFO const *LPCMENUITEMINFO;
 #include <winuser.h>
 #include <wingdi.h>
 
-int RegisterClass(WNDCLASS *wndclass);
+ATOM RegisterClass(const WNDCLASS *wndclass);
+ATOM RegisterClassEx(const WNDCLASSEX *wndclass);
 
 #define SW_HIDE 0
 #define SW_SHOWNORMAL 1
@@ -218,6 +316,7 @@ void DestroyWindow(HWND wnd);
 HWND GetParent(HWND wnd);
 BOOL IsWindow(HWND wnd);
 void SetLastError(DWORD err);
+DWORD GetLastError(void);
 
 HGDIOBJ GetStockObject(int fnObject);
 DWORD GetSysColor(int nIndex);
@@ -227,6 +326,7 @@ BOOL DeleteObject(HGDIOBJ hObject);
 HGDIOBJ SelectObject(HDC hdc, HGDIOBJ hgdiobj);
 int GetObject(HANDLE h, int c, LPVOID pv);
 COLORREF SetDCBrushColor(HDC hdc, COLORREF crColor);
+COLORREF SetTextColor(HDC hdc, COLORREF crColor);
 BOOL TextOut(HDC hdc, int nXStart, int nYStart, const char *lpString,
     size_t cchString);
 BOOL Ellipse(HDC hdc, int nLeftRect, int nTopRect, int nRightRect,
@@ -236,13 +336,28 @@ BOOL Rectangle(HDC hdc, int nLeftRect, int nTopRect,
 BOOL FillRect(HDC hdc, const RECT *lprc, HBRUSH hbr);
 
 void *GetWindowLongPtr(HWND wnd, int nIndex);
-int SendMessage(HWND wnd, unsigned int msg, WPARAM wParam, LPARAM lParam);
+LRESULT SendMessage(HWND wnd, unsigned int msg, WPARAM wParam, LPARAM lParam);
+LRESULT SendMessageTimeout(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam,
+    UINT fuFlags, UINT uTimeout, PDWORD_PTR lpdwResult);
+BOOL SendNotifyMessage(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam);
 LRESULT DefWindowProc(HWND wnd, unsigned int msg, WPARAM wParam, LPARAM lParam);
 
 BOOL GetMessage(LPMSG msg, HWND wnd, UINT wMsgFilterMin, UINT wMsgFilterMax);
+BOOL PeekMessage(LPMSG msg, HWND wnd, UINT wMsgFilterMin, UINT wMsgFilterMax,
+    UINT wRemoveMsg);
+BOOL PostMessage(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
+BOOL PostThreadMessage(DWORD idThread, UINT msg, WPARAM wParam,
+    LPARAM lParam);
+DWORD GetCurrentThreadId(void);
+BOOL TranslateMessage(const MSG *msg);
 int DispatchMessage(const MSG *msg);
 void PostQuitMessage(int nExitCode);
 
+/* Waiting on file descriptors. Handles are plain fds on this platform. */
+int WSAAsyncSelect(int s, HWND hwnd, UINT wMsg, long lEvent);
+DWORD MsgWaitForMultipleObjects(DWORD nCount, const int *pHandles,
+    BOOL fWaitAll, DWORD dwMilliseconds, DWORD dwWakeMask);
+
 /* Rect utility functions (rect.c) */
 BOOL SetRect(RECT *r, int left, int top, int right, int bottom);
 BOOL SetRectEmpty(RECT *r);
@@ -300,6 +415,7 @@ BOOL SubtractRect(RECT *dst, const RECT *r1, const RECT *r2);
 #define MFS_UNCHECKED	0
 #define MFS_UNHILITE	0
 
+#define MF_BYCOMMAND	0
 #define MF_BYPOSITION	0x400
 
 
@@ -307,8 +423,13 @@ BOOL SubtractRect(RECT *dst, const RECT *r1, const RECT *r2);
 BOOL AppendMenu(HMENU menu, UINT flags, UINT_PTR id, LPCSTR title);
 BOOL InsertMenu(HMENU menu, UINT pos, UINT flags, UINT_PTR id, LPCSTR ptr);
 BOOL InsertMenuItem(HMENU menu, UINT pos, BOOL bypos, LPCMENUITEMINFO info);
+BOOL ModifyMenu(HMENU menu, UINT pos, UINT flags, UINT_PTR id, LPCSTR ptr);
+BOOL GetMenuItemInfo(HMENU menu, UINT pos, BOOL bypos, LPMENUITEMINFO info);
+DWORD CheckMenuItem(HMENU menu, UINT id, UINT check);
+BOOL EnableMenuItem(HMENU menu, UINT id, UINT enable);
 HMENU CreateMenu(void);
 HMENU CreatePopupMenu(void);
+BOOL DestroyMenu(HMENU menu);
 BOOL IsMenu(HMENU menu);
 
 #ifdef __cplusplus
@@ -72,15 +72,170 @@
 /* Brush styles */
 #define BS_SOLID 0
 
+/* Pen styles */
+#define PS_SOLID 0
+#define PS_DASH 1
+#define PS_DOT 2
+#define PS_NULL 5
+
 #define CLR_INVALID 0xFFFFFFFF
+#define GDI_ERROR 0xFFFFFFFF
+
+/* DIB color table identifiers */
+#define DIB_RGB_COLORS 0
+#define DIB_PAL_COLORS 1
+
+/* Bitmap compression */
+#define BI_RGB 0
+#define BI_BITFIELDS 3
+
+/* Raster operations */
+#define SRCCOPY 0x00CC0020
+
+/* Font weights */
+#define FW_DONTCARE 0
+#define FW_THIN 100
+#define FW_EXTRALIGHT 200
+#define FW_LIGHT 300
+#define FW_NORMAL 400
+#define FW_MEDIUM 500
+#define FW_SEMIBOLD 600
+#define FW_BOLD 700
+#define FW_EXTRABOLD 800
+#define FW_HEAVY 900
+
+#define ANSI_CHARSET 0
+#define DEFAULT_CHARSET 1
+
+#define OUT_DEFAULT_PRECIS 0
+#define CLIP_DEFAULT_PRECIS 0
+#define DEFAULT_QUALITY 0
+
+/* lfPitchAndFamily */
+#define DEFAULT_PITCH 0
+#define FIXED_PITCH 1
+#define VARIABLE_PITCH 2
+#define FF_DONTCARE 0x00
+#define FF_ROMAN 0x10
+#define FF_SWISS 0x20
+#define FF_MODERN 0x30
+
+#define LF_FACESIZE 32
+
+typedef struct tagLOGFONT {
+  LONG lfHeight;
+  LONG lfWidth;
+  LONG lfEscapement;
+  LONG lfOrientation;
+  LONG lfWeight;
+  BYTE lfItalic;
+  BYTE lfUnderline;
+  BYTE lfStrikeOut;
+  BYTE lfCharSet;
+  BYTE lfOutPrecision;
+  BYTE lfClipPrecision;
+  BYTE lfQuality;
+  BYTE lfPitchAndFamily;
+  char lfFaceName[LF_FACESIZE];
+} LOGFONT, *LPLOGFONT;
+
+/* tmPitchAndFamily bits; note that TMPF_FIXED_PITCH set means the font is
+ * NOT fixed pitch */
+#define TMPF_FIXED_PITCH 0x01
+
+typedef struct tagTEXTMETRIC {
+  LONG tmHeight;
+  LONG tmAscent;
+  LONG tmDescent;
+  LONG tmInternalLeading;
+  LONG tmExternalLeading;
+  LONG tmAveCharWidth;
+  LONG tmMaxCharWidth;
+  LONG tmWeight;
+  LONG tmOverhang;
+  LONG tmDigitizedAspectX;
+  LONG tmDigitizedAspectY;
+  BYTE tmFirstChar;
+  BYTE tmLastChar;
+  BYTE tmDefaultChar;
+  BYTE tmBreakChar;
+  BYTE tmItalic;
+  BYTE tmUnderlined;
+  BYTE tmStruckOut;
+  BYTE tmPitchAndFamily;
+  BYTE tmCharSet;
+} TEXTMETRIC, *LPTEXTMETRIC;
+
+typedef struct tagBITMAPINFOHEADER {
+  DWORD biSize;
+  LONG  biWidth;
+  LONG  biHeight; /* negative for top-down bitmaps */
+  WORD  biPlanes;
+  WORD  biBitCount;
+  DWORD biCompression;
+  DWORD biSizeImage;
+  LONG  biXPelsPerMeter;
+  LONG  biYPelsPerMeter;
+  DWORD biClrUsed;
+  DWORD biClrImportant;
+} BITMAPINFOHEADER, *PBITMAPINFOHEADER;
+
+typedef struct tagRGBQUAD {
+  BYTE rgbBlue;
+  BYTE rgbGreen;
+  BYTE rgbRed;
+  BYTE rgbReserved;
+} RGBQUAD;
+
+typedef struct tagBITMAPINFO {
+  BITMAPINFOHEADER bmiHeader;
+  RGBQUAD bmiColors[1];
+} BITMAPINFO, *PBITMAPINFO, *LPBITMAPINFO;
 
 HBRUSH CreateSolidBrush(COLORREF crColor);
 HBRUSH CreateBrushIndirect(const LOGBRUSH *lplb);
 HRGN CreateRectRgn(int left, int top, int right, int bottom);
 HRGN CreateRectRgnIndirect(const RECT *lprc);
+int SelectClipRgn(HDC hdc, HRGN hrgn);
 
 int CombineRgn(HRGN dest, HRGN src1, HRGN src2, int combineMode);
 int GetRgnBox(HRGN hrgn, RECT *lprc);
 BOOL SetRectRgn(HRGN hrgn, int left, int top, int right, int bottom);
+BOOL PtInRegion(HRGN hrgn, int x, int y);
+
+/* Device independent bitmaps (bitmap.c) */
+HBITMAP CreateDIBSection(HDC hdc, const BITMAPINFO *pbmi, UINT usage,
+    void **ppvBits, HANDLE hSection, DWORD offset);
+int SetDIBitsToDevice(HDC hdc, int xDest, int yDest, DWORD w, DWORD h,
+    int xSrc, int ySrc, UINT StartScan, UINT cLines, const void *lpvBits,
+    const BITMAPINFO *lpbmi, UINT ColorUse);
+int StretchDIBits(HDC hdc, int xDest, int yDest, int DestWidth,
+    int DestHeight, int xSrc, int ySrc, int SrcWidth, int SrcHeight,
+    const void *lpBits, const BITMAPINFO *lpbmi, UINT iUsage, DWORD rop);
+HBITMAP CreateCompatibleBitmap(HDC hdc, int cx, int cy);
+int GetDIBits(HDC hdc, HBITMAP hbm, UINT start, UINT cLines, LPVOID lpvBits,
+    LPBITMAPINFO lpbmi, UINT usage);
+BOOL GdiFlush(void);
+
+/* Memory DCs, drawn on without a display (memdc.c) */
+HDC CreateCompatibleDC(HDC hdc);
+BOOL DeleteDC(HDC hdc);
+
+/* Fonts and text metrics (font.c) */
+HFONT CreateFont(int nHeight, int nWidth, int nEscapement, int nOrientation,
+    int fnWeight, DWORD fdwItalic, DWORD fdwUnderline, DWORD fdwStrikeOut,
+    DWORD fdwCharSet, DWORD fdwOutputPrecision, DWORD fdwClipPrecision,
+    DWORD fdwQuality, DWORD fdwPitchAndFamily, const char *lpszFace);
+HFONT CreateFontIndirect(const LOGFONT *lplf);
+BOOL GetTextExtentPoint32(HDC hdc, const char *lpString, int c,
+    LPSIZE lpSize);
+BOOL GetTextMetrics(HDC hdc, LPTEXTMETRIC lptm);
+BOOL GetCharWidth32(HDC hdc, UINT iFirst, UINT iLast, LPINT lpBuffer);
+
+/* Unicode text (text.c) */
+BOOL TextOutW(HDC hdc, int nXStart, int nYStart, LPCWSTR lpString,
+    int cchString);
+BOOL GetTextExtentPoint32W(HDC hdc, LPCWSTR lpString, int c,
+    LPSIZE lpSize);
 
 #endif /* __WINGDI_H__ */
@@ -33,6 +33,8 @@
 #define __WINUSER_H__
 
 #define MAKEINTRESOURCE(i) ((LPSTR)((ULONG_PTR)((WORD)(i))))
+#define MAKEINTATOM(i) ((LPSTR)((ULONG_PTR)((WORD)(i))))
+#define IS_INTRESOURCE(r) ((((ULONG_PTR)(r)) >> 16) == 0)
 
 
 /* GetWindowLong indexes */
@@ -42,6 +44,108 @@
 /* GetSystemMetrics indexes */
 #define SM_CYMENU 15
 
+/* Mouse message key state (wParam) */
+#define MK_LBUTTON    0x0001
+#define MK_RBUTTON    0x0002
+#define MK_SHIFT      0x0004
+#define MK_CONTROL    0x0008
+#define MK_MBUTTON    0x0010
+
+#define WHEEL_DELTA 120
+#define GET_WHEEL_DELTA_WPARAM(wParam) ((short)HIWORD(wParam))
+#define GET_KEYSTATE_WPARAM(wParam) (LOWORD(wParam))
+
+#define GMMP_USE_DISPLAY_POINTS 1
+
+/* Virtual key codes (WM_KEYDOWN wParam); '0'-'9' and 'A'-'Z' are their
+ * ASCII codes */
+#define VK_BACK       0x08
+#define VK_TAB        0x09
+#define VK_CLEAR      0x0C
+#define VK_RETURN     0x0D
+#define VK_SHIFT      0x10
+#define VK_CONTROL    0x11
+#define VK_MENU       0x12
+#define VK_PAUSE      0x13
+#define VK_CAPITAL    0x14
+#define VK_ESCAPE     0x1B
+#define VK_SPACE      0x20
+#define VK_PRIOR      0x21
+#define VK_NEXT       0x22
+#define VK_END        0x23
+#define VK_HOME       0x24
+#define VK_LEFT       0x25
+#define VK_UP         0x26
+#define VK_RIGHT      0x27
+#define VK_DOWN       0x28
+#define VK_SNAPSHOT   0x2C
+#define VK_INSERT     0x2D
+#define VK_DELETE     0x2E
+#define VK_LWIN       0x5B
+#define VK_RWIN       0x5C
+#define VK_APPS       0x5D
+#define VK_NUMPAD0    0x60
+#define VK_NUMPAD1    0x61
+#define VK_NUMPAD2    0x62
+#define VK_NUMPAD3    0x63
+#define VK_NUMPAD4    0x64
+#define VK_NUMPAD5    0x65
+#define VK_NUMPAD6    0x66
+#define VK_NUMPAD7    0x67
+#define VK_NUMPAD8    0x68
+#define VK_NUMPAD9    0x69
+#define VK_MULTIPLY   0x6A
+#define VK_ADD        0x6B
+#define VK_SEPARATOR  0x6C
+#define VK_SUBTRACT   0x6D
+#define VK_DECIMAL    0x6E
+#define VK_DIVIDE     0x6F
+#define VK_F1         0x70
+#define VK_F2         0x71
+#define VK_F3         0x72
+#define VK_F4         0x73
+#define VK_F5         0x74
+#define VK_F6         0x75
+#define VK_F7         0x76
+#define VK_F8         0x77
+#define VK_F9         0x78
+#define VK_F10        0x79
+#define VK_F11        0x7A
+#define VK_F12        0x7B
+#define VK_F24        0x87
+#define VK_NUMLOCK    0x90
+#define VK_SCROLL     0x91
+#define VK_OEM_1      0xBA /* ;: */
+#define VK_OEM_PLUS   0xBB
+#define VK_OEM_COMMA  0xBC
+#define VK_OEM_MINUS  0xBD
+#define VK_OEM_PERIOD 0xBE
+#define VK_OEM_2      0xBF /* /? */
+#define VK_OEM_3      0xC0 /* `~ */
+#define VK_OEM_4      0xDB /* [{ */
+#define VK_OEM_5      0xDC /* \| */
+#define VK_OEM_6      0xDD /* ]} */
+#define VK_OEM_7      0xDE /* '" */
+#define VK_OEM_8      0xDF
+#define VK_OEM_102    0xE2 /* <> */
+
+typedef struct tagMOUSEMOVEPOINT {
+  int x;
+  int y;
+  DWORD time;
+  ULONG_PTR dwExtraInfo;
+} MOUSEMOVEPOINT, *PMOUSEMOVEPOINT, *LPMOUSEMOVEPOINT;
+
+/* DrawText formats */
+#define DT_TOP        0x00000000
+#define DT_LEFT       0x00000000
+#define DT_CENTER     0x00000001
+#define DT_RIGHT      0x00000002
+#define DT_VCENTER    0x00000004
+#define DT_BOTTOM     0x00000008
+#define DT_SINGLELINE 0x00000020
+#define DT_CALCRECT   0x00000400
+
 /* Standard window styles (WS) */
 #define WS_OVERLAPPED   0x00000000
 #define WS_TABSTOP      0x00010000
@@ -99,18 +203,60 @@ HWND CreateWindowEx(DWORD dwExStyle, const char *lpClassName,
     const char *lpWindowName, DWORD dwStyle, int x, int y, int nWidth,
     int nHeight, HWND hWndParent, HMENU menu, HINSTANCE hInst, LPVOID *extra);
 
+BOOL DrawMenuBar(HWND hWnd);
+int GetMouseMovePointsEx(UINT cbSize, LPMOUSEMOVEPOINT lppt,
+    LPMOUSEMOVEPOINT lpptBuf, int nBufPoints, DWORD resolution);
+/* w32x extension: per window X event compression */
+#define ECF_MOTION    0x0001 /* keep only the last of a run of motions */
+#define ECF_CONFIGURE 0x0002 /* fold configure storms into one WM_SIZE */
+#define ECF_ALL       (ECF_MOTION | ECF_CONFIGURE)
+
+typedef struct tagEVENTCOMPRESSIONSTATS {
+  DWORD dwExposeMerged;    /* Expose events merged into an update region */
+  DWORD dwMotionDropped;   /* MotionNotify events superseded */
+  DWORD dwConfigureFolded; /* ConfigureNotify events folded */
+} EVENTCOMPRESSIONSTATS;
+
+/* SendMessageTimeout flags */
+#define SMTO_NORMAL             0x0000
+#define SMTO_BLOCK              0x0001
+#define SMTO_ABORTIFHUNG        0x0002
+#define SMTO_NOTIMEOUTIFNOTHUNG 0x0008
+
+/* SetTimer intervals are clamped to this range */
+#define USER_TIMER_MINIMUM 0x0000000A
+#define USER_TIMER_MAXIMUM 0x7FFFFFFF
+
+UINT_PTR SetTimer(HWND hwnd, UINT_PTR nIDEvent, UINT uElapse,
+    TIMERPROC lpTimerFunc);
+BOOL KillTimer(HWND hwnd, UINT_PTR uIDEvent);
+DWORD GetTickCount(void);
+
+BOOL SetWindowEventCompression(HWND hwnd, DWORD flags);
+BOOL GetEventCompressionStats(EVENTCOMPRESSIONSTATS *stats);
+
+int DrawText(HDC hdc, const char *lpchText, int cchText, LPRECT lprc,
+    UINT format);
+int DrawTextW(HDC hdc, LPCWSTR lpchText, int cchText, LPRECT lprc,
+    UINT format);
+BOOL EndPaint(HWND wnd, const PAINTSTRUCT *lpPaint);
+
 BOOL GetClientRect(HWND wnd, LPRECT rect);
 HDC GetDC(HWND hwnd);
-BOOL GetMenu(HWND hwnd);
+HMENU GetMenu(HWND hwnd);
 int GetSystemMetrics(int nIndex);
 LONG GetWindowLong(HWND hWnd, int nIndex);
 BOOL GetWindowRect(HWND wnd, LPRECT rect);
 
+BOOL GetUpdateRect(HWND hWnd, LPRECT lpRect, BOOL bErase);
+int GetUpdateRgn(HWND hWnd, HRGN hRgn, BOOL bErase);
 BOOL InvalidateRect(HWND hWnd, const RECT *lpRect, BOOL bErase);
 
 int ReleaseDC(HWND hWnd, HDC hDC);
 BOOL SetMenu(HWND hwnd, HMENU menu);
 BOOL UpdateWindow(HWND hwnd);
+BOOL ValidateRect(HWND hWnd, const RECT *lpRect);
+BOOL ValidateRgn(HWND hWnd, HRGN hRgn);
 
 HCURSOR LoadCursor(HINSTANCE hInst, LPSTR lpCursorName);
 
@@ -0,0 +1,744 @@
+/*
+ * Copyright (c) 2018 Devin Smith <devin@devinsmith.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef HAVE_XFT_H
+#include <X11/Xft/Xft.h>
+#endif
+#ifdef HAVE_XSHM_H
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
+
+#include <windows.h>
+#include "w32x_priv.h"
+
+extern Display *disp;
+
+/*
+ * A device independent bitmap. Pixels are stored as 32 bit BGRX, which is
+ * what a 24/32 bit TrueColor server expects, so when MIT-SHM is available
+ * the application writes straight into the segment the server reads from.
+ * The server attaches the segment when the bitmap is first sent to a
+ * window.
+ *
+ * Bitmaps that are never sent to a window (compatible bitmaps, and all of
+ * them without a display) have no XImage, only the bits; they are only
+ * drawn on through memory DCs.
+ */
+struct w32x_dib {
+	XImage *image;
+	void *bits;
+	size_t size;
+	int width;
+	int height;
+	BOOL bottom_up; /* as the application sees the bits */
+	BOOL shm;
+#ifdef HAVE_XSHM_H
+	BOOL attached; /* the server has the segment */
+	XShmSegmentInfo shminfo;
+#endif
+
+	LIST_ENTRY(w32x_dib) entries;
+};
+
+/* All DIB sections, used to recognize their bits in SetDIBitsToDevice.
+ * Shared by all threads and guarded by the library lock. */
+static LIST_HEAD(dib_list, w32x_dib) dib_sections =
+    LIST_HEAD_INITIALIZER(dib_sections);
+
+/* Scratch image StretchDIBits scales into */
+static __thread struct w32x_dib *scratch;
+static __thread int *scratch_xmap;
+static __thread int scratch_xmap_len;
+
+static int shm_available = -1; /* -1 until probed */
+static __thread BOOL images_pending;
+
+static BOOL
+shm_probe(void)
+{
+#ifdef HAVE_XSHM_H
+	if (disp == NULL)
+		return FALSE;
+	if (shm_available == -1) {
+		shm_available = XShmQueryExtension(disp) &&
+		    ImageByteOrder(disp) == LSBFirst;
+	}
+	return shm_available;
+#else
+	return FALSE;
+#endif
+}
+
+static BOOL
+dib_format_supported(const BITMAPINFOHEADER *bih)
+{
+	Visual *visual;
+	int depth;
+
+	if (bih->biBitCount != 32 || bih->biCompression != BI_RGB ||
+	    bih->biWidth <= 0 || bih->biHeight == 0) {
+		fprintf(stderr, "XXX: Only 32 bit BI_RGB DIBs are supported\n");
+		return FALSE;
+	}
+	if (disp == NULL)
+		return TRUE;
+
+	/* BGRX in memory is the pixel value as is on these visuals */
+	visual = DefaultVisual(disp, DefaultScreen(disp));
+	depth = DefaultDepth(disp, DefaultScreen(disp));
+	if ((depth != 24 && depth != 32) || visual->red_mask != 0xff0000 ||
+	    visual->green_mask != 0xff00 || visual->blue_mask != 0xff) {
+		fprintf(stderr, "XXX: DIBs need a 24 bit TrueColor visual\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+#ifdef HAVE_XSHM_H
+static int shm_error;
+
+static int
+shm_error_handler(Display *d, XErrorEvent *e)
+{
+	shm_error = 1;
+	return 0;
+}
+
+static BOOL
+dib_alloc_shm(struct w32x_dib *dib, int width, int height)
+{
+	XImage *img;
+
+	img = XShmCreateImage(disp, DefaultVisual(disp, DefaultScreen(disp)),
+	    DefaultDepth(disp, DefaultScreen(disp)), ZPixmap, NULL,
+	    &dib->shminfo, width, height);
+	if (img == NULL)
+		return FALSE;
+	if (img->bits_per_pixel != 32) {
+		XDestroyImage(img);
+		return FALSE;
+	}
+
+	dib->size = (size_t)img->bytes_per_line * img->height;
+	dib->shminfo.shmid = shmget(IPC_PRIVATE, dib->size, IPC_CREAT | 0600);
+	if (dib->shminfo.shmid == -1) {
+		XDestroyImage(img);
+		return FALSE;
+	}
+	dib->shminfo.shmaddr = shmat(dib->shminfo.shmid, NULL, 0);
+	if (dib->shminfo.shmaddr == (char *)-1) {
+		dib->shminfo.shmaddr = NULL;
+		shmctl(dib->shminfo.shmid, IPC_RMID, NULL);
+		XDestroyImage(img);
+		return FALSE;
+	}
+	dib->shminfo.readOnly = False;
+	img->data = dib->shminfo.shmaddr;
+
+	dib->image = img;
+	dib->bits = img->data;
+	dib->shm = TRUE;
+	return TRUE;
+}
+
+/*
+ * Have the server attach the segment of dib. Attaching fails on a remote
+ * display, which is only found out synchronously, so it waits until the
+ * bitmap is first sent to a window. The display stays locked while the
+ * error handler is swapped so no other thread's errors end up in it. On
+ * failure the image goes out with XPutImage from then on.
+ */
+static void
+dib_attach(struct w32x_dib *dib)
+{
+	XErrorHandler old_handler;
+
+	XLockDisplay(disp);
+	if (!dib->shm || dib->attached) {
+		/* Another thread got here first */
+		XUnlockDisplay(disp);
+		return;
+	}
+	if (shm_available) {
+		XSync(disp, False);
+		shm_error = 0;
+		old_handler = XSetErrorHandler(shm_error_handler);
+		XShmAttach(disp, &dib->shminfo);
+		XSync(disp, False);
+		XSetErrorHandler(old_handler);
+		if (shm_error)
+			shm_available = FALSE;
+		else
+			dib->attached = TRUE;
+	}
+
+	/* The segment goes away once both sides have detached */
+	shmctl(dib->shminfo.shmid, IPC_RMID, NULL);
+	if (!dib->attached)
+		dib->shm = FALSE;
+	XUnlockDisplay(disp);
+}
+#endif
+
+/* Whether dib can be sent with XShmPutImage, attaching it if need be */
+static BOOL
+dib_shm_ready(struct w32x_dib *dib)
+{
+#ifdef HAVE_XSHM_H
+	if (dib->shm && !dib->attached)
+		dib_attach(dib);
+#endif
+	return dib->shm;
+}
+
+/* Allocate a bitmap; with for_window set it gets an XImage (in shared
+ * memory if possible) to send it with. */
+static struct w32x_dib *
+dib_alloc(int width, int height, BOOL for_window)
+{
+	struct w32x_dib *dib;
+
+	dib = calloc(1, sizeof(struct w32x_dib));
+	if (dib == NULL)
+		return NULL;
+	dib->width = width;
+	dib->height = height;
+
+	if (disp == NULL)
+		for_window = FALSE;
+
+#ifdef HAVE_XSHM_H
+	if (for_window && shm_probe() && dib_alloc_shm(dib, width, height))
+		return dib;
+#endif
+
+	/* Plain client side memory, sent with XPutImage */
+	dib->size = (size_t)width * height * 4;
+	dib->bits = calloc(1, dib->size);
+	if (dib->bits != NULL && !for_window)
+		return dib;
+	if (dib->bits != NULL) {
+		dib->image = XCreateImage(disp,
+		    DefaultVisual(disp, DefaultScreen(disp)),
+		    DefaultDepth(disp, DefaultScreen(disp)), ZPixmap, 0,
+		    dib->bits, width, height, 32, width * 4);
+	}
+	if (dib->image == NULL) {
+		free(dib->bits);
+		free(dib);
+		return NULL;
+	}
+	dib->image->byte_order = LSBFirst;
+	return dib;
+}
+
+static void
+dib_free(struct w32x_dib *dib)
+{
+#ifdef HAVE_XSHM_H
+	if (dib->shminfo.shmaddr != NULL) {
+		if (dib->attached)
+			XShmDetach(disp, &dib->shminfo);
+		else if (dib->shm)
+			shmctl(dib->shminfo.shmid, IPC_RMID, NULL);
+		shmdt(dib->shminfo.shmaddr);
+		dib->image->data = NULL;
+	}
+#endif
+	/* Frees the bits of a non shared image too */
+	if (dib->image != NULL)
+		XDestroyImage(dib->image);
+	else
+		free(dib->bits);
+	free(dib);
+}
+
+void
+w32x_dib_destroy(struct w32x_dib *dib)
+{
+	if (dib == NULL)
+		return;
+
+	w32x_lock();
+	LIST_REMOVE(dib, entries);
+	w32x_unlock();
+	dib_free(dib);
+}
+
+static struct w32x_dib *
+dib_find(const void *bits)
+{
+	struct w32x_dib *dib;
+	const char *p = bits;
+
+	w32x_lock();
+	LIST_FOREACH(dib, &dib_sections, entries) {
+		if (p >= (char *)dib->bits && p < (char *)dib->bits + dib->size)
+			break;
+	}
+	w32x_unlock();
+	return dib;
+}
+
+/* Describe client memory as an XImage without allocating */
+static void
+init_client_image(XImage *img, const void *bits, int width, int height)
+{
+	memset(img, 0, sizeof(XImage));
+	img->width = width;
+	img->height = height;
+	img->format = ZPixmap;
+	img->data = (char *)bits;
+	img->byte_order = LSBFirst;
+	img->bitmap_unit = 32;
+	img->bitmap_bit_order = LSBFirst;
+	img->bitmap_pad = 32;
+	img->depth = DefaultDepth(disp, DefaultScreen(disp));
+	img->bytes_per_line = width * 4;
+	img->bits_per_pixel = 32;
+	img->red_mask = 0xff0000;
+	img->green_mask = 0xff00;
+	img->blue_mask = 0xff;
+	XInitImage(img);
+}
+
+static void
+dib_put(HDC hdc, XImage *img, BOOL shm, int src_x, int src_y, int dst_x,
+    int dst_y, unsigned int w, unsigned int h)
+{
+	w32x_dc_flush(hdc);
+#ifdef HAVE_XSHM_H
+	if (shm) {
+		XShmPutImage(disp, hdc->drawable, hdc->gc, img, src_x, src_y,
+		    dst_x, dst_y, w, h, False);
+		images_pending = TRUE;
+		return;
+	}
+#endif
+	XPutImage(disp, hdc->drawable, hdc->gc, img, src_x, src_y,
+	    dst_x, dst_y, w, h);
+	images_pending = TRUE;
+}
+
+/* Send scanlines of img, or with img NULL draw those of bits on a memory
+ * DC. */
+static void
+scanlines_put(HDC hdc, XImage *img, BOOL shm, const void *bits, int width,
+    int src_x, int src_y, int dst_x, int dst_y, unsigned int w,
+    unsigned int h)
+{
+	if (img == NULL) {
+		w32x_mem_put_pixels(hdc, dst_x, dst_y, w, h,
+		    (const uint32_t *)bits + (size_t)src_y * width + src_x,
+		    width);
+		return;
+	}
+	dib_put(hdc, img, shm, src_x, src_y, dst_x, dst_y, w, h);
+}
+
+/*
+ * Wait until the server has consumed all pixel data sent so far. Shared
+ * memory must not be rewritten before this.
+ */
+void
+w32x_dib_sync(void)
+{
+	if (images_pending) {
+		XSync(disp, False);
+		images_pending = FALSE;
+	}
+}
+
+HBITMAP
+CreateDIBSection(HDC hdc, const BITMAPINFO *pbmi, UINT usage,
+    void **ppvBits, HANDLE hSection, DWORD offset)
+{
+	const BITMAPINFOHEADER *bih = &pbmi->bmiHeader;
+	struct gdi_bitmap *bmp;
+	struct w32x_dib *dib;
+	HBITMAP hbm;
+	int height;
+
+	if (ppvBits != NULL)
+		*ppvBits = NULL;
+
+	if (hSection != NULL) {
+		fprintf(stderr, "XXX: CreateDIBSection hSection not supported\n");
+		return NULL;
+	}
+	if (!dib_format_supported(bih))
+		return NULL;
+
+	height = bih->biHeight < 0 ? -bih->biHeight : bih->biHeight;
+	dib = dib_alloc(bih->biWidth, height, TRUE);
+	if (dib == NULL)
+		return NULL;
+
+	hbm = w32x_gdi_alloc(GDI_TYPE_BITMAP, (void **)&bmp);
+	if (hbm == NULL) {
+		dib_free(dib);
+		return NULL;
+	}
+	bmp->dib = dib;
+	dib->bottom_up = bih->biHeight > 0;
+	w32x_lock();
+	LIST_INSERT_HEAD(&dib_sections, dib, entries);
+	w32x_unlock();
+
+	if (ppvBits != NULL)
+		*ppvBits = dib->bits;
+	return hbm;
+}
+
+/*
+ * Compatible bitmaps are 32 bit top-down DIBs whose bits the application
+ * does not see. They are meant to be selected into a memory DC and read
+ * back with GetDIBits, so they are plain memory and never shared with
+ * the server.
+ */
+HBITMAP
+CreateCompatibleBitmap(HDC hdc, int cx, int cy)
+{
+	struct gdi_bitmap *bmp;
+	struct w32x_dib *dib;
+	HBITMAP hbm;
+
+	if (cx <= 0 || cy <= 0) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return NULL;
+	}
+	if ((dib = dib_alloc(cx, cy, FALSE)) == NULL) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return NULL;
+	}
+
+	hbm = w32x_gdi_alloc(GDI_TYPE_BITMAP, (void **)&bmp);
+	if (hbm == NULL) {
+		dib_free(dib);
+		return NULL;
+	}
+	bmp->dib = dib;
+	w32x_lock();
+	LIST_INSERT_HEAD(&dib_sections, dib, entries);
+	w32x_unlock();
+	return hbm;
+}
+
+/*
+ * Copy cLines scanlines of a bitmap, starting at scanline start, out as a
+ * 32 bit BI_RGB DIB. As on Win32 scanlines count from the bottom unless
+ * lpbmi asks for a top-down DIB. With lpvBits NULL only the header is
+ * filled in. Returns the number of scanlines copied.
+ */
+int
+GetDIBits(HDC hdc, HBITMAP hbm, UINT start, UINT cLines, LPVOID lpvBits,
+    LPBITMAPINFO lpbmi, UINT usage)
+{
+	BITMAPINFOHEADER *bih = &lpbmi->bmiHeader;
+	struct gdi_bitmap *bmp = w32x_gdi_get(hbm, GDI_TYPE_BITMAP);
+	struct w32x_surface s;
+	uint32_t *dst;
+	UINT i, n;
+	int y;
+
+	if (bmp == NULL || bih->biSize < sizeof(BITMAPINFOHEADER)) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return 0;
+	}
+	w32x_dib_surface(bmp->dib, &s);
+
+	if (lpvBits == NULL) {
+		bih->biWidth = s.width;
+		bih->biHeight = s.height;
+		bih->biPlanes = 1;
+		bih->biBitCount = 32;
+		bih->biCompression = BI_RGB;
+		bih->biSizeImage = (DWORD)s.width * s.height * 4;
+		return s.height;
+	}
+
+	if (bih->biBitCount != 32 || bih->biCompression != BI_RGB) {
+		fprintf(stderr, "XXX: GetDIBits only supports 32 bit BI_RGB\n");
+		return 0;
+	}
+	if (bih->biWidth != s.width) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return 0;
+	}
+	if (start >= (UINT)s.height)
+		return 0;
+	n = cLines < s.height - start ? cLines : s.height - start;
+
+	/* Drawing on memory DCs is synchronous, so there is nothing to wait
+	 * for before reading the bits */
+	dst = lpvBits;
+	for (i = 0; i < n; i++) {
+		y = bih->biHeight < 0 ? (int)(start + i) :
+		    s.height - 1 - (int)(start + i);
+		memcpy(dst, s.bits + (ptrdiff_t)y * s.pitch, s.width * 4);
+		dst += s.width;
+	}
+	return n;
+}
+
+/* Describe the pixels of a bitmap to the software rasterizer */
+void
+w32x_dib_surface(const struct w32x_dib *dib, struct w32x_surface *s)
+{
+	int stride = dib->image != NULL ?
+	    dib->image->bytes_per_line / 4 : dib->width;
+
+	s->width = dib->width;
+	s->height = dib->height;
+	if (dib->bottom_up) {
+		s->bits = (uint32_t *)dib->bits +
+		    (ptrdiff_t)(dib->height - 1) * stride;
+		s->pitch = -stride;
+	} else {
+		s->bits = dib->bits;
+		s->pitch = stride;
+	}
+}
+
+/* Make sure the scratch image can hold at least width x height pixels. */
+static BOOL
+scratch_reserve(int width, int height)
+{
+	if (scratch != NULL && scratch->width >= width &&
+	    scratch->height >= height)
+		return TRUE;
+
+	if (scratch != NULL) {
+		w32x_dib_sync();
+		dib_free(scratch);
+	}
+	scratch = dib_alloc(width, height, TRUE);
+	return scratch != NULL;
+}
+
+/*
+ * Bits that belong to a DIB section go out with XShmPutImage when the
+ * section lives in shared memory; anything else is sent with XPutImage.
+ * Top-down DIBs are sent as they are. Bottom-up scanlines are flipped
+ * into the scratch image first, so either way a call is one request.
+ */
+int
+SetDIBitsToDevice(HDC hdc, int xDest, int yDest, DWORD w, DWORD h,
+    int xSrc, int ySrc, UINT StartScan, UINT cLines, const void *lpvBits,
+    const BITMAPINFO *lpbmi, UINT ColorUse)
+{
+	const BITMAPINFOHEADER *bih = &lpbmi->bmiHeader;
+	struct w32x_dib *dib;
+	XImage client, *img;
+	struct w32x_surface out;
+	const uint32_t *src;
+	BOOL shm = FALSE;
+	int base, stride;
+	int first, last, k;
+
+	if (!dib_format_supported(bih))
+		return 0;
+
+	/* Clip the source to the bitmap width */
+	if (xSrc < 0) {
+		xDest -= xSrc;
+		w = (int)w > -xSrc ? w + xSrc : 0;
+		xSrc = 0;
+	}
+	if (xSrc + (int)w > bih->biWidth)
+		w = xSrc < bih->biWidth ? bih->biWidth - xSrc : 0;
+	if (w == 0 || h == 0 || cLines == 0)
+		return 0;
+
+	/* Only scanlines first to last of the source rectangle were passed */
+	first = ySrc > (int)StartScan ? ySrc : (int)StartScan;
+	last = ySrc + (int)h < (int)(StartScan + cLines) ?
+	    ySrc + (int)h : (int)(StartScan + cLines);
+	if (first >= last)
+		return cLines;
+
+	stride = bih->biWidth * 4;
+	if (hdc->mem) {
+		/* Memory DCs read the scanlines straight out of lpvBits */
+		img = NULL;
+		base = 0;
+	} else if ((dib = dib_find(lpvBits)) != NULL) {
+		img = dib->image;
+		shm = dib_shm_ready(dib);
+		base = ((const char *)lpvBits - (char *)dib->bits) / stride;
+	} else {
+		init_client_image(&client, lpvBits, bih->biWidth, cLines);
+		img = &client;
+		base = 0;
+	}
+
+	if (bih->biHeight < 0) {
+		/* Scanlines are in display order */
+		scanlines_put(hdc, img, shm, lpvBits, bih->biWidth, xSrc,
+		    base + first - StartScan, xDest, yDest + first - ySrc,
+		    w, last - first);
+	} else {
+		/* Scanlines count up from the bottom of the source
+		 * rectangle, so the last one goes at the top */
+		yDest += ySrc + (int)h - last;
+		src = (const uint32_t *)lpvBits +
+		    (size_t)(last - 1 - StartScan) * bih->biWidth + xSrc;
+
+		if (hdc->mem) {
+			/* Memory DCs walk the rows backwards instead */
+			w32x_mem_put_pixels(hdc, xDest, yDest, w, last - first,
+			    src, -bih->biWidth);
+			return cLines;
+		}
+
+		if (!scratch_reserve(w, last - first))
+			return 0;
+		/* The server may still be reading the last image out of
+		 * the scratch segment */
+		if (scratch->shm)
+			w32x_dib_sync();
+		w32x_dib_surface(scratch, &out);
+		for (k = 0; k < last - first; k++) {
+			memcpy(out.bits + (ptrdiff_t)k * out.pitch,
+			    src - (ptrdiff_t)k * bih->biWidth, w * 4);
+		}
+		dib_put(hdc, scratch->image, dib_shm_ready(scratch), 0, 0,
+		    xDest, yDest, w, last - first);
+	}
+
+	return cLines;
+}
+
+/*
+ * Scales with nearest neighbour sampling into a scratch image, then sends
+ * that. Negative widths and heights mirror the image, as on Win32.
+ */
+int
+StretchDIBits(HDC hdc, int xDest, int yDest, int DestWidth, int DestHeight,
+    int xSrc, int ySrc, int SrcWidth, int SrcHeight, const void *lpBits,
+    const BITMAPINFO *lpbmi, UINT iUsage, DWORD rop)
+{
+	const BITMAPINFOHEADER *bih = &lpbmi->bmiHeader;
+	struct w32x_surface out;
+	const uint32_t *src_row;
+	uint32_t *dst_row;
+	int dw, dh, sw, sh, x, y, sx, sy, rows;
+	BOOL flip_x, flip_y;
+
+	if (rop != SRCCOPY) {
+		fprintf(stderr, "XXX: StretchDIBits only supports SRCCOPY\n");
+		return 0;
+	}
+	if (!dib_format_supported(bih))
+		return 0;
+
+	rows = bih->biHeight < 0 ? -bih->biHeight : bih->biHeight;
+	if (DestWidth == SrcWidth && DestHeight == SrcHeight &&
+	    DestWidth > 0 && DestHeight > 0) {
+		return SetDIBitsToDevice(hdc, xDest, yDest, DestWidth,
+		    DestHeight, xSrc, ySrc, 0, rows, lpBits, lpbmi, iUsage) ?
+		    DestHeight : 0;
+	}
+
+	dw = DestWidth < 0 ? -DestWidth : DestWidth;
+	dh = DestHeight < 0 ? -DestHeight : DestHeight;
+	sw = SrcWidth < 0 ? -SrcWidth : SrcWidth;
+	sh = SrcHeight < 0 ? -SrcHeight : SrcHeight;
+	if (dw == 0 || dh == 0 || sw == 0 || sh == 0)
+		return 0;
+	flip_x = (DestWidth < 0) != (SrcWidth < 0);
+	flip_y = (DestHeight < 0) != (SrcHeight < 0);
+	if (DestWidth < 0)
+		xDest += DestWidth;
+	if (DestHeight < 0)
+		yDest += DestHeight;
+
+	if (!scratch_reserve(dw, dh))
+		return 0;
+	if (scratch_xmap_len < dw) {
+		int *xmap = realloc(scratch_xmap, dw * sizeof(int));
+		if (xmap == NULL)
+			return 0;
+		scratch_xmap = xmap;
+		scratch_xmap_len = dw;
+	}
+
+	/* The server may still be reading the last frame out of the
+	 * scratch segment */
+	if (scratch->shm)
+		w32x_dib_sync();
+	w32x_dib_surface(scratch, &out);
+
+	for (x = 0; x < dw; x++) {
+		sx = xSrc + (int)((long)x * sw / dw);
+		if (flip_x)
+			sx = xSrc + sw - 1 - (sx - xSrc);
+		if (sx < 0)
+			sx = 0;
+		else if (sx >= bih->biWidth)
+			sx = bih->biWidth - 1;
+		scratch_xmap[x] = sx;
+	}
+
+	for (y = 0; y < dh; y++) {
+		/* sy counts down from the top of the source rectangle */
+		sy = (int)((long)y * sh / dh);
+		if (flip_y)
+			sy = sh - 1 - sy;
+		if (bih->biHeight < 0)
+			sy = ySrc + sy;
+		else
+			sy = ySrc + sh - 1 - sy;
+		if (sy < 0)
+			sy = 0;
+		else if (sy >= rows)
+			sy = rows - 1;
+
+		src_row = (const uint32_t *)lpBits + (size_t)sy * bih->biWidth;
+		dst_row = out.bits + (ptrdiff_t)y * out.pitch;
+		for (x = 0; x < dw; x++)
+			dst_row[x] = src_row[scratch_xmap[x]];
+	}
+
+	if (hdc->mem) {
+		w32x_mem_put_pixels(hdc, xDest, yDest, dw, dh, out.bits,
+		    out.pitch);
+	} else {
+		dib_put(hdc, scratch->image, dib_shm_ready(scratch), 0, 0,
+		    xDest, yDest, dw, dh);
+	}
+
+	return dh;
+}
@@ -33,6 +33,7 @@
 
 struct RadioButtonInfo {
 	int activated;
+	int pressed;
 };
 
 static LRESULT CALLBACK RadioButtonProc(HWND wnd, unsigned int msg,
@@ -48,9 +49,10 @@ WNDCLASS ButtonClass = {
 
 static void
 drawRadioButton(HWND wnd, int x, int y, unsigned int w,
-    unsigned int h, int clicked)
+    unsigned int h, int pressed)
 {
 	PAINTSTRUCT ps;
+	TEXTMETRIC tm;
 	struct RadioButtonInfo *extra;
 	char label[256];
 
@@ -62,8 +64,7 @@ drawRadioButton(HWND wnd, int x, int y, unsigned int w,
 	SelectObject(hdc, GetStockObject(DC_BRUSH));
 	SelectObject(hdc, GetStockObject(BLACK_PEN));
 
-	if (clicked) {
-		extra->activated = extra->activated ? 0 : 1;
+	if (pressed) {
 		SetDCBrushColor(hdc, RGB(0x80, 0x80, 0x80));
 	} else {
 		SetDCBrushColor(hdc, RGB(0xe0, 0xe0, 0xe0));
@@ -82,28 +83,35 @@ drawRadioButton(HWND wnd, int x, int y, unsigned int w,
 	    ((h - RBDIAM) / 2) + RBDIAM);
 
 	SelectObject(hdc, GetStockObject(SYSTEM_FONT));
-	TextOut(hdc, RB_X * 2 + RBDIAM, h, label, strlen(label));
+	GetTextMetrics(hdc, &tm);
+	TextOut(hdc, RB_X * 2 + RBDIAM, (h - tm.tmHeight) / 2, label,
+	    strlen(label));
+
+	EndPaint(wnd, &ps);
 }
 
 static LRESULT CALLBACK
 RadioButtonProc(HWND wnd, unsigned int msg, WPARAM wParam, LPARAM lParam)
 {
 	RECT winRect;
+	struct RadioButtonInfo *extra = GetWindowLongPtr(wnd, 0);
 
 	GetClientRect(wnd, &winRect);
 
+	/* Clicks only change state; drawing happens in WM_PAINT */
 	switch (msg) {
 	case WM_LBUTTONDOWN:
-		drawRadioButton(wnd, winRect.left, winRect.top,
-		    winRect.right, winRect.bottom, 1);
+		extra->activated = extra->activated ? 0 : 1;
+		extra->pressed = 1;
+		InvalidateRect(wnd, NULL, TRUE);
 		break;
 	case WM_LBUTTONUP:
-		drawRadioButton(wnd, winRect.left, winRect.top,
-		    winRect.right, winRect.bottom, 0);
+		extra->pressed = 0;
+		InvalidateRect(wnd, NULL, TRUE);
 		break;
 	case WM_PAINT:
 		drawRadioButton(wnd, winRect.left, winRect.top,
-		    winRect.right, winRect.bottom, 0);
+		    winRect.right, winRect.bottom, extra->pressed);
 		break;
 	default:
 		return DefWindowProc(wnd, msg, wParam, lParam);
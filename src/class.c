@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2018 Devin Smith <devin@devinsmith.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef HAVE_XFT_H
+#include <X11/Xft/Xft.h>
+#endif
+
+#include <windows.h>
+#include "w32x_priv.h"
+
+/*
+ * Window classes.
+ *
+ * Registering a class interns its name: the class gets an ATOM, which
+ * indexes a flat array, and the name goes into an open addressing table
+ * so it is hashed once per lookup instead of compared against every
+ * registered class. CreateWindowEx takes either the name or
+ * MAKEINTATOM(atom); the atom skips hashing and string compares
+ * altogether. As on Win32, class names are case insensitive.
+ */
+
+#define CLASS_ATOM_BASE 0xc000 /* first atom, as on Win32 */
+#define CLASS_MAX (0x10000 - CLASS_ATOM_BASE)
+#define CLASS_HASH_MIN_SIZE 64
+
+extern int blackpixel;
+
+static WndClass **classes; /* indexed by atom - CLASS_ATOM_BASE */
+static unsigned int nclasses;
+static unsigned int classes_size;
+
+static WndClass **class_hash; /* open addressing, NULL when empty */
+static unsigned int class_hash_mask;
+
+static uint32_t
+class_hash_name(const char *name)
+{
+	uint32_t h = 2166136261u;
+
+	while (*name != '\0')
+		h = (h ^ tolower((unsigned char)*name++)) * 16777619u;
+	return h;
+}
+
+static WndClass **
+class_hash_find(const char *name, uint32_t h)
+{
+	unsigned int i = h & class_hash_mask;
+
+	while (class_hash[i] != NULL && (class_hash[i]->hash != h ||
+	    strcasecmp(class_hash[i]->name, name) != 0))
+		i = (i + 1) & class_hash_mask;
+	return &class_hash[i];
+}
+
+/* Rehash into a table of size slots. */
+static BOOL
+class_hash_resize(unsigned int size)
+{
+	WndClass **old = class_hash;
+	unsigned int i;
+
+	class_hash = calloc(size, sizeof(WndClass *));
+	if (class_hash == NULL) {
+		class_hash = old;
+		return FALSE;
+	}
+	class_hash_mask = size - 1;
+
+	/* Every class is in the atom array, no need to walk the old table */
+	for (i = 0; i < nclasses; i++)
+		*class_hash_find(classes[i]->name, classes[i]->hash) = classes[i];
+	free(old);
+	return TRUE;
+}
+
+static WndClass *
+class_lookup(const char *name)
+{
+	uintptr_t atom = (uintptr_t)name;
+
+	if (IS_INTRESOURCE(name)) {
+		if (atom < CLASS_ATOM_BASE ||
+		    atom - CLASS_ATOM_BASE >= nclasses)
+			return NULL;
+		return classes[atom - CLASS_ATOM_BASE];
+	}
+
+	if (class_hash == NULL)
+		return NULL;
+	return *class_hash_find(name, class_hash_name(name));
+}
+
+/* Look a class up by name or by MAKEINTATOM atom. Classes are never
+ * freed, so the result stays valid after the lock is dropped. */
+WndClass *
+get_class_by_name(const char *name)
+{
+	WndClass *wc;
+
+	if (name == NULL)
+		return NULL;
+	w32x_lock();
+	wc = class_lookup(name);
+	w32x_unlock();
+	return wc;
+}
+
+static ATOM
+register_class(const char *name, HBRUSH hbrBackground, WNDPROC proc,
+    size_t wndExtra)
+{
+	WndClass *wc, **p;
+	COLORREF cr;
+	uint32_t h;
+
+	if (name == NULL || IS_INTRESOURCE(name) || proc == NULL) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return 0;
+	}
+
+	h = class_hash_name(name);
+	if (class_hash != NULL && *class_hash_find(name, h) != NULL) {
+		SetLastError(ERROR_CLASS_ALREADY_EXISTS);
+		return 0;
+	}
+	if (nclasses == CLASS_MAX) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return 0;
+	}
+
+	/* Keep the name table under half full */
+	if (class_hash == NULL || (nclasses + 1) * 2 > class_hash_mask + 1) {
+		if (!class_hash_resize(class_hash == NULL ?
+		    CLASS_HASH_MIN_SIZE : (class_hash_mask + 1) * 2)) {
+			SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+			return 0;
+		}
+	}
+	if (nclasses == classes_size) {
+		p = realloc(classes, (classes_size + 64) * sizeof(WndClass *));
+		if (p == NULL) {
+			SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+			return 0;
+		}
+		classes = p;
+		classes_size += 64;
+	}
+
+	if (hbrBackground >= (HBRUSH)(COLOR_SCROLLBAR + 1) &&
+	    hbrBackground <= (HBRUSH)(COLOR_MENUBAR + 1)) {
+		cr = GetSysColor(((long)hbrBackground) - 1);
+	} else {
+		LOGBRUSH lb;
+
+		GetObject(hbrBackground, sizeof(LOGBRUSH), &lb);
+		cr = lb.lbColor;
+	}
+
+	wc = calloc(1, sizeof(WndClass));
+	if (wc == NULL || (wc->name = strdup(name)) == NULL) {
+		free(wc);
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return 0;
+	}
+	wc->hash = h;
+	wc->atom = CLASS_ATOM_BASE + nclasses;
+	wc->border_pixel = blackpixel;
+	wc->background_pixel = w32x_color_to_pixel(cr);
+	wc->wndExtra = wndExtra;
+	wc->proc = proc;
+
+	*class_hash_find(name, h) = wc;
+	classes[nclasses++] = wc;
+
+	return wc->atom;
+}
+
+ATOM
+RegisterClass(const WNDCLASS *wndClass)
+{
+	ATOM atom;
+
+	if (wndClass == NULL) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return 0;
+	}
+	w32x_lock();
+	atom = register_class(wndClass->lpszClassName,
+	    wndClass->hbrBackground, wndClass->lpfnWndProc,
+	    wndClass->cbWndExtra);
+	w32x_unlock();
+	return atom;
+}
+
+ATOM
+RegisterClassEx(const WNDCLASSEX *wndClass)
+{
+	ATOM atom;
+
+	if (wndClass == NULL || wndClass->cbSize != sizeof(WNDCLASSEX) ||
+	    wndClass->cbWndExtra < 0) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return 0;
+	}
+	w32x_lock();
+	atom = register_class(wndClass->lpszClassName,
+	    wndClass->hbrBackground, wndClass->lpfnWndProc,
+	    wndClass->cbWndExtra);
+	w32x_unlock();
+	return atom;
+}
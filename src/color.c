@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2018 Devin Smith <devin@devinsmith.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef HAVE_XFT_H
+#include <X11/Xft/Xft.h>
+#endif
+
+#include <windows.h>
+#include "w32x_priv.h"
+
+/*
+ * COLORREF to pixel conversion.
+ *
+ * On TrueColor and DirectColor visuals the pixel is computed from the
+ * visual masks. Other visuals go through a COLORREF -> pixel hash table
+ * filled from a snapshot of the colormap. PseudoColor maps get a color
+ * cube stored into them first, allocated in one request, so there is a
+ * reasonable match for any color. Either way, only the first lookup on a
+ * mapped visual talks to the server.
+ */
+
+extern Display *disp;
+extern Colormap colormap;
+
+#define COLOR_CACHE_SIZE 1024 /* power of two */
+#define COLOR_CACHE_EMPTY 0xffffffff /* never a valid COLORREF */
+
+struct channel {
+	int shift;
+	unsigned long max; /* largest value of the channel */
+};
+
+struct color_slot {
+	COLORREF cr;
+	unsigned long pixel;
+};
+
+static BOOL direct;
+static struct channel red, green, blue;
+
+static BOOL mapped_ready;
+static XColor *cells;
+static int ncells;
+static struct color_slot cache[COLOR_CACHE_SIZE];
+static int cache_used;
+
+static void
+channel_init(struct channel *c, unsigned long mask)
+{
+	c->shift = 0;
+	while (mask != 0 && (mask & 1) == 0) {
+		mask >>= 1;
+		c->shift++;
+	}
+	c->max = mask;
+}
+
+static unsigned long
+channel_value(const struct channel *c, unsigned int v)
+{
+	return ((v * c->max + 127) / 255) << c->shift;
+}
+
+/* Called once the display is open. */
+void
+w32x_color_init(void)
+{
+	Visual *visual = DefaultVisual(disp, DefaultScreen(disp));
+
+	if (visual->class == TrueColor || visual->class == DirectColor) {
+		direct = TRUE;
+		channel_init(&red, visual->red_mask);
+		channel_init(&green, visual->green_mask);
+		channel_init(&blue, visual->blue_mask);
+	}
+}
+
+static void
+cache_clear(void)
+{
+	int i;
+
+	for (i = 0; i < COLOR_CACHE_SIZE; i++)
+		cache[i].cr = COLOR_CACHE_EMPTY;
+	cache_used = 0;
+}
+
+/*
+ * Store a color cube in private cells of a PseudoColor map. The cells are
+ * allocated in a single request, trying smaller cubes while the map is
+ * too full.
+ */
+static void
+store_color_cube(void)
+{
+	unsigned long pixels[6 * 6 * 6];
+	XColor defs[6 * 6 * 6];
+	int n, r, g, b, i;
+
+	for (n = 6; n >= 2; n--) {
+		if (XAllocColorCells(disp, colormap, False, NULL, 0, pixels,
+		    n * n * n))
+			break;
+	}
+	if (n < 2)
+		return;
+
+	i = 0;
+	for (r = 0; r < n; r++) {
+		for (g = 0; g < n; g++) {
+			for (b = 0; b < n; b++) {
+				defs[i].pixel = pixels[i];
+				defs[i].red = r * 65535 / (n - 1);
+				defs[i].green = g * 65535 / (n - 1);
+				defs[i].blue = b * 65535 / (n - 1);
+				defs[i].flags = DoRed | DoGreen | DoBlue;
+				i++;
+			}
+		}
+	}
+	XStoreColors(disp, colormap, defs, i);
+}
+
+/* Read the whole colormap back in one round trip. */
+static void
+mapped_init(void)
+{
+	Visual *visual = DefaultVisual(disp, DefaultScreen(disp));
+	int i;
+
+	mapped_ready = TRUE;
+	cache_clear();
+
+	if (visual->class == PseudoColor)
+		store_color_cube();
+
+	ncells = visual->map_entries;
+	cells = calloc(ncells, sizeof(XColor));
+	if (cells == NULL) {
+		ncells = 0;
+		return;
+	}
+	for (i = 0; i < ncells; i++)
+		cells[i].pixel = i;
+	XQueryColors(disp, colormap, cells, ncells);
+}
+
+static unsigned long
+nearest_cell(COLORREF cr)
+{
+	long r = GetRValue(cr), g = GetGValue(cr), b = GetBValue(cr);
+	unsigned long best = BlackPixel(disp, DefaultScreen(disp));
+	long best_dist = -1;
+	int i;
+
+	for (i = 0; i < ncells; i++) {
+		long dr = r - (cells[i].red >> 8);
+		long dg = g - (cells[i].green >> 8);
+		long db = b - (cells[i].blue >> 8);
+		/* Weighted for how bright each channel looks */
+		long dist = 3 * dr * dr + 4 * dg * dg + 2 * db * db;
+
+		if (best_dist < 0 || dist < best_dist) {
+			best = cells[i].pixel;
+			best_dist = dist;
+			if (dist == 0)
+				break;
+		}
+	}
+	return best;
+}
+
+static unsigned long
+mapped_pixel(COLORREF cr)
+{
+	unsigned int i;
+
+	if (!mapped_ready)
+		mapped_init();
+
+	/* Fibonacci hash of the 32 bit COLORREF. The table never fills, it
+	 * is reset at 3/4. */
+	i = (cr * 2654435769u) >> 22;
+	for (;;) {
+		if (cache[i].cr == cr)
+			return cache[i].pixel;
+		if (cache[i].cr == COLOR_CACHE_EMPTY)
+			break;
+		i = (i + 1) & (COLOR_CACHE_SIZE - 1);
+	}
+
+	if (cache_used >= COLOR_CACHE_SIZE * 3 / 4) {
+		cache_clear();
+		return mapped_pixel(cr);
+	}
+
+	cache[i].cr = cr;
+	cache[i].pixel = nearest_cell(cr);
+	cache_used++;
+	return cache[i].pixel;
+}
+
+/* Returns the pixel value of the default visual closest to cr. */
+unsigned long
+w32x_color_to_pixel(COLORREF cr)
+{
+	unsigned long pixel;
+
+	cr &= 0xffffff;
+
+	/* Classes are registered without a display too */
+	if (disp == NULL)
+		return 0;
+	if (direct) {
+		return channel_value(&red, GetRValue(cr)) |
+		    channel_value(&green, GetGValue(cr)) |
+		    channel_value(&blue, GetBValue(cr));
+	}
+
+	/* The colormap cache is shared by all threads */
+	w32x_lock();
+	pixel = mapped_pixel(cr);
+	w32x_unlock();
+	return pixel;
+}
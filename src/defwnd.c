@@ -77,6 +77,7 @@ DefWindowProc(HWND wnd, unsigned int msg, WPARAM wParam, LPARAM lParam)
 		break;
 	case WM_PAINT:
 		BeginPaint(wnd, &ps);
+		EndPaint(wnd, &ps);
 		break;
 	case WM_CLOSE:
 		printf("Request to close window\n");
@@ -0,0 +1,695 @@
+/*
+ * Copyright (c) 2018 Devin Smith <devin@devinsmith.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#ifdef HAVE_XFT_H
+#include <X11/Xft/Xft.h>
+#endif
+#include <sys/queue.h>
+
+#include <windows.h>
+#include "w32x_priv.h"
+
+/*
+ * Fonts.
+ *
+ * HFONTs are small handles onto shared server fonts. CreateFontIndirect
+ * normalizes the LOGFONT down to what selects an X font (family, pixel
+ * size, weight and slant) and looks that up in a process wide cache, so
+ * identical fonts share one XFontStruct and one metrics table no matter
+ * how many DCs or windows use them. Fonts no HFONT refers to stay cached
+ * on an LRU list and are unloaded when it grows past FONT_CACHE_UNUSED.
+ *
+ * When a font is loaded its advance widths are read out of the
+ * XFontStruct into a flat 256 entry table, along with the metrics
+ * GetTextMetrics reports. Core font advances are additive, so measuring a
+ * string is one table lookup per character with no XTextWidth call and
+ * no server traffic.
+ *
+ * Memory DCs draw without the server, so a face also has a FreeType face
+ * found through fontconfig, with a metrics table of its own. It is opened
+ * the first time a memory DC uses the font. Without a display that is
+ * the only font a face has.
+ */
+
+#define W32X_XFLD_DEFAULT_FONT "7x14"
+#define W32X_DEFAULT_PIXEL_SIZE 14
+
+#define FONT_HASH_SIZE 64 /* power of two */
+#define FONT_CACHE_UNUSED 16
+
+struct w32x_font {
+	LOGFONT key; /* normalized */
+	unsigned int hash;
+	XFontStruct *xfont;
+	struct w32x_font_metrics metrics;
+#ifdef HAVE_XFT_H
+	XftFont *xft; /* opened the first time Unicode text is drawn */
+	FT_Face ft; /* opened the first time a memory DC draws with it */
+	BOOL ft_missing; /* fontconfig or FreeType had nothing for it */
+	struct w32x_font_metrics ft_metrics;
+#endif
+	int refs; /* HFONTs using it */
+
+	struct w32x_font *next; /* hash chain */
+	TAILQ_ENTRY(w32x_font) lru; /* only while refs is 0 */
+};
+
+extern Display *disp;
+
+static struct w32x_font *font_hash[FONT_HASH_SIZE];
+static TAILQ_HEAD(, w32x_font) font_lru = TAILQ_HEAD_INITIALIZER(font_lru);
+static int font_unused;
+
+/* Windows face names and the X families that stand in for them */
+static const struct {
+	const char *face;
+	const char *family;
+} face_aliases[] = {
+	{ "arial", "helvetica" },
+	{ "ms sans serif", "helvetica" },
+	{ "ms shell dlg", "helvetica" },
+	{ "tahoma", "helvetica" },
+	{ "verdana", "helvetica" },
+	{ "times new roman", "times" },
+	{ "ms serif", "times" },
+	{ "courier new", "courier" },
+	{ "system", "fixed" },
+	{ "fixedsys", "fixed" },
+	{ "terminal", "fixed" },
+};
+
+static Atom average_width = None;
+
+#ifdef HAVE_XFT_H
+static FT_Library ft_library;
+#endif
+
+/* X marks characters that are missing from a font with all zero
+ * metrics. */
+static BOOL
+char_exists(const XCharStruct *cs)
+{
+	return cs->width != 0 || cs->lbearing != 0 || cs->rbearing != 0 ||
+	    cs->ascent != 0 || cs->descent != 0;
+}
+
+/* Width of character c in the first row of the font, -1 if missing. */
+static int
+char_width(const XFontStruct *fs, unsigned int c)
+{
+	const XCharStruct *cs;
+
+	if (fs->min_byte1 != 0 || c < fs->min_char_or_byte2 ||
+	    c > fs->max_char_or_byte2)
+		return -1;
+
+	if (fs->per_char == NULL)
+		return fs->max_bounds.width;
+
+	cs = &fs->per_char[c - fs->min_char_or_byte2];
+	return char_exists(cs) ? cs->width : -1;
+}
+
+/* Guess weight and slant from the XLFD name, e.g.
+ * -misc-fixed-bold-r-normal--14-130-75-75-c-70-iso8859-1 */
+static void
+metrics_from_name(struct w32x_font_metrics *m, const XFontStruct *fs)
+{
+	unsigned long atom;
+	char *name, *field;
+	int i;
+
+	m->weight = FW_NORMAL;
+	m->italic = FALSE;
+
+	if (!XGetFontProperty((XFontStruct *)fs, XA_FONT, &atom))
+		return;
+	if ((name = XGetAtomName(disp, atom)) == NULL)
+		return;
+
+	/* Weight is the third field, slant the fourth */
+	field = name;
+	for (i = 0; i < 3 && field != NULL; i++)
+		field = strchr(field + 1, '-');
+	if (field != NULL) {
+		if (strncasecmp(field, "-bold-", 6) == 0 ||
+		    strncasecmp(field, "-demibold-", 10) == 0)
+			m->weight = FW_BOLD;
+		field = strchr(field + 1, '-');
+		if (field != NULL && (strncasecmp(field, "-i-", 3) == 0 ||
+		    strncasecmp(field, "-o-", 3) == 0))
+			m->italic = TRUE;
+	}
+	XFree(name);
+}
+
+static void
+metrics_build(struct w32x_font_metrics *m, const XFontStruct *fs)
+{
+	unsigned long value;
+	int def, c, w;
+
+	m->ascent = fs->ascent;
+	m->descent = fs->descent;
+	m->max_width = fs->max_bounds.width;
+	m->fixed_pitch = fs->min_bounds.width == fs->max_bounds.width;
+	m->first_char = fs->min_byte1 == 0 ? fs->min_char_or_byte2 : 0;
+	m->last_char = fs->min_byte1 == 0 ?
+	    (fs->max_char_or_byte2 > 255 ? 255 : fs->max_char_or_byte2) : 0;
+	m->default_char = fs->default_char <= 255 ? fs->default_char : 0;
+
+	/* Missing characters are drawn as the default character */
+	def = char_width(fs, fs->default_char);
+	if (def < 0)
+		def = 0;
+	for (c = 0; c < 256; c++) {
+		w = char_width(fs, c);
+		m->advance[c] = w >= 0 ? w : def;
+	}
+
+	/* AVERAGE_WIDTH is in tenths of a pixel */
+	if (average_width == None)
+		average_width = XInternAtom(disp, "AVERAGE_WIDTH", False);
+	if (XGetFontProperty((XFontStruct *)fs, average_width, &value))
+		m->ave_width = (value + 5) / 10;
+	else
+		m->ave_width = m->advance['x'];
+
+	metrics_from_name(m, fs);
+}
+
+/*
+ * Reduce a LOGFONT to the fields that pick an X font. The face name
+ * becomes the X family, so e.g. "Arial" and "Helvetica" share an entry.
+ * Underline and strike out are not part of a server font.
+ */
+static void
+font_normalize(const LOGFONT *lf, LOGFONT *key)
+{
+	char face[LF_FACESIZE];
+	size_t i;
+
+	memset(key, 0, sizeof(LOGFONT));
+	key->lfHeight = lf->lfHeight < 0 ? -lf->lfHeight : lf->lfHeight;
+	if (key->lfHeight == 0)
+		key->lfHeight = W32X_DEFAULT_PIXEL_SIZE;
+	key->lfWidth = lf->lfWidth < 0 ? -lf->lfWidth : lf->lfWidth;
+	key->lfWeight = lf->lfWeight >= FW_SEMIBOLD ? FW_BOLD : FW_NORMAL;
+	key->lfItalic = lf->lfItalic ? TRUE : FALSE;
+
+	for (i = 0; i < LF_FACESIZE - 1 && lf->lfFaceName[i] != '\0'; i++)
+		face[i] = tolower((unsigned char)lf->lfFaceName[i]);
+	face[i] = '\0';
+
+	if (face[0] == '\0') {
+		/* No face, go by pitch and family */
+		if ((lf->lfPitchAndFamily & 0x3) == FIXED_PITCH ||
+		    (lf->lfPitchAndFamily & 0xf0) == FF_MODERN)
+			strcpy(face, "courier");
+		else if ((lf->lfPitchAndFamily & 0xf0) == FF_ROMAN)
+			strcpy(face, "times");
+		else
+			strcpy(face, "helvetica");
+	}
+	for (i = 0; i < sizeof(face_aliases) / sizeof(face_aliases[0]); i++) {
+		if (strcmp(face, face_aliases[i].face) == 0) {
+			strcpy(face, face_aliases[i].family);
+			break;
+		}
+	}
+	strcpy(key->lfFaceName, face);
+}
+
+static unsigned int
+font_hash_key(const LOGFONT *key)
+{
+	const unsigned char *p = (const unsigned char *)key;
+	unsigned int h = 2166136261u;
+	size_t i;
+
+	/* FNV-1a; normalized keys are zero padded, so hashing all of it is
+	 * well defined */
+	for (i = 0; i < sizeof(LOGFONT); i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h;
+}
+
+/* Load the closest server font, relaxing the request step by step. */
+static XFontStruct *
+font_load(const LOGFONT *key)
+{
+	const char *weight = key->lfWeight == FW_BOLD ? "bold" : "medium";
+	const char *slants[] = { "r", NULL, NULL };
+	char width[16], name[256];
+	XFontStruct *xfont;
+	int i;
+
+	/* Faces call their italics either italic or oblique */
+	if (key->lfItalic) {
+		slants[0] = "i";
+		slants[1] = "o";
+	}
+	if (key->lfWidth != 0)
+		snprintf(width, sizeof(width), "%ld", (long)key->lfWidth * 10);
+	else
+		strcpy(width, "*");
+
+	for (i = 0; slants[i] != NULL; i++) {
+		snprintf(name, sizeof(name),
+		    "-*-%s-%s-%s-normal--%ld-*-*-*-*-%s-iso8859-1",
+		    key->lfFaceName, weight, slants[i], (long)key->lfHeight,
+		    width);
+		if ((xfont = XLoadQueryFont(disp, name)) != NULL)
+			return xfont;
+	}
+
+	/* Any family of the right size and style */
+	snprintf(name, sizeof(name), "-*-*-%s-%s-normal--%ld-*-*-*-*-*-iso8859-1",
+	    weight, slants[0], (long)key->lfHeight);
+	if ((xfont = XLoadQueryFont(disp, name)) != NULL)
+		return xfont;
+
+	fprintf(stderr, "XXX: No font for %s %ld, using %s\n",
+	    key->lfFaceName, (long)key->lfHeight, W32X_XFLD_DEFAULT_FONT);
+	if ((xfont = XLoadQueryFont(disp, W32X_XFLD_DEFAULT_FONT)) != NULL)
+		return xfont;
+	return XLoadQueryFont(disp, "fixed");
+}
+
+/* Unload unreferenced fonts beyond what the cache keeps around. */
+static void
+font_trim(void)
+{
+	struct w32x_font *face, **pp;
+
+	while (font_unused > FONT_CACHE_UNUSED) {
+		face = TAILQ_FIRST(&font_lru);
+		TAILQ_REMOVE(&font_lru, face, lru);
+		font_unused--;
+
+		for (pp = &font_hash[face->hash & (FONT_HASH_SIZE - 1)];
+		    *pp != face; pp = &(*pp)->next)
+			;
+		*pp = face->next;
+
+		if (face->xfont != NULL)
+			XFreeFont(disp, face->xfont);
+#ifdef HAVE_XFT_H
+		if (face->xft != NULL) {
+			w32x_text_forget_font(face->xft);
+			XftFontClose(disp, face->xft);
+		}
+		if (face->ft != NULL)
+			FT_Done_Face(face->ft);
+#endif
+		free(face);
+	}
+}
+
+/* Find or load the font for a LOGFONT, taking a reference to it. */
+static struct w32x_font *
+font_get(const LOGFONT *lf)
+{
+	struct w32x_font *face;
+	LOGFONT key;
+	unsigned int hash;
+
+	font_normalize(lf, &key);
+	hash = font_hash_key(&key);
+
+	for (face = font_hash[hash & (FONT_HASH_SIZE - 1)]; face != NULL;
+	    face = face->next) {
+		if (face->hash == hash &&
+		    memcmp(&face->key, &key, sizeof(LOGFONT)) == 0)
+			break;
+	}
+
+	if (face == NULL) {
+		if ((face = calloc(1, sizeof(struct w32x_font))) == NULL) {
+			SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+			return NULL;
+		}
+		/* Without a display only memory DCs can use the font */
+		if (disp != NULL) {
+			if ((face->xfont = font_load(&key)) == NULL) {
+				free(face);
+				return NULL;
+			}
+			metrics_build(&face->metrics, face->xfont);
+		}
+		face->key = key;
+		face->hash = hash;
+		face->next = font_hash[hash & (FONT_HASH_SIZE - 1)];
+		font_hash[hash & (FONT_HASH_SIZE - 1)] = face;
+	} else if (face->refs == 0) {
+		TAILQ_REMOVE(&font_lru, face, lru);
+		font_unused--;
+	}
+
+	face->refs++;
+	return face;
+}
+
+static void
+font_put(struct w32x_font *face)
+{
+	if (--face->refs == 0) {
+		TAILQ_INSERT_TAIL(&font_lru, face, lru);
+		font_unused++;
+		font_trim();
+	}
+}
+
+HFONT
+CreateFontIndirect(const LOGFONT *lplf)
+{
+	struct gdi_font *font;
+	struct w32x_font *face;
+	HFONT hfont;
+
+	if (lplf == NULL) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return NULL;
+	}
+	/* The face cache is shared by all threads */
+	w32x_lock();
+	if ((face = font_get(lplf)) == NULL) {
+		w32x_unlock();
+		return NULL;
+	}
+
+	hfont = w32x_gdi_alloc(GDI_TYPE_FONT, (void **)&font);
+	if (hfont == NULL) {
+		font_put(face);
+		w32x_unlock();
+		return NULL;
+	}
+	w32x_unlock();
+	font->face = face;
+	font->lf = *lplf;
+	return hfont;
+}
+
+HFONT
+CreateFont(int nHeight, int nWidth, int nEscapement, int nOrientation,
+    int fnWeight, DWORD fdwItalic, DWORD fdwUnderline, DWORD fdwStrikeOut,
+    DWORD fdwCharSet, DWORD fdwOutputPrecision, DWORD fdwClipPrecision,
+    DWORD fdwQuality, DWORD fdwPitchAndFamily, const char *lpszFace)
+{
+	LOGFONT lf;
+
+	memset(&lf, 0, sizeof(lf));
+	lf.lfHeight = nHeight;
+	lf.lfWidth = nWidth;
+	lf.lfEscapement = nEscapement;
+	lf.lfOrientation = nOrientation;
+	lf.lfWeight = fnWeight;
+	lf.lfItalic = fdwItalic;
+	lf.lfUnderline = fdwUnderline;
+	lf.lfStrikeOut = fdwStrikeOut;
+	lf.lfCharSet = fdwCharSet;
+	lf.lfOutPrecision = fdwOutputPrecision;
+	lf.lfClipPrecision = fdwClipPrecision;
+	lf.lfQuality = fdwQuality;
+	lf.lfPitchAndFamily = fdwPitchAndFamily;
+	if (lpszFace != NULL)
+		strncpy(lf.lfFaceName, lpszFace, LF_FACESIZE - 1);
+	return CreateFontIndirect(&lf);
+}
+
+const struct w32x_font_metrics *
+w32x_font_metrics(struct gdi_font *font)
+{
+	return &font->face->metrics;
+}
+
+XFontStruct *
+w32x_font_xfont(struct gdi_font *font)
+{
+	return font->face->xfont;
+}
+
+#ifdef HAVE_XFT_H
+/* fontconfig families for the X families LOGFONTs are mapped to */
+static const char *
+xft_family(const char *family)
+{
+	if (strcmp(family, "helvetica") == 0)
+		return "sans-serif";
+	if (strcmp(family, "times") == 0)
+		return "serif";
+	if (strcmp(family, "courier") == 0 || strcmp(family, "fixed") == 0)
+		return "monospace";
+	return family;
+}
+
+/*
+ * Open the file fontconfig picks for a face with FreeType, the same
+ * pattern w32x_font_xft asks Xft for, and build its metrics table.
+ */
+static BOOL
+ft_open(struct w32x_font *face)
+{
+	struct w32x_font_metrics *m = &face->ft_metrics;
+	FcPattern *pattern, *match;
+	FcResult result;
+	FcChar8 *file;
+	FT_Face ft;
+	FT_UInt def;
+	int index, c;
+
+	if (ft_library == NULL && FT_Init_FreeType(&ft_library) != 0)
+		return FALSE;
+
+	pattern = FcPatternBuild(NULL,
+	    FC_FAMILY, FcTypeString, xft_family(face->key.lfFaceName),
+	    FC_PIXEL_SIZE, FcTypeDouble, (double)face->key.lfHeight,
+	    FC_WEIGHT, FcTypeInteger, face->key.lfWeight == FW_BOLD ?
+	    FC_WEIGHT_BOLD : FC_WEIGHT_MEDIUM,
+	    FC_SLANT, FcTypeInteger, face->key.lfItalic ?
+	    FC_SLANT_ITALIC : FC_SLANT_ROMAN,
+	    NULL);
+	if (pattern == NULL)
+		return FALSE;
+	FcConfigSubstitute(NULL, pattern, FcMatchPattern);
+	FcDefaultSubstitute(pattern);
+	match = FcFontMatch(NULL, pattern, &result);
+	FcPatternDestroy(pattern);
+	if (match == NULL)
+		return FALSE;
+
+	ft = NULL;
+	if (FcPatternGetString(match, FC_FILE, 0, &file) == FcResultMatch) {
+		if (FcPatternGetInteger(match, FC_INDEX, 0, &index) !=
+		    FcResultMatch)
+			index = 0;
+		if (FT_New_Face(ft_library, (const char *)file, index,
+		    &ft) != 0)
+			ft = NULL;
+	}
+	FcPatternDestroy(match);
+	if (ft == NULL)
+		return FALSE;
+	if (FT_Set_Pixel_Sizes(ft, 0, face->key.lfHeight) != 0) {
+		FT_Done_Face(ft);
+		return FALSE;
+	}
+
+	/* Metrics are 26.6 fixed point */
+	m->ascent = (ft->size->metrics.ascender + 63) >> 6;
+	m->descent = (-ft->size->metrics.descender + 63) >> 6;
+	m->max_width = (ft->size->metrics.max_advance + 32) >> 6;
+	m->weight = face->key.lfWeight;
+	m->italic = face->key.lfItalic;
+	m->fixed_pitch = FT_IS_FIXED_WIDTH(ft) ? TRUE : FALSE;
+	m->first_char = ' ';
+	m->last_char = 255;
+	m->default_char = '?';
+
+	/* Missing characters are drawn as the default character */
+	def = FT_Get_Char_Index(ft, m->default_char);
+	for (c = 0; c < 256; c++) {
+		index = FT_Get_Char_Index(ft, c);
+		if (FT_Load_Glyph(ft, index != 0 ? index : def,
+		    FT_LOAD_DEFAULT) == 0)
+			m->advance[c] = (ft->glyph->advance.x + 32) >> 6;
+	}
+	m->ave_width = m->advance['x'];
+
+	face->ft = ft;
+	return TRUE;
+}
+
+/* FreeType face memory DCs draw the font with, NULL if there is none.
+ * Callers hold the library lock while they use it, FreeType faces are
+ * not thread safe. */
+FT_Face
+w32x_font_ft(struct gdi_font *font)
+{
+	struct w32x_font *face = font->face;
+
+	w32x_lock();
+	if (face->ft == NULL && !face->ft_missing && !ft_open(face)) {
+		fprintf(stderr, "XXX: No FreeType font for %s %ld\n",
+		    face->key.lfFaceName, (long)face->key.lfHeight);
+		face->ft_missing = TRUE;
+	}
+	w32x_unlock();
+	return face->ft;
+}
+
+/* Xft counterpart of the core font, for Unicode text (text.c). */
+XftFont *
+w32x_font_xft(struct gdi_font *font)
+{
+	struct w32x_font *face = font->face;
+	XftFont *xft;
+
+	w32x_lock();
+	if (face->xft == NULL) {
+		face->xft = XftFontOpen(disp, DefaultScreen(disp),
+		    XFT_FAMILY, XftTypeString, xft_family(face->key.lfFaceName),
+		    XFT_PIXEL_SIZE, XftTypeDouble, (double)face->key.lfHeight,
+		    XFT_WEIGHT, XftTypeInteger, face->key.lfWeight == FW_BOLD ?
+		    XFT_WEIGHT_BOLD : XFT_WEIGHT_MEDIUM,
+		    XFT_SLANT, XftTypeInteger, face->key.lfItalic ?
+		    XFT_SLANT_ITALIC : XFT_SLANT_ROMAN,
+		    NULL);
+	}
+	xft = face->xft;
+	w32x_unlock();
+	return xft;
+}
+#endif
+
+/* Metrics of the font as memory DCs draw it, NULL if they cannot */
+const struct w32x_font_metrics *
+w32x_font_mem_metrics(struct gdi_font *font)
+{
+#ifdef HAVE_XFT_H
+	if (w32x_font_ft(font) != NULL)
+		return &font->face->ft_metrics;
+#endif
+	return NULL;
+}
+
+/* Called when a font object is deleted */
+void
+w32x_font_release(struct gdi_font *font)
+{
+	w32x_lock();
+	font_put(font->face);
+	w32x_unlock();
+	font->face = NULL;
+}
+
+static const struct w32x_font_metrics *
+dc_metrics(HDC hdc)
+{
+	struct gdi_font *font = w32x_gdi_get(hdc->selectedFont,
+	    GDI_TYPE_FONT);
+
+	if (font == NULL)
+		return NULL;
+	if (hdc->mem)
+		return w32x_font_mem_metrics(font);
+	return w32x_font_metrics(font);
+}
+
+BOOL
+GetTextExtentPoint32(HDC hdc, const char *lpString, int c, LPSIZE lpSize)
+{
+	const struct w32x_font_metrics *m = dc_metrics(hdc);
+	const unsigned char *s = (const unsigned char *)lpString;
+	int i, width = 0;
+
+	if (m == NULL || c < 0 || lpSize == NULL) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	for (i = 0; i < c; i++)
+		width += m->advance[s[i]];
+
+	lpSize->cx = width;
+	lpSize->cy = m->ascent + m->descent;
+	return TRUE;
+}
+
+BOOL
+GetTextMetrics(HDC hdc, LPTEXTMETRIC lptm)
+{
+	const struct w32x_font_metrics *m = dc_metrics(hdc);
+
+	if (m == NULL || lptm == NULL) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	memset(lptm, 0, sizeof(TEXTMETRIC));
+	lptm->tmHeight = m->ascent + m->descent;
+	lptm->tmAscent = m->ascent;
+	lptm->tmDescent = m->descent;
+	lptm->tmAveCharWidth = m->ave_width;
+	lptm->tmMaxCharWidth = m->max_width;
+	lptm->tmWeight = m->weight;
+	lptm->tmDigitizedAspectX = 96;
+	lptm->tmDigitizedAspectY = 96;
+	lptm->tmFirstChar = m->first_char;
+	lptm->tmLastChar = m->last_char;
+	lptm->tmDefaultChar = m->default_char;
+	lptm->tmBreakChar = ' ';
+	lptm->tmItalic = m->italic;
+	lptm->tmPitchAndFamily = m->fixed_pitch ? 0 : TMPF_FIXED_PITCH;
+	lptm->tmCharSet = ANSI_CHARSET;
+	return TRUE;
+}
+
+BOOL
+GetCharWidth32(HDC hdc, UINT iFirst, UINT iLast, LPINT lpBuffer)
+{
+	const struct w32x_font_metrics *m = dc_metrics(hdc);
+	UINT c;
+
+	if (m == NULL || iFirst > iLast || lpBuffer == NULL) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	/* Characters beyond the table are drawn as the default character */
+	for (c = iFirst; c <= iLast; c++)
+		*lpBuffer++ = m->advance[c <= 255 ? c : m->default_char];
+	return TRUE;
+}
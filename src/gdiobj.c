@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2018 Devin Smith <devin@devinsmith.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef HAVE_XFT_H
+#include <X11/Xft/Xft.h>
+#endif
+
+#include <windows.h>
+#include "w32x_priv.h"
+
+/*
+ * GDI handle table.
+ *
+ * Like the Win32 GDI handle table, a handle is not a pointer but packs a
+ * slot index, the object type and a generation count:
+ *
+ *   31       20 19  16 15          0
+ *   +----------+------+-------------+
+ *   |generation| type |    index    |
+ *   +----------+------+-------------+
+ *
+ * Types start at 1, so a handle can never be mistaken for a
+ * (HBRUSH)(COLOR_xxx + 1) value. The generation is bumped whenever a slot
+ * is freed, which makes stale handles fail the lookup instead of reaching
+ * reused memory.
+ *
+ * Each type has its own slab of fixed size slots holding only that
+ * type's fields. Slabs grow a chunk at a time and freed slots are reused
+ * oldest first, so steady state create/delete does not touch malloc and a
+ * slot's generation takes as long as possible to wrap.
+ *
+ * The table is shared by all threads and guarded by the library lock.
+ */
+
+#define GDI_INDEX_BITS 16
+#define GDI_TYPE_SHIFT 16
+#define GDI_TYPE_MASK 0xf
+#define GDI_GEN_SHIFT 20
+#define GDI_GEN_MASK 0xfff
+
+#define GDI_CHUNK_SLOTS 256
+#define GDI_MAX_SLOTS (1 << GDI_INDEX_BITS)
+#define GDI_NO_SLOT 0xffffffff
+
+struct gdi_slot {
+	unsigned short gen;
+	unsigned char live;
+	unsigned char stock;
+	unsigned int selected; /* number of DCs it is selected into */
+	unsigned int next_free;
+	void *body[]; /* type specific object, pointer aligned */
+};
+
+struct gdi_slab {
+	size_t stride;
+	char **chunks;
+	unsigned int nslots;
+	unsigned int free_head;
+	unsigned int free_tail;
+};
+
+#define GDI_SLAB(type) { \
+	.stride = (sizeof(struct gdi_slot) + sizeof(type) + \
+	    sizeof(void *) - 1) & ~(sizeof(void *) - 1), \
+	.free_head = GDI_NO_SLOT, \
+	.free_tail = GDI_NO_SLOT \
+}
+
+static struct gdi_slab slabs[GDI_TYPE_LAST + 1] = {
+	[GDI_TYPE_PEN] = GDI_SLAB(struct gdi_pen),
+	[GDI_TYPE_BRUSH] = GDI_SLAB(struct gdi_brush),
+	[GDI_TYPE_FONT] = GDI_SLAB(struct gdi_font),
+	[GDI_TYPE_BITMAP] = GDI_SLAB(struct gdi_bitmap),
+	[GDI_TYPE_REGION] = GDI_SLAB(struct gdi_region),
+};
+
+static struct gdi_slot *
+slot_at(struct gdi_slab *slab, unsigned int index)
+{
+	return (struct gdi_slot *)(slab->chunks[index / GDI_CHUNK_SLOTS] +
+	    (index % GDI_CHUNK_SLOTS) * slab->stride);
+}
+
+static HGDIOBJ
+make_handle(enum gdi_type type, unsigned int index, unsigned int gen)
+{
+	return (HGDIOBJ)(uintptr_t)((gen << GDI_GEN_SHIFT) |
+	    (type << GDI_TYPE_SHIFT) | index);
+}
+
+/* Add a chunk of free slots to the slab. */
+static BOOL
+slab_grow(struct gdi_slab *slab)
+{
+	unsigned int nchunks = slab->nslots / GDI_CHUNK_SLOTS;
+	unsigned int i;
+	char **chunks;
+	char *chunk;
+
+	if (slab->nslots >= GDI_MAX_SLOTS)
+		return FALSE;
+
+	chunk = calloc(GDI_CHUNK_SLOTS, slab->stride);
+	if (chunk == NULL)
+		return FALSE;
+	chunks = realloc(slab->chunks, (nchunks + 1) * sizeof(char *));
+	if (chunks == NULL) {
+		free(chunk);
+		return FALSE;
+	}
+	chunks[nchunks] = chunk;
+	slab->chunks = chunks;
+
+	for (i = 0; i < GDI_CHUNK_SLOTS; i++) {
+		slot_at(slab, slab->nslots + i)->next_free =
+		    (i + 1 < GDI_CHUNK_SLOTS) ? slab->nslots + i + 1 :
+		    GDI_NO_SLOT;
+	}
+	if (slab->free_tail != GDI_NO_SLOT)
+		slot_at(slab, slab->free_tail)->next_free = slab->nslots;
+	else
+		slab->free_head = slab->nslots;
+	slab->free_tail = slab->nslots + GDI_CHUNK_SLOTS - 1;
+	slab->nslots += GDI_CHUNK_SLOTS;
+	return TRUE;
+}
+
+static struct gdi_slot *
+handle_slot(HGDIOBJ h, enum gdi_type *typep)
+{
+	uintptr_t v = (uintptr_t)h;
+	unsigned int index = v & (GDI_MAX_SLOTS - 1);
+	unsigned int type = (v >> GDI_TYPE_SHIFT) & GDI_TYPE_MASK;
+	unsigned int gen = (v >> GDI_GEN_SHIFT) & GDI_GEN_MASK;
+	struct gdi_slot *slot;
+
+	if ((v >> GDI_GEN_SHIFT) != gen || type == 0 || type > GDI_TYPE_LAST ||
+	    index >= slabs[type].nslots)
+		return NULL;
+
+	slot = slot_at(&slabs[type], index);
+	if (!slot->live || slot->gen != gen)
+		return NULL;
+
+	if (typep != NULL)
+		*typep = type;
+	return slot;
+}
+
+/*
+ * Allocate an object of the given type. The object is returned through
+ * objp; its contents are whatever the previous occupant of the slot left
+ * behind, so a region can keep its storage. Returns NULL when out of
+ * memory or slots.
+ */
+HGDIOBJ
+w32x_gdi_alloc(enum gdi_type type, void **objp)
+{
+	HGDIOBJ h;
+	struct gdi_slab *slab = &slabs[type];
+	struct gdi_slot *slot;
+	unsigned int index;
+
+	w32x_lock();
+	if (slab->free_head == GDI_NO_SLOT && !slab_grow(slab)) {
+		w32x_unlock();
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return NULL;
+	}
+
+	index = slab->free_head;
+	slot = slot_at(slab, index);
+	slab->free_head = slot->next_free;
+	if (slab->free_head == GDI_NO_SLOT)
+		slab->free_tail = GDI_NO_SLOT;
+
+	slot->live = 1;
+	slot->stock = 0;
+	slot->selected = 0;
+	*objp = slot->body;
+	h = make_handle(type, index, slot->gen);
+	w32x_unlock();
+	return h;
+}
+
+/* Returns the object behind h, or NULL if h is not a live handle of the
+ * given type. */
+void *
+w32x_gdi_get(HGDIOBJ h, enum gdi_type type)
+{
+	enum gdi_type t;
+	struct gdi_slot *slot;
+
+	w32x_lock();
+	slot = handle_slot(h, &t);
+	w32x_unlock();
+	if (slot == NULL || t != type)
+		return NULL;
+	return slot->body;
+}
+
+/* Returns the type of a live handle, 0 otherwise. */
+enum gdi_type
+w32x_gdi_type(HGDIOBJ h)
+{
+	enum gdi_type t;
+	struct gdi_slot *slot;
+
+	w32x_lock();
+	slot = handle_slot(h, &t);
+	w32x_unlock();
+	return slot != NULL ? t : 0;
+}
+
+/* Stock objects are never freed. */
+void
+w32x_gdi_set_stock(HGDIOBJ h)
+{
+	struct gdi_slot *slot;
+
+	w32x_lock();
+	if ((slot = handle_slot(h, NULL)) != NULL)
+		slot->stock = 1;
+	w32x_unlock();
+}
+
+BOOL
+w32x_gdi_is_stock(HGDIOBJ h)
+{
+	struct gdi_slot *slot;
+	BOOL stock;
+
+	w32x_lock();
+	slot = handle_slot(h, NULL);
+	stock = slot != NULL && slot->stock;
+	w32x_unlock();
+	return stock;
+}
+
+BOOL
+w32x_gdi_is_selected(HGDIOBJ h)
+{
+	struct gdi_slot *slot;
+	BOOL selected;
+
+	w32x_lock();
+	slot = handle_slot(h, NULL);
+	selected = slot != NULL && slot->selected > 0;
+	w32x_unlock();
+	return selected;
+}
+
+/* Track which objects are selected into a DC, either handle may be
+ * NULL. */
+void
+w32x_gdi_select(HGDIOBJ selected, HGDIOBJ deselected)
+{
+	struct gdi_slot *slot;
+
+	w32x_lock();
+	if ((slot = handle_slot(selected, NULL)) != NULL)
+		slot->selected++;
+	if ((slot = handle_slot(deselected, NULL)) != NULL &&
+	    slot->selected > 0)
+		slot->selected--;
+	w32x_unlock();
+}
+
+/* Return the slot to its slab; the handle and any copies of it become
+ * invalid. */
+void
+w32x_gdi_free(HGDIOBJ h)
+{
+	enum gdi_type type;
+	struct gdi_slot *slot;
+	struct gdi_slab *slab;
+	unsigned int index;
+
+	w32x_lock();
+	if ((slot = handle_slot(h, &type)) == NULL) {
+		w32x_unlock();
+		return;
+	}
+
+	slab = &slabs[type];
+	index = (uintptr_t)h & (GDI_MAX_SLOTS - 1);
+	slot->live = 0;
+	slot->gen = (slot->gen + 1) & GDI_GEN_MASK;
+	slot->next_free = GDI_NO_SLOT;
+	if (slab->free_tail != GDI_NO_SLOT)
+		slot_at(slab, slab->free_tail)->next_free = index;
+	else
+		slab->free_head = index;
+	slab->free_tail = index;
+	w32x_unlock();
+}
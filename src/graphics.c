@@ -31,6 +31,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <sys/param.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xresource.h>
@@ -41,49 +42,48 @@
 #include <windows.h>
 #include "w32x_priv.h"
 
-/* Pietrek - Windows Internals (p.369) */
-#define PEN_MAGIC     0x4F47 /* GO */
-#define BRUSH_MAGIC   0x4F48 /* HO */
-#define FONT_MAGIC    0x4F49 /* IO */
-#define REGION_MAGIC  0x4F4C /* LO */
-
-#define W32X_XFLD_DEFAULT_FONT "7x14"
-#define W32X_XFT_DEFAULT_FONT "Sans,90"
-
 extern Display *disp;
 extern int blackpixel;
 extern int whitepixel;
 
-struct GDIOBJ {
-	short obj_sig; /* see above */
-	COLORREF crColor;
-	int penStyle; /* used only for pens */
-	int nWidth; /* width of pen */
-	XFontStruct *font; /* font */
-	Region region;
-
-	BOOL selected;
-};
+/* DCs with queued shapes, flushed before the message loop blocks. Each
+ * thread flushes the DCs it drew on. A DC can be flushed by another
+ * thread than the one that drew on it (one draws, the other paints), so
+ * the lists are only changed with the global lock held. */
+static __thread struct w32x_dc_list dirty_dcs;
 
 static bool stock_inited = false;
-static struct GDIOBJ *system_font = NULL;
-static struct GDIOBJ *dc_brush = NULL;
-static struct GDIOBJ *black_pen = NULL;
+static HFONT system_font = NULL;
+static HBRUSH dc_brush = NULL;
+static HPEN black_pen = NULL;
+static HBITMAP default_bitmap = NULL; /* of new memory DCs */
 
 static void init_stock_objects(void)
 {
-	system_font = calloc(1, sizeof(struct GDIOBJ));
-	system_font->obj_sig = FONT_MAGIC ;
-	system_font->font = XLoadQueryFont(disp, W32X_XFLD_DEFAULT_FONT);
+	struct gdi_brush *brush;
+	struct gdi_pen *pen;
+	LOGFONT lf;
+
+	memset(&lf, 0, sizeof(lf));
+	lf.lfWeight = FW_NORMAL;
+	strcpy(lf.lfFaceName, "System");
+	system_font = CreateFontIndirect(&lf);
+	w32x_gdi_set_stock(system_font);
 
 	/* The default DC_BRUSH color is WHITE */
-	dc_brush = calloc(1, sizeof(struct GDIOBJ));
-	dc_brush->obj_sig = BRUSH_MAGIC;
-	dc_brush->crColor = RGB(0xff, 0xff, 0xff);
+	dc_brush = w32x_gdi_alloc(GDI_TYPE_BRUSH, (void **)&brush);
+	brush->color = RGB(0xff, 0xff, 0xff);
+	brush->style = BS_SOLID;
+	w32x_gdi_set_stock(dc_brush);
 
-	black_pen = calloc(1, sizeof(struct GDIOBJ));
-	black_pen->obj_sig= PEN_MAGIC;
-	black_pen->crColor = RGB(0x00, 0x00, 0x00);
+	black_pen = w32x_gdi_alloc(GDI_TYPE_PEN, (void **)&pen);
+	pen->color = RGB(0x00, 0x00, 0x00);
+	pen->style = PS_SOLID;
+	pen->width = 0;
+	w32x_gdi_set_stock(black_pen);
+
+	default_bitmap = CreateCompatibleBitmap(NULL, 1, 1);
+	w32x_gdi_set_stock(default_bitmap);
 
 	stock_inited = true;
 }
@@ -92,9 +92,11 @@ static void init_stock_objects(void)
  * pens, brushes, fonts, or palettes. */
 HGDIOBJ GetStockObject(int fnObject)
 {
+	w32x_lock();
 	if (!stock_inited) {
 		init_stock_objects();
 	};
+	w32x_unlock();
 
 	if (fnObject == SYSTEM_FONT)
 		return system_font;
@@ -106,6 +108,16 @@ HGDIOBJ GetStockObject(int fnObject)
 	return NULL;
 }
 
+HBITMAP
+w32x_stock_bitmap(void)
+{
+	w32x_lock();
+	if (!stock_inited)
+		init_stock_objects();
+	w32x_unlock();
+	return default_bitmap;
+}
+
 DWORD
 GetSysColor(int nIndex)
 {
@@ -116,6 +128,16 @@ GetSysColor(int nIndex)
 	case COLOR_MENUBAR:
 		return RGB(0xd0, 0xd0, 0xd0);
 		break;
+	case COLOR_MENUTEXT:
+		return RGB(0, 0, 0);
+		break;
+	case COLOR_HIGHLIGHT:
+	case COLOR_MENUHILIGHT:
+		return RGB(0x33, 0x66, 0xcc);
+		break;
+	case COLOR_HIGHLIGHTTEXT:
+		return RGB(0xff, 0xff, 0xff);
+		break;
 	default:
 		break;
 	}
@@ -124,26 +146,33 @@ GetSysColor(int nIndex)
 
 int GetObject(HANDLE h, int c, LPVOID pv)
 {
-	struct GDIOBJ *obj = h;
-
 	/* Determine the type of object this is */
-	switch (obj->obj_sig) {
-	case PEN_MAGIC:
+	switch (w32x_gdi_type(h)) {
+	case GDI_TYPE_PEN:
 		printf("XXX: GetObject (Pen) Not done\n");
 		break;
-	case BRUSH_MAGIC: {
+	case GDI_TYPE_BRUSH: {
+		struct gdi_brush *brush = w32x_gdi_get(h, GDI_TYPE_BRUSH);
+
 		if (c != sizeof(LOGBRUSH))
 			return 0;
 
 		LOGBRUSH *lb = pv;
-		lb->lbStyle = 0; /* Not implemented */
-		lb->lbColor = obj->crColor;
+		lb->lbStyle = brush->style;
+		lb->lbColor = brush->color;
 		lb->lbHatch = 0;
 		return sizeof(LOGBRUSH);
 		}
 		break;
-	case FONT_MAGIC:
-		printf("XXX: GetObject (Font) Not done\n");
+	case GDI_TYPE_FONT: {
+		struct gdi_font *font = w32x_gdi_get(h, GDI_TYPE_FONT);
+
+		if (c != sizeof(LOGFONT))
+			return 0;
+
+		memcpy(pv, &font->lf, sizeof(LOGFONT));
+		return sizeof(LOGFONT);
+		}
 		break;
 	default:
 		printf("Unknown GDI object type\n");
@@ -155,15 +184,18 @@ int GetObject(HANDLE h, int c, LPVOID pv)
 
 HBRUSH CreateBrushIndirect(const LOGBRUSH *lplb)
 {
-	struct GDIOBJ *obj;
+	struct gdi_brush *brush;
+	HBRUSH hbr;
 
 	if (lplb == NULL)
 		return NULL;
 
-	obj = calloc(1, sizeof(struct GDIOBJ));
-	obj->obj_sig = BRUSH_MAGIC;
-	obj->crColor = lplb->lbColor;
-	return obj;
+	hbr = w32x_gdi_alloc(GDI_TYPE_BRUSH, (void **)&brush);
+	if (hbr == NULL)
+		return NULL;
+	brush->color = lplb->lbColor;
+	brush->style = lplb->lbStyle;
+	return hbr;
 }
 
 HBRUSH CreateSolidBrush(COLORREF crColor)
@@ -178,35 +210,30 @@ HBRUSH CreateSolidBrush(COLORREF crColor)
 
 HPEN CreatePen(int fnPenStyle, int nWidth, COLORREF crColor)
 {
-	struct GDIOBJ *obj = calloc(1, sizeof(struct GDIOBJ));
+	struct gdi_pen *pen;
+	HPEN hpen;
 
-	obj->obj_sig = PEN_MAGIC;
-	obj->crColor = crColor;
-	obj->penStyle = fnPenStyle;
-	obj->nWidth = nWidth;
-	return obj;
-}
-
-static void
-region_union_rect(HRGN rgn, int left, int top, int right, int bottom)
-{
-	XRectangle rect;
-	rect.x = left;
-	rect.y = top;
-	rect.width = right - left;
-	rect.height = bottom - top;
-	XUnionRectWithRegion(&rect, rgn->region, rgn->region);
+	hpen = w32x_gdi_alloc(GDI_TYPE_PEN, (void **)&pen);
+	if (hpen == NULL)
+		return NULL;
+	pen->color = crColor;
+	pen->style = fnPenStyle;
+	pen->width = nWidth;
+	return hpen;
 }
 
 HRGN
 CreateRectRgn(int left, int top, int right, int bottom)
 {
-	struct GDIOBJ *obj = calloc(1, sizeof(struct GDIOBJ));
+	struct gdi_region *rgn;
+	HRGN hrgn;
+
+	hrgn = w32x_gdi_alloc(GDI_TYPE_REGION, (void **)&rgn);
+	if (hrgn == NULL)
+		return NULL;
 
-	obj->obj_sig = REGION_MAGIC;
-	obj->region = XCreateRegion();
-	region_union_rect(obj, left, top, right, bottom);
-	return obj;
+	w32x_region_set_rect(&rgn->region, left, top, right, bottom);
+	return hrgn;
 }
 
 HRGN
@@ -221,43 +248,105 @@ CreateRectRgnIndirect(const RECT *r)
  */
 BOOL DeleteObject(HGDIOBJ hObject)
 {
-	struct GDIOBJ *obj = hObject;
+	struct gdi_region *rgn;
+	struct gdi_bitmap *bmp;
+	enum gdi_type type = w32x_gdi_type(hObject);
 
-	if (obj->selected)
+	if (type == 0) {
+		SetLastError(ERROR_INVALID_HANDLE);
 		return FALSE;
+	}
 
-	if (obj->obj_sig == REGION_MAGIC) {
-		if (obj->region != NULL) {
-			XDestroyRegion(obj->region);
-		}
+	/* Stock objects can be "deleted", but stay around */
+	if (w32x_gdi_is_stock(hObject))
+		return TRUE;
+
+	if (w32x_gdi_is_selected(hObject))
+		return FALSE;
+
+	if (type == GDI_TYPE_REGION) {
+		rgn = w32x_gdi_get(hObject, GDI_TYPE_REGION);
+		w32x_region_trim(&rgn->region);
+	} else if (type == GDI_TYPE_FONT) {
+		w32x_font_release(w32x_gdi_get(hObject, GDI_TYPE_FONT));
+	} else if (type == GDI_TYPE_BITMAP) {
+		bmp = w32x_gdi_get(hObject, GDI_TYPE_BITMAP);
+		w32x_dib_destroy(bmp->dib);
 	}
 
-	free(hObject);
+	w32x_gdi_free(hObject);
 	return TRUE;
 }
 
+static void setFgColor(HDC hdc, COLORREF cr)
+{
+	XGCValues gcv;
+
+	if (hdc->fgColor != cr) {
+		gcv.foreground = w32x_color_to_pixel(cr);
+		XChangeGC(disp, hdc->gc, GCForeground, &gcv);
+		hdc->fgColor = cr;
+	}
+}
+
+/* Memory DCs draw Latin-1 text with the Unicode path */
+static BOOL
+mem_text_out(HDC hdc, int x, int y, const char *s, size_t c)
+{
+	WCHAR *ws;
+	size_t i;
+	BOOL ret;
+
+	if ((ws = malloc((c + 1) * sizeof(WCHAR))) == NULL) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	for (i = 0; i < c; i++)
+		ws[i] = (unsigned char)s[i];
+	ret = w32x_mem_text_out(hdc, x, y, ws, c);
+	free(ws);
+	return ret;
+}
+
 BOOL TextOut(HDC hdc, int nXStart, int nYStart, const char *lpString,
     size_t cchString)
 {
-	XFontStruct *font;
 	XTextItem ti[1];
-	struct GDIOBJ *gdi_font = (struct GDIOBJ *)hdc->selectedFont;
+	struct gdi_font *gdi_font = w32x_gdi_get(hdc->selectedFont,
+	    GDI_TYPE_FONT);
+	const struct w32x_font_metrics *m;
 
-	font = gdi_font->font;
+	if (hdc->mem)
+		return mem_text_out(hdc, nXStart, nYStart, lpString, cchString);
+	if (gdi_font == NULL || (m = w32x_font_metrics(gdi_font)) == NULL)
+		return FALSE;
 
 	ti[0].chars = (char *)lpString;
 	ti[0].nchars = cchString;
 	ti[0].delta = 0;
-	ti[0].font = font->fid;
+	ti[0].font = w32x_font_xfont(gdi_font)->fid;
 
-	XDrawText(disp, hdc->wnd->window, hdc->gc, nXStart,
-	    (nYStart - (font->ascent + font->descent)) / 2 + font->ascent, ti, 1);
+	/* nYStart is the top of the text, X wants the baseline */
+	w32x_dc_flush(hdc);
+	setFgColor(hdc, hdc->textColor);
+	XDrawText(disp, hdc->drawable, hdc->gc, nXStart, nYStart + m->ascent,
+	    ti, 1);
 
 	//XUnloadFont(disp, font->fid);
 
 	return TRUE;
 }
 
+/* Returns once queued drawing, including DIB pixel data, has reached the
+ * server. Call it before writing to the bits of a DIB section that has
+ * just been drawn. */
+BOOL GdiFlush(void)
+{
+	w32x_gdi_flush_all();
+	w32x_dib_sync();
+	return TRUE;
+}
+
 /* Private functions */
 HDC w32x_CreateDC(void)
 {
@@ -266,185 +355,673 @@ HDC w32x_CreateDC(void)
 
 	gcv.background = whitepixel;
 	gcv.foreground = blackpixel;
+	/* Presenting the back buffer must not generate NoExpose events */
+	gcv.graphics_exposures = False;
 	dc = calloc(1, sizeof(struct WndDC));
+	dc->fgColor = CLR_INVALID;
+	dc->textColor = RGB(0, 0, 0);
+	dc->clip_serial = 1;
+	w32x_region_set_rect(&dc->clip_rgn, 0, 0, 0, 0);
+	w32x_region_set_rect(&dc->clip_both, 0, 0, 0, 0);
 	dc->gc = XCreateGC(disp, DefaultRootWindow(disp),
-	    GCForeground | GCBackground, &gcv);
+	    GCForeground | GCBackground | GCGraphicsExposures, &gcv);
 
 	return dc;
 }
 
+/* Work out the clip in effect from the paint region and the selected clip
+ * region, and hand it to the GC. */
+static void
+dc_update_clip(HDC hdc)
+{
+	const struct w32x_region *clip = hdc->paint_clip;
+
+	if (hdc->clip_selected) {
+		if (clip == NULL) {
+			clip = &hdc->clip_rgn;
+		} else if (w32x_region_combine(&hdc->clip_both, clip,
+		    &hdc->clip_rgn, RGN_AND) != ERROR) {
+			clip = &hdc->clip_both;
+		}
+		/* else better to draw too much than nothing at all */
+	}
+	hdc->clip = clip;
+	hdc->clip_serial++;
+
+	if (hdc->mem)
+		return;
+	if (clip != NULL)
+		w32x_region_set_gc_clip(hdc->gc, clip);
+	else
+		XSetClipMask(disp, hdc->gc, None);
+}
+
+/*
+ * Select a copy of a region as the clip region of a DC, or with hrgn NULL
+ * remove it. While painting, drawing is clipped to both it and the paint
+ * region. Returns the complexity of the clip, or ERROR.
+ */
+int
+SelectClipRgn(HDC hdc, HRGN hrgn)
+{
+	struct gdi_region *rgn = NULL;
+
+	if (hrgn != NULL &&
+	    (rgn = w32x_gdi_get(hrgn, GDI_TYPE_REGION)) == NULL)
+		return ERROR;
+
+	w32x_dc_flush(hdc);
+	if (rgn != NULL) {
+		if (w32x_region_combine(&hdc->clip_rgn, &rgn->region,
+		    &rgn->region, RGN_COPY) == ERROR)
+			return ERROR;
+		hdc->clip_selected = TRUE;
+	} else {
+		hdc->clip_selected = FALSE;
+	}
+	dc_update_clip(hdc);
+
+	return hdc->clip != NULL ? hdc->clip->complexity : SIMPLEREGION;
+}
+
+/*
+ * Redirect a window DC to the window's back buffer for a BeginPaint/EndPaint
+ * pair. Drawing is clipped to the paint region, which is filled with the
+ * window background first when erase is set.
+ */
+void
+w32x_dc_begin_paint(HDC hdc, Drawable backbuf, const struct w32x_region *clip,
+    BOOL erase, unsigned long bg_pixel, const RECT *box)
+{
+	XGCValues gcv;
+
+	w32x_dc_flush(hdc);
+	hdc->drawable = backbuf;
+	hdc->paint_clip = clip;
+	dc_update_clip(hdc);
+
+	if (erase && !IsRectEmpty(box)) {
+		gcv.foreground = bg_pixel;
+		XChangeGC(disp, hdc->gc, GCForeground, &gcv);
+		XFillRectangle(disp, backbuf, hdc->gc, box->left, box->top,
+		    box->right - box->left, box->bottom - box->top);
+		/* Force the next draw to reload its color */
+		hdc->fgColor = CLR_INVALID;
+	}
+}
+
+/*
+ * Present the painted area with a single copy, still clipped to the paint
+ * region so stale back buffer pixels outside of it never reach the window,
+ * and point the DC back at the window.
+ */
+void
+w32x_dc_end_paint(HDC hdc, const RECT *box)
+{
+	Drawable backbuf = hdc->drawable;
+	Window window = hdc->wnd->window;
+
+	w32x_dc_flush(hdc);
+	if (backbuf != window && !IsRectEmpty(box)) {
+		XCopyArea(disp, backbuf, window, hdc->gc, box->left, box->top,
+		    box->right - box->left, box->bottom - box->top,
+		    box->left, box->top);
+	}
+
+	hdc->drawable = window;
+	hdc->paint_clip = NULL;
+	dc_update_clip(hdc);
+}
+
 HGDIOBJ SelectObject(HDC hdc, HGDIOBJ hgdiobj)
 {
 	HGDIOBJ old = NULL;
-	struct GDIOBJ *obj = hgdiobj;
 
 	/* Determine the type of object this is */
-	switch (obj->obj_sig) {
-	case PEN_MAGIC:
+	switch (w32x_gdi_type(hgdiobj)) {
+	case GDI_TYPE_PEN:
 		old = hdc->selectedPen;
 		hdc->selectedPen = hgdiobj;
 		break;
-	case BRUSH_MAGIC:
+	case GDI_TYPE_BRUSH:
 		old = hdc->selectedBrush;
 		hdc->selectedBrush = hgdiobj;
 		break;
-	case FONT_MAGIC:
+	case GDI_TYPE_FONT:
 		old = hdc->selectedFont;
 		hdc->selectedFont = hgdiobj;
 		break;
+	case GDI_TYPE_BITMAP:
+		/* Only memory DCs draw into bitmaps, and a bitmap can be
+		 * selected into one of them at a time */
+		if (!hdc->mem || (hgdiobj != hdc->selectedBitmap &&
+		    w32x_gdi_is_selected(hgdiobj) &&
+		    !w32x_gdi_is_stock(hgdiobj)))
+			return NULL;
+		old = hdc->selectedBitmap;
+		hdc->selectedBitmap = hgdiobj;
+		break;
 	default:
 		printf("Unknown GDI object type\n");
-		break;
+		return NULL;
 	}
 
+	w32x_gdi_select(hgdiobj, old);
 	return old;
 }
 
 COLORREF SetDCBrushColor(HDC hdc, COLORREF crColor)
 {
 	COLORREF old_val;
-	struct GDIOBJ *selected = hdc->selectedBrush;
+	struct gdi_brush *brush;
 
-	if (selected != dc_brush)
+	if (hdc->selectedBrush != dc_brush)
 		return CLR_INVALID;
 
-	old_val = selected->crColor;
+	brush = w32x_gdi_get(dc_brush, GDI_TYPE_BRUSH);
+	old_val = brush->color;
+	brush->color = crColor;
 
-	selected->crColor = crColor;
+	return old_val;
+}
+
+COLORREF SetTextColor(HDC hdc, COLORREF crColor)
+{
+	COLORREF old_val = hdc->textColor;
 
+	hdc->textColor = crColor;
 	return old_val;
 }
 
-static void setFgColor(HDC hdc, COLORREF cr)
+/*
+ * Draw-call batching
+ *
+ * Fills and outlines are queued on the DC in runs of shapes of one kind
+ * and color. Each run goes out as a single XFillRectangles, XFillArcs,
+ * XDrawRectangles or XDrawArcs request when the DC is flushed, in order.
+ *
+ * A shape joins the last run of its kind and color even when other runs
+ * follow it, as long as the result matches drawing in order. The shapes
+ * of later runs it overlaps would land on top of it, so:
+ *
+ * - a filled rectangle queues the overlapped parts again, as patches in a
+ *   run at the end;
+ * - an outline drops the filled rectangles of later runs it covers
+ *   completely, such as those patches;
+ * - anything else goes to a run at the end.
+ *
+ * In a grid of cells sharing edges each fill overlaps the outline of the
+ * cell before, and the patch that repairs that is covered by the cell's
+ * own outline, so the grid takes one fill and one outline run until they
+ * are full. The DC is flushed when no run can take a shape, and by
+ * anything that draws through the GC or changes where or how it draws.
+ */
+#define GDI_PATCH_MAX 8
+
+static BOOL
+shape_hits(const XRectangle *a, const XRectangle *b)
 {
-	XGCValues gcv;
+	return a->x < b->x + b->width && b->x < a->x + a->width &&
+	    a->y < b->y + b->height && b->y < a->y + a->height;
+}
 
-	if (hdc->fgPixel != cr) {
-		gcv.foreground = cr;
-		XChangeGC(disp, hdc->gc, GCForeground, &gcv);
-		hdc->fgPixel = cr;
+/* The part of a inside b */
+static BOOL
+shape_clip(const XRectangle *a, const XRectangle *b, XRectangle *out)
+{
+	int left = MAX(a->x, b->x), top = MAX(a->y, b->y);
+	int right = MIN(a->x + a->width, b->x + b->width);
+	int bottom = MIN(a->y + a->height, b->y + b->height);
+
+	if (left >= right || top >= bottom)
+		return FALSE;
+	out->x = left;
+	out->y = top;
+	out->width = right - left;
+	out->height = bottom - top;
+	return TRUE;
+}
+
+static BOOL
+shape_inside(const XRectangle *in, const XRectangle *out)
+{
+	return in->x >= out->x && in->y >= out->y &&
+	    in->x + in->width <= out->x + out->width &&
+	    in->y + in->height <= out->y + out->height;
+}
+
+static void
+shape_union(XRectangle *e, const XRectangle *r)
+{
+	int right = MAX(e->x + e->width, r->x + r->width);
+	int bottom = MAX(e->y + e->height, r->y + r->height);
+
+	e->x = MIN(e->x, r->x);
+	e->y = MIN(e->y, r->y);
+	e->width = right - e->x;
+	e->height = bottom - e->y;
+}
+
+/* Box of shape i of run b */
+static void
+shape_box(const struct gdi_batch *b, int i, XRectangle *r)
+{
+	if (b->shape == GDI_SHAPE_RECT) {
+		*r = b->u.rects[i];
+	} else {
+		r->x = b->u.arcs[i].x;
+		r->y = b->u.arcs[i].y;
+		r->width = b->u.arcs[i].width;
+		r->height = b->u.arcs[i].height;
 	}
 }
 
-BOOL Ellipse(HDC hdc, int nLeftRect, int nTopRect, int nRightRect,
-    int nBottomRect)
+/*
+ * The pixels a shape touches, as up to four rectangles. X draws outlines
+ * one pixel wider and taller than the box they outline. A rectangle
+ * outline leaves its inside alone; an arc is taken as its whole box.
+ */
+static int
+shape_pieces(BOOL fill, enum gdi_shape shape, const XRectangle *r,
+    XRectangle *p)
 {
-	setFgColor(hdc, hdc->selectedBrush->crColor);
+	if (fill) {
+		p[0] = *r;
+		return 1;
+	}
+	if (shape == GDI_SHAPE_ARC) {
+		p[0] = *r;
+		p[0].width++;
+		p[0].height++;
+		return 1;
+	}
+	/* Top, bottom, left and right edges */
+	p[0].x = r->x;
+	p[0].y = r->y;
+	p[0].width = r->width + 1;
+	p[0].height = 1;
+	p[1] = p[0];
+	p[1].y = r->y + r->height;
+	p[2].x = r->x;
+	p[2].y = r->y;
+	p[2].width = 1;
+	p[2].height = r->height + 1;
+	p[3] = p[2];
+	p[3].x = r->x + r->width;
+	return 4;
+}
 
-	XFillArc(disp, hdc->wnd->window, hdc->gc, nLeftRect,
-	    nTopRect, nRightRect - nLeftRect, nBottomRect - nTopRect, 0, 360 * 64);
+static BOOL
+pieces_hit(const XRectangle *a, int na, const XRectangle *b, int nb)
+{
+	int i, j;
 
-	setFgColor(hdc, hdc->selectedPen->crColor);
+	for (i = 0; i < na; i++) {
+		for (j = 0; j < nb; j++) {
+			if (shape_hits(&a[i], &b[j]))
+				return TRUE;
+		}
+	}
+	return FALSE;
+}
 
-	XDrawArc(disp, hdc->wnd->window, hdc->gc, nLeftRect, nTopRect,
-	    nRightRect - nLeftRect, nBottomRect - nTopRect, 0, 360 * 64);
-	return TRUE;
+static void
+run_add(struct gdi_batch *b, const XRectangle *r)
+{
+	XRectangle p[4];
+	int i, n;
 
+	if (b->shape == GDI_SHAPE_RECT) {
+		b->u.rects[b->count] = *r;
+	} else {
+		b->u.arcs[b->count].x = r->x;
+		b->u.arcs[b->count].y = r->y;
+		b->u.arcs[b->count].width = r->width;
+		b->u.arcs[b->count].height = r->height;
+		b->u.arcs[b->count].angle1 = 0;
+		b->u.arcs[b->count].angle2 = 360 * 64;
+	}
+
+	n = shape_pieces(b->fill, b->shape, r, p);
+	if (b->count == 0)
+		b->extents = p[0];
+	for (i = 0; i < n; i++)
+		shape_union(&b->extents, &p[i]);
+	b->count++;
 }
 
-BOOL Rectangle(HDC hdc, int nLeftRect, int nTopRect,
-  int nRightRect, int nBottomRect)
+/* Run at the end of the DC with room for n shapes like these, started if
+ * need be; NULL once the DC has no runs left. */
+static struct gdi_batch *
+run_at_end(HDC hdc, BOOL fill, enum gdi_shape shape, COLORREF color, int n)
 {
-	setFgColor(hdc, hdc->selectedBrush->crColor);
+	struct gdi_batch *b;
 
-	XDrawRectangle(disp, hdc->wnd->window, hdc->gc, nLeftRect, nTopRect,
-	    nRightRect - nLeftRect, nBottomRect - nTopRect);
+	if (hdc->nruns > 0) {
+		b = &hdc->runs[hdc->nruns - 1];
+		if (b->fill == fill && b->shape == shape &&
+		    b->color == color && b->count + n <= GDI_BATCH_MAX)
+			return b;
+	}
+	if (hdc->nruns == GDI_RUNS_MAX)
+		return NULL;
 
-	return TRUE;
+	b = &hdc->runs[hdc->nruns++];
+	b->fill = fill;
+	b->shape = shape;
+	b->color = color;
+	b->count = 0;
+	return b;
 }
 
-BOOL FillRect(HDC hdc, const RECT *lprc, HBRUSH hbr)
+/* Drop the filled rectangles after run k that touch pieces p */
+static void
+runs_drop(HDC hdc, int k, const XRectangle *p, int np)
+{
+	struct gdi_batch *b;
+	XRectangle t;
+	int i, j;
+
+	for (j = k + 1; j < hdc->nruns; j++) {
+		b = &hdc->runs[j];
+		if (!b->fill || b->shape != GDI_SHAPE_RECT)
+			continue;
+		for (i = b->count - 1; i >= 0; i--) {
+			shape_box(b, i, &t);
+			if (pieces_hit(p, np, &t, 1))
+				b->u.rects[i] = b->u.rects[--b->count];
+		}
+	}
+	while (hdc->nruns > 0 && hdc->runs[hdc->nruns - 1].count == 0)
+		hdc->nruns--;
+}
+
+/* Queue a shape without changing what the DC draws; FALSE if it has to be
+ * flushed first. */
+static BOOL
+batch_place(HDC hdc, BOOL fill, enum gdi_shape shape, COLORREF color,
+    const XRectangle *r)
 {
-	setFgColor(hdc, hdc->selectedBrush->crColor);
+	XRectangle sp[4], tp[4], t, cut, patches[GDI_PATCH_MAX];
+	struct gdi_batch *b, *end;
+	int ns, nt, np = 0, i, j, k, m;
+	BOOL ok = TRUE;
+
+	/* The last run it could join */
+	for (k = hdc->nruns - 1; k >= 0; k--) {
+		b = &hdc->runs[k];
+		if (b->fill == fill && b->shape == shape &&
+		    b->color == color && b->count < GDI_BATCH_MAX)
+			break;
+	}
+	if (k < 0 || k == hdc->nruns - 1)
+		ok = FALSE;
+
+	/* What in the runs after it would it end up under? */
+	ns = shape_pieces(fill, shape, r, sp);
+	for (j = k + 1; ok && j < hdc->nruns; j++) {
+		b = &hdc->runs[j];
+		if (!pieces_hit(sp, ns, &b->extents, 1))
+			continue;
+		for (i = 0; ok && i < b->count; i++) {
+			shape_box(b, i, &t);
+			nt = shape_pieces(b->fill, b->shape, &t, tp);
+			if (!pieces_hit(sp, ns, tp, nt))
+				continue;
+
+			if (fill && shape == GDI_SHAPE_RECT) {
+				for (m = 0; ok && m < nt; m++) {
+					if (!shape_clip(r, &tp[m], &cut))
+						continue;
+					if (np == GDI_PATCH_MAX)
+						ok = FALSE;
+					else
+						patches[np++] = cut;
+				}
+			} else if (fill || shape != GDI_SHAPE_RECT ||
+			    !b->fill || b->shape != GDI_SHAPE_RECT) {
+				ok = FALSE;
+			} else {
+				/* Only drop what the outline covers */
+				for (m = 0; m < ns; m++) {
+					if (shape_inside(&t, &sp[m]))
+						break;
+				}
+				ok = m < ns;
+			}
+		}
+	}
 
-	int result = XFillRectangle(disp, hdc->wnd->window, hdc->gc, lprc->left,
-	    lprc->top, (lprc->right - lprc->left), (lprc->bottom - lprc->top));
+	if (ok && fill) {
+		if (np == 0) {
+			run_add(&hdc->runs[k], r);
+			return TRUE;
+		}
+		if ((end = run_at_end(hdc, TRUE, GDI_SHAPE_RECT, color,
+		    np)) != NULL) {
+			run_add(&hdc->runs[k], r);
+			for (i = 0; i < np; i++)
+				run_add(end, &patches[i]);
+			return TRUE;
+		}
+	} else if (ok) {
+		run_add(&hdc->runs[k], r);
+		runs_drop(hdc, k, sp, ns);
+		return TRUE;
+	}
 
-	printf("%d\n", result);
+	/* Drawing it after everything else is always right */
+	if ((end = run_at_end(hdc, fill, shape, color, 1)) == NULL)
+		return FALSE;
+	run_add(end, r);
 	return TRUE;
 }
 
+static void
+batch_send(HDC hdc, struct gdi_batch *b)
+{
+	if (b->count == 0)
+		return;
+
+	setFgColor(hdc, b->color);
+	if (b->shape == GDI_SHAPE_RECT) {
+		if (b->fill) {
+			XFillRectangles(disp, hdc->drawable, hdc->gc,
+			    b->u.rects, b->count);
+		} else {
+			XDrawRectangles(disp, hdc->drawable, hdc->gc,
+			    b->u.rects, b->count);
+		}
+	} else {
+		if (b->fill) {
+			XFillArcs(disp, hdc->drawable, hdc->gc, b->u.arcs,
+			    b->count);
+		} else {
+			XDrawArcs(disp, hdc->drawable, hdc->gc, b->u.arcs,
+			    b->count);
+		}
+	}
+	b->count = 0;
+}
+
+void
+w32x_dc_flush(HDC hdc)
+{
+	int i;
+
+	if (!hdc->dirty)
+		return;
+
+	for (i = 0; i < hdc->nruns; i++)
+		batch_send(hdc, &hdc->runs[i]);
+	hdc->nruns = 0;
+
+	w32x_lock();
+	TAILQ_REMOVE(hdc->dirty_list, hdc, dirty_entries);
+	w32x_unlock();
+	hdc->dirty = FALSE;
+}
+
+/* Flush every DC; called before the message loop goes to sleep. */
+void
+w32x_gdi_flush_all(void)
+{
+	HDC hdc;
+
+	if (dirty_dcs.tqh_last == NULL)
+		return;
+	for (;;) {
+		w32x_lock();
+		hdc = TAILQ_FIRST(&dirty_dcs);
+		w32x_unlock();
+		if (hdc == NULL)
+			break;
+		w32x_dc_flush(hdc);
+	}
+}
 
 static void
-region_get_clip_box(HRGN hrgn, XRectangle* rect)
+batch_add(HDC hdc, BOOL fill, enum gdi_shape shape, COLORREF color,
+    int x, int y, int width, int height)
 {
-	XClipBox(hrgn->region, rect);
+	XRectangle r;
+
+	if (width <= 0 || height <= 0)
+		return;
+
+	/* Memory DCs have nothing to batch for */
+	if (hdc->mem) {
+		w32x_mem_shape(hdc, fill, shape, color, x, y, width, height);
+		return;
+	}
+
+	r.x = x;
+	r.y = y;
+	r.width = width;
+	r.height = height;
+
+	if (!batch_place(hdc, fill, shape, color, &r)) {
+		w32x_dc_flush(hdc);
+		batch_place(hdc, fill, shape, color, &r);
+	}
+
+	if (!hdc->dirty) {
+		if (dirty_dcs.tqh_last == NULL)
+			TAILQ_INIT(&dirty_dcs);
+		w32x_lock();
+		TAILQ_INSERT_TAIL(&dirty_dcs, hdc, dirty_entries);
+		w32x_unlock();
+		hdc->dirty_list = &dirty_dcs;
+		hdc->dirty = TRUE;
+	}
 }
 
-static int
-region_get_complexity(HRGN hrgn)
+BOOL Ellipse(HDC hdc, int nLeftRect, int nTopRect, int nRightRect,
+    int nBottomRect)
 {
-	int ret;
-	if (XEmptyRegion(hrgn->region)) {
-		ret = NULLREGION;
+	struct gdi_brush *brush = w32x_gdi_get(hdc->selectedBrush,
+	    GDI_TYPE_BRUSH);
+	struct gdi_pen *pen = w32x_gdi_get(hdc->selectedPen, GDI_TYPE_PEN);
+
+	if (brush == NULL || pen == NULL)
+		return FALSE;
+
+	batch_add(hdc, TRUE, GDI_SHAPE_ARC, brush->color,
+	    nLeftRect, nTopRect, nRightRect - nLeftRect,
+	    nBottomRect - nTopRect);
+	batch_add(hdc, FALSE, GDI_SHAPE_ARC, pen->color,
+	    nLeftRect, nTopRect, nRightRect - nLeftRect,
+	    nBottomRect - nTopRect);
+	return TRUE;
+
+}
+
+BOOL Rectangle(HDC hdc, int nLeftRect, int nTopRect,
+  int nRightRect, int nBottomRect)
+{
+	struct gdi_brush *brush = w32x_gdi_get(hdc->selectedBrush,
+	    GDI_TYPE_BRUSH);
+
+	if (brush == NULL)
+		return FALSE;
+
+	batch_add(hdc, FALSE, GDI_SHAPE_RECT, brush->color,
+	    nLeftRect, nTopRect, nRightRect - nLeftRect,
+	    nBottomRect - nTopRect);
+
+	return TRUE;
+}
+
+BOOL FillRect(HDC hdc, const RECT *lprc, HBRUSH hbr)
+{
+	struct gdi_brush *brush;
+	COLORREF color;
+
+	/* Like the class background, hbr may be a system color index + 1 */
+	if (hbr >= (HBRUSH)(COLOR_SCROLLBAR + 1) &&
+	    hbr <= (HBRUSH)(COLOR_MENUBAR + 1)) {
+		color = GetSysColor(((long)hbr) - 1);
 	} else {
-		XRectangle r;
-		XClipBox(hrgn->region, &r);
-		if (XRectInRegion(hrgn->region, r.x, r.y, r.width, r.height)) {
-			ret = SIMPLEREGION;
-		} else {
-			ret = COMPLEXREGION;
-		}
+		if ((brush = w32x_gdi_get(hbr, GDI_TYPE_BRUSH)) == NULL)
+			return FALSE;
+		color = brush->color;
 	}
-	return ret;
+
+	batch_add(hdc, TRUE, GDI_SHAPE_RECT, color, lprc->left, lprc->top,
+	    lprc->right - lprc->left, lprc->bottom - lprc->top);
+	return TRUE;
 }
 
 int
 GetRgnBox(HRGN hrgn, RECT *r)
 {
-	if (hrgn->obj_sig != REGION_MAGIC)
-		return RGN_ERROR;
+	struct gdi_region *rgn = w32x_gdi_get(hrgn, GDI_TYPE_REGION);
 
-	if (r != NULL) {
-		XRectangle rect;
+	if (rgn == NULL)
+		return RGN_ERROR;
 
-		region_get_clip_box(hrgn, &rect);
-		r->left   = rect.x;
-		r->right  = rect.x + rect.width;
-		r->top    = rect.y;
-		r->bottom = rect.y + rect.height;
-	}
-	return region_get_complexity(hrgn);
+	if (r != NULL)
+		*r = rgn->region.extents;
+	return rgn->region.complexity;
 }
 
 int
-CombineRgn(HRGN dest, HRGN src1, HRGN src2, int combineMode)
+CombineRgn(HRGN hdest, HRGN hsrc1, HRGN hsrc2, int combineMode)
 {
-	Region tmp;
-	switch (combineMode) {
-	case RGN_AND:
-		XIntersectRegion(src1->region, src2->region, dest->region);
-		break;
-	case RGN_COPY:
-		tmp = XCreateRegion();
-		XUnionRegion(src1->region, tmp, dest->region);
-		XDestroyRegion(tmp);
-		break;
-	case RGN_DIFF:
-		XSubtractRegion(src1->region, src2->region, dest->region);
-		break;
-	case RGN_OR:
-		XUnionRegion(src1->region, src2->region, dest->region);
-		break;
-	case RGN_XOR:
-		XXorRegion(src1->region, src2->region, dest->region);
-		break;
-	}
-	return region_get_complexity(dest);
+	struct gdi_region *dest = w32x_gdi_get(hdest, GDI_TYPE_REGION);
+	struct gdi_region *src1 = w32x_gdi_get(hsrc1, GDI_TYPE_REGION);
+	struct gdi_region *src2 = w32x_gdi_get(hsrc2, GDI_TYPE_REGION);
+
+	if (dest == NULL || src1 == NULL)
+		return RGN_ERROR;
+	if (combineMode == RGN_COPY)
+		src2 = src1;
+	else if (src2 == NULL)
+		return RGN_ERROR;
+
+	return w32x_region_combine(&dest->region, &src1->region,
+	    &src2->region, combineMode);
 }
 
 BOOL
 SetRectRgn(HRGN hrgn, int left, int top, int right, int bottom)
 {
-	if (hrgn->obj_sig != REGION_MAGIC)
+	struct gdi_region *rgn = w32x_gdi_get(hrgn, GDI_TYPE_REGION);
+
+	if (rgn == NULL)
 		return FALSE;
 
-	if (hrgn->region != NULL) {
-		XDestroyRegion(hrgn->region);
-	}
-	hrgn->region = XCreateRegion();
-	region_union_rect(hrgn, left, top, right, bottom);
+	w32x_region_set_rect(&rgn->region, left, top, right, bottom);
 	return TRUE;
 }
 
+BOOL
+PtInRegion(HRGN hrgn, int x, int y)
+{
+	struct gdi_region *rgn = w32x_gdi_get(hrgn, GDI_TYPE_REGION);
 
+	if (rgn == NULL)
+		return FALSE;
+
+	return w32x_region_contains_point(&rgn->region, x, y);
+}
@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2018 Devin Smith <devin@devinsmith.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/XKBlib.h>
+#include <X11/keysym.h>
+#ifdef HAVE_XFT_H
+#include <X11/Xft/Xft.h>
+#endif
+
+#include <windows.h>
+#include "w32x_priv.h"
+
+/*
+ * Keyboard input.
+ *
+ * The virtual key of every keycode is worked out once from the keyboard
+ * mapping and kept in a table, which is rebuilt only when the server
+ * reports a MappingNotify. Turning a KeyPress into WM_KEYDOWN is a table
+ * lookup; XLookupString only runs in TranslateMessage, when the
+ * application asks for characters.
+ *
+ * The thread reading a MappingNotify builds the new table off to the side
+ * and swaps it in under the library lock, which other threads take for
+ * their lookups, so none of them sees a table half rebuilt.
+ *
+ * The scan code in lParam is the keycode less 8, which on Linux is the
+ * PC set 1 scan code for most keys. TranslateMessage gets the keycode
+ * back from it, and the modifier state from a short record of recent key
+ * presses.
+ */
+
+extern Display *disp;
+
+#define KEY_PENDING 64 /* key presses remembered for TranslateMessage */
+
+struct vk_map {
+	BYTE vk[256];           /* keycode to VK, 0 for none */
+	BYTE numlock[256];      /* VK while NumLock is on, if different */
+	BYTE extended[256 / 8]; /* lParam bit 24 */
+	unsigned int numlock_mask;
+};
+
+static struct vk_map *vk_map;
+static __thread BYTE key_down[256 / 8];
+
+static __thread struct {
+	unsigned char keycode;
+	unsigned int state;
+} pending[KEY_PENDING];
+static __thread unsigned int pending_head, pending_tail;
+
+#define BIT_SET(a, i) ((a)[(i) / 8] |= 1 << ((i) % 8))
+#define BIT_CLR(a, i) ((a)[(i) / 8] &= ~(1 << ((i) % 8)))
+#define BIT_ISSET(a, i) (((a)[(i) / 8] >> ((i) % 8)) & 1)
+
+static const struct {
+	KeySym sym;
+	BYTE vk;
+	BOOL extended;
+} keysym_vk[] = {
+	{ XK_BackSpace, VK_BACK, FALSE },
+	{ XK_Tab, VK_TAB, FALSE },
+	{ XK_ISO_Left_Tab, VK_TAB, FALSE },
+	{ XK_Clear, VK_CLEAR, FALSE },
+	{ XK_Return, VK_RETURN, FALSE },
+	{ XK_Pause, VK_PAUSE, FALSE },
+	{ XK_Scroll_Lock, VK_SCROLL, FALSE },
+	{ XK_Escape, VK_ESCAPE, FALSE },
+	{ XK_Delete, VK_DELETE, TRUE },
+	{ XK_Home, VK_HOME, TRUE },
+	{ XK_Left, VK_LEFT, TRUE },
+	{ XK_Up, VK_UP, TRUE },
+	{ XK_Right, VK_RIGHT, TRUE },
+	{ XK_Down, VK_DOWN, TRUE },
+	{ XK_Prior, VK_PRIOR, TRUE },
+	{ XK_Next, VK_NEXT, TRUE },
+	{ XK_End, VK_END, TRUE },
+	{ XK_Insert, VK_INSERT, TRUE },
+	{ XK_Print, VK_SNAPSHOT, TRUE },
+	{ XK_Menu, VK_APPS, TRUE },
+	{ XK_Num_Lock, VK_NUMLOCK, TRUE },
+	{ XK_KP_Enter, VK_RETURN, TRUE },
+	{ XK_KP_Home, VK_HOME, FALSE },
+	{ XK_KP_Left, VK_LEFT, FALSE },
+	{ XK_KP_Up, VK_UP, FALSE },
+	{ XK_KP_Right, VK_RIGHT, FALSE },
+	{ XK_KP_Down, VK_DOWN, FALSE },
+	{ XK_KP_Prior, VK_PRIOR, FALSE },
+	{ XK_KP_Next, VK_NEXT, FALSE },
+	{ XK_KP_End, VK_END, FALSE },
+	{ XK_KP_Begin, VK_CLEAR, FALSE },
+	{ XK_KP_Insert, VK_INSERT, FALSE },
+	{ XK_KP_Delete, VK_DELETE, FALSE },
+	{ XK_KP_Multiply, VK_MULTIPLY, FALSE },
+	{ XK_KP_Add, VK_ADD, FALSE },
+	{ XK_KP_Separator, VK_SEPARATOR, FALSE },
+	{ XK_KP_Subtract, VK_SUBTRACT, FALSE },
+	{ XK_KP_Decimal, VK_DECIMAL, FALSE },
+	{ XK_KP_Divide, VK_DIVIDE, TRUE },
+	{ XK_Shift_L, VK_SHIFT, FALSE },
+	{ XK_Shift_R, VK_SHIFT, FALSE },
+	{ XK_Control_L, VK_CONTROL, FALSE },
+	{ XK_Control_R, VK_CONTROL, TRUE },
+	{ XK_Alt_L, VK_MENU, FALSE },
+	{ XK_Alt_R, VK_MENU, TRUE },
+	{ XK_ISO_Level3_Shift, VK_MENU, TRUE },
+	{ XK_Meta_L, VK_MENU, FALSE },
+	{ XK_Meta_R, VK_MENU, TRUE },
+	{ XK_Caps_Lock, VK_CAPITAL, FALSE },
+	{ XK_Super_L, VK_LWIN, TRUE },
+	{ XK_Super_R, VK_RWIN, TRUE },
+	{ XK_space, VK_SPACE, FALSE },
+	{ XK_semicolon, VK_OEM_1, FALSE },
+	{ XK_equal, VK_OEM_PLUS, FALSE },
+	{ XK_comma, VK_OEM_COMMA, FALSE },
+	{ XK_minus, VK_OEM_MINUS, FALSE },
+	{ XK_period, VK_OEM_PERIOD, FALSE },
+	{ XK_slash, VK_OEM_2, FALSE },
+	{ XK_grave, VK_OEM_3, FALSE },
+	{ XK_bracketleft, VK_OEM_4, FALSE },
+	{ XK_backslash, VK_OEM_5, FALSE },
+	{ XK_bracketright, VK_OEM_6, FALSE },
+	{ XK_apostrophe, VK_OEM_7, FALSE },
+	{ XK_less, VK_OEM_102, FALSE },
+};
+
+static BYTE
+keysym_to_vk(KeySym sym, BOOL *extended)
+{
+	unsigned int i;
+
+	*extended = FALSE;
+	if (sym >= XK_a && sym <= XK_z)
+		return 'A' + (sym - XK_a);
+	if (sym >= XK_A && sym <= XK_Z)
+		return 'A' + (sym - XK_A);
+	if (sym >= XK_0 && sym <= XK_9)
+		return '0' + (sym - XK_0);
+	if (sym >= XK_KP_0 && sym <= XK_KP_9)
+		return VK_NUMPAD0 + (sym - XK_KP_0);
+	if (sym >= XK_F1 && sym <= XK_F24)
+		return VK_F1 + (sym - XK_F1);
+
+	for (i = 0; i < sizeof(keysym_vk) / sizeof(keysym_vk[0]); i++) {
+		if (keysym_vk[i].sym == sym) {
+			*extended = keysym_vk[i].extended;
+			return keysym_vk[i].vk;
+		}
+	}
+
+	/* Other keys that type something, e.g. letters of other layouts */
+	if ((sym >= 0x20 && sym <= 0xff) || (sym & 0xff000000) == 0x01000000)
+		return VK_OEM_8;
+	return 0;
+}
+
+/* The modifier bit NumLock is mapped to */
+static unsigned int
+find_numlock(void)
+{
+	XModifierKeymap *mods;
+	KeyCode kc = XKeysymToKeycode(disp, XK_Num_Lock);
+	unsigned int mask = 0;
+	int i;
+
+	if (kc == 0 || (mods = XGetModifierMapping(disp)) == NULL)
+		return 0;
+	for (i = 0; i < 8 * mods->max_keypermod; i++) {
+		if (mods->modifiermap[i] == kc) {
+			mask = 1 << (i / mods->max_keypermod);
+			break;
+		}
+	}
+	XFreeModifiermap(mods);
+	return mask;
+}
+
+static void
+build_vk_table(void)
+{
+	struct vk_map *map, *old;
+	KeySym *syms;
+	BOOL extended, ext2;
+	int min, max, per, kc;
+	BYTE vk;
+
+	if ((map = calloc(1, sizeof(*map))) == NULL) {
+		fprintf(stderr, "XXX: Out of memory for the keyboard map\n");
+		return;
+	}
+
+	XDisplayKeycodes(disp, &min, &max);
+	syms = XGetKeyboardMapping(disp, min, max - min + 1, &per);
+	if (syms != NULL) {
+		for (kc = min; kc <= max; kc++) {
+			const KeySym *s = &syms[(kc - min) * per];
+
+			/* The unshifted symbol names the key */
+			map->vk[kc] = keysym_to_vk(s[0], &extended);
+			if (extended)
+				BIT_SET(map->extended, kc);
+
+			/* Keypad keys are digits with NumLock on */
+			if (per > 1 && IsKeypadKey(s[1]) &&
+			    (vk = keysym_to_vk(s[1], &ext2)) != map->vk[kc])
+				map->numlock[kc] = vk;
+		}
+		XFree(syms);
+	}
+	map->numlock_mask = find_numlock();
+
+	w32x_lock();
+	old = vk_map;
+	vk_map = map;
+	w32x_unlock();
+	free(old);
+}
+
+void
+w32x_keyboard_init(void)
+{
+	/* Report held keys as repeated presses without the releases in
+	 * between, so the previous key state bit is right */
+	XkbSetDetectableAutoRepeat(disp, True, NULL);
+	build_vk_table();
+}
+
+void
+w32x_keyboard_mapping(XMappingEvent *e)
+{
+	XRefreshKeyboardMapping(e);
+	if (e->request == MappingKeyboard || e->request == MappingModifier)
+		build_vk_table();
+}
+
+void
+w32x_keyboard_translate(const XKeyEvent *e, LPMSG msg)
+{
+	unsigned int kc = e->keycode & 0xff;
+	BOOL extended = FALSE;
+	BYTE vk = 0;
+	LPARAM lParam;
+
+	w32x_lock();
+	if (vk_map != NULL) {
+		vk = vk_map->vk[kc];
+		if ((e->state & vk_map->numlock_mask) &&
+		    vk_map->numlock[kc] != 0)
+			vk = vk_map->numlock[kc];
+		extended = BIT_ISSET(vk_map->extended, kc);
+	}
+	w32x_unlock();
+	if (vk == 0)
+		return;
+
+	lParam = 1 | ((LPARAM)((kc - 8) & 0xff) << 16);
+	if (extended)
+		lParam |= 1 << 24;
+
+	if (e->type == KeyPress) {
+		if (BIT_ISSET(key_down, kc))
+			lParam |= 1 << 30;
+		BIT_SET(key_down, kc);
+
+		/* Remembered for TranslateMessage, the oldest is dropped
+		 * if the application never calls it */
+		pending[pending_tail % KEY_PENDING].keycode = kc;
+		pending[pending_tail % KEY_PENDING].state = e->state;
+		pending_tail++;
+		if (pending_tail - pending_head > KEY_PENDING)
+			pending_head = pending_tail - KEY_PENDING;
+
+		msg->message = WM_KEYDOWN;
+	} else {
+		BIT_CLR(key_down, kc);
+		lParam |= (LPARAM)3 << 30;
+		msg->message = WM_KEYUP;
+	}
+	msg->wParam = vk;
+	msg->lParam = lParam;
+}
+
+/*
+ * The characters a WM_KEYDOWN types, as Unicode code points. Returns the
+ * number stored in chars.
+ */
+int
+w32x_keyboard_chars(const MSG *msg, WPARAM *chars, int max)
+{
+	unsigned int kc = (((DWORD)msg->lParam >> 16) & 0xff) + 8;
+	unsigned char buf[8];
+	XKeyEvent e;
+	KeySym sym;
+	int i, n;
+
+	/* Find the press; older ones were never translated */
+	while (pending_head != pending_tail &&
+	    pending[pending_head % KEY_PENDING].keycode != kc)
+		pending_head++;
+	if (pending_head == pending_tail)
+		return 0;
+
+	memset(&e, 0, sizeof(e));
+	e.type = KeyPress;
+	e.display = disp;
+	e.keycode = kc;
+	e.state = pending[pending_head % KEY_PENDING].state;
+	pending_head++;
+
+	n = XLookupString(&e, (char *)buf, sizeof(buf), &sym, NULL);
+	if (n > max)
+		n = max;
+	/* XLookupString produces Latin-1, which is the first 256 code
+	 * points; other symbols may carry a code point of their own */
+	for (i = 0; i < n; i++)
+		chars[i] = buf[i];
+	if (n == 0 && max > 0 && (sym & 0xff000000) == 0x01000000) {
+		chars[0] = sym & 0x00ffffff;
+		n = 1;
+	}
+	return n;
+}
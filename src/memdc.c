@@ -0,0 +1,498 @@
+/*
+ * Copyright (c) 2018 Devin Smith <devin@devinsmith.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef HAVE_XFT_H
+#include <X11/Xft/Xft.h>
+#endif
+
+#include <windows.h>
+#include "w32x_priv.h"
+
+/*
+ * Memory DCs.
+ *
+ * A memory DC has no window, drawable or GC. It draws into the bitmap
+ * selected into it with a small software rasterizer, so it works the same
+ * with or without a display, and the pixels are read back with GetDIBits.
+ * There is no server to batch requests for, so shapes are drawn as they
+ * come. Everything is clipped to the bitmap and to the region selected
+ * with SelectClipRgn.
+ *
+ * Shapes cover the same pixels as the X requests a window DC sends for
+ * them, so a picture comes out the same on a window and in a bitmap:
+ * fills cover width x height pixels and outlines, drawn as X draws zero
+ * width lines, one more in each direction. Text is drawn anti-aliased
+ * with FreeType, from the face fontconfig picks for the font (font.c).
+ */
+
+/* Where a memory DC draws: its bitmap and the clip list. Without a clip
+ * region the list is the bitmap bounds. */
+struct target {
+	struct w32x_surface s;
+	const RECT *rects; /* y-x banded */
+	int nrects;
+	RECT bounds;
+};
+
+static BOOL
+target_get(HDC hdc, struct target *t)
+{
+	struct gdi_bitmap *bmp = w32x_gdi_get(hdc->selectedBitmap,
+	    GDI_TYPE_BITMAP);
+
+	if (bmp == NULL)
+		return FALSE;
+
+	w32x_dib_surface(bmp->dib, &t->s);
+	SetRect(&t->bounds, 0, 0, t->s.width, t->s.height);
+	if (hdc->clip != NULL) {
+		t->rects = w32x_region_rects(hdc->clip, &t->nrects);
+	} else {
+		t->rects = &t->bounds;
+		t->nrects = 1;
+	}
+	return TRUE;
+}
+
+static uint32_t *
+target_row(const struct target *t, int y)
+{
+	return t->s.bits + (ptrdiff_t)y * t->s.pitch;
+}
+
+/*
+ * Visible pieces of the span [x0, x1) on row y, one per call: *i is the
+ * clip rectangle to continue from, 0 for the first call. The list is
+ * banded, so the walk ends at the first band below the row.
+ */
+static BOOL
+span_next(const struct target *t, int y, int x0, int x1, int *i, int *l,
+    int *r)
+{
+	const RECT *rc;
+
+	if (y < 0 || y >= t->s.height)
+		return FALSE;
+	x0 = MAX(x0, 0);
+	x1 = MIN(x1, t->s.width);
+
+	for (; *i < t->nrects; (*i)++) {
+		rc = &t->rects[*i];
+		if (rc->top > y)
+			return FALSE;
+		if (rc->bottom <= y || rc->right <= x0 || rc->left >= x1)
+			continue;
+		*l = MAX(x0, rc->left);
+		*r = MIN(x1, rc->right);
+		(*i)++;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/* BGRX pixel of a COLORREF */
+static uint32_t
+color_pixel(COLORREF cr)
+{
+	return (uint32_t)GetRValue(cr) << 16 | GetGValue(cr) << 8 |
+	    GetBValue(cr);
+}
+
+static void
+fill_span(const struct target *t, int y, int x0, int x1, uint32_t pixel)
+{
+	uint32_t *row;
+	int i = 0, l, r;
+
+	while (span_next(t, y, x0, x1, &i, &l, &r)) {
+		row = target_row(t, y);
+		while (l < r)
+			row[l++] = pixel;
+	}
+}
+
+/* Outline of the rectangle X draws for XDrawRectangle(x, y, w, h) */
+static void
+frame_rect(const struct target *t, int x, int y, int w, int h,
+    uint32_t pixel)
+{
+	int j;
+
+	fill_span(t, y, x, x + w + 1, pixel);
+	for (j = y + 1; j < y + h; j++) {
+		fill_span(t, j, x, x + 1, pixel);
+		fill_span(t, j, x + w, x + w + 1, pixel);
+	}
+	fill_span(t, y + h, x, x + w + 1, pixel);
+}
+
+static int64_t
+isqrt(int64_t v)
+{
+	int64_t r = 0, b = (int64_t)1 << 62;
+
+	while (b > v)
+		b >>= 2;
+	while (b != 0) {
+		if (v >= r + b) {
+			v -= r + b;
+			r = (r >> 1) + b;
+		} else {
+			r >>= 1;
+		}
+		b >>= 2;
+	}
+	return r;
+}
+
+static int64_t
+floor_half(int64_t v)
+{
+	return v >= 0 ? v / 2 : -((-v + 1) / 2);
+}
+
+/*
+ * Pixels [*l, *r) of row py whose centers lie inside an ellipse. All of it
+ * is in half pixels, so that pixel centers and the centers of the boxes X
+ * takes are integers: the center is at cx, cy and the semi-axes are a and
+ * b, and pixel px has its center at 2 * px + 1.
+ */
+static BOOL
+ellipse_span(int cx, int cy, int a, int b, int py, int *l, int *r)
+{
+	int64_t dy = 2 * (int64_t)py + 1 - cy;
+	int64_t bb = (int64_t)b * b;
+	int64_t m;
+
+	if (dy * dy > bb)
+		return FALSE;
+
+	/* (dx / a)^2 + (dy / b)^2 <= 1 */
+	m = isqrt((int64_t)a * a * (bb - dy * dy) / bb);
+	*l = -floor_half(-((int64_t)cx - m - 1));
+	*r = floor_half((int64_t)cx + m - 1) + 1;
+	return *l < *r;
+}
+
+/*
+ * Both the fill and the outline are of the ellipse inscribed in the w x h
+ * box at x, y, as Ellipse draws it. The fill stays half a pixel inside
+ * the outline, which covers its edge, so no fill pixel is left outside.
+ */
+static void
+fill_ellipse(const struct target *t, int x, int y, int w, int h,
+    uint32_t pixel)
+{
+	int j, l, r;
+
+	/* Too thin to have an inside */
+	if (w < 2 || h < 2)
+		return;
+
+	for (j = MAX(y, 0); j < y + h && j < t->s.height; j++) {
+		if (ellipse_span(2 * x + w, 2 * y + h, w - 1, h - 1, j, &l, &r))
+			fill_span(t, j, l, r, pixel);
+	}
+}
+
+/*
+ * A one pixel pen: inside the ellipse, but not inside the one a pixel
+ * smaller all round. Where the ellipse is steep that can leave rows
+ * without a pen pixel on a side, so each side also takes at least one
+ * pixel and whatever reaches past the rows above and below; that keeps
+ * the outline closed around the fill.
+ */
+static void
+frame_ellipse(const struct target *t, int x, int y, int w, int h,
+    uint32_t pixel)
+{
+	int cx = 2 * x + w, cy = 2 * y + h;
+	int j, l, r, il, ir, al, ar, bl, br;
+
+	for (j = MAX(y, 0); j < y + h && j < t->s.height; j++) {
+		if (!ellipse_span(cx, cy, w, h, j, &l, &r))
+			continue;
+		if (w > 2 && h > 2 &&
+		    ellipse_span(cx, cy, w - 2, h - 2, j, &il, &ir) &&
+		    ellipse_span(cx, cy, w, h, j - 1, &al, &ar) &&
+		    ellipse_span(cx, cy, w, h, j + 1, &bl, &br)) {
+			il = MAX(MAX(il, l + 1), MAX(al, bl));
+			ir = MIN(MIN(ir, r - 1), MIN(ar, br));
+		} else {
+			il = ir = r;
+		}
+		if (il < ir) {
+			fill_span(t, j, l, il, pixel);
+			fill_span(t, j, ir, r, pixel);
+		} else {
+			fill_span(t, j, l, r, pixel);
+		}
+	}
+}
+
+/* Draw a shape the way batch_add (graphics.c) would queue it. */
+void
+w32x_mem_shape(HDC hdc, BOOL fill, enum gdi_shape shape, COLORREF color,
+    int x, int y, int width, int height)
+{
+	uint32_t pixel = color_pixel(color);
+	struct target t;
+
+	if (!target_get(hdc, &t))
+		return;
+
+	/* Window DCs send 16 bit sizes, and the ellipse math needs them */
+	width = MIN(width, SHRT_MAX);
+	height = MIN(height, SHRT_MAX);
+
+	if (shape == GDI_SHAPE_RECT) {
+		if (fill) {
+			for (; height > 0; height--)
+				fill_span(&t, y++, x, x + width, pixel);
+		} else {
+			frame_rect(&t, x, y, width, height, pixel);
+		}
+	} else {
+		if (fill)
+			fill_ellipse(&t, x, y, width, height, pixel);
+		else
+			frame_ellipse(&t, x, y, width, height, pixel);
+	}
+}
+
+/* Copy width x height pixels to x, y; src is the top left one and pitch
+ * the distance between rows in pixels. */
+void
+w32x_mem_put_pixels(HDC hdc, int x, int y, int width, int height,
+    const uint32_t *src, int pitch)
+{
+	struct target t;
+	int i, j, l, r;
+
+	if (!target_get(hdc, &t))
+		return;
+
+	for (j = 0; j < height; j++) {
+		i = 0;
+		while (span_next(&t, y + j, x, x + width, &i, &l, &r)) {
+			memcpy(target_row(&t, y + j) + l,
+			    src + (ptrdiff_t)j * pitch + (l - x),
+			    (size_t)(r - l) * 4);
+		}
+	}
+}
+
+#ifdef HAVE_XFT_H
+/* Next character of UTF-16 text, combining surrogate pairs */
+static FT_ULong
+next_char(LPCWSTR s, int c, int *i)
+{
+	FT_ULong ch = s[(*i)++];
+
+	if (ch >= 0xd800 && ch <= 0xdbff && *i < c &&
+	    s[*i] >= 0xdc00 && s[*i] <= 0xdfff)
+		ch = 0x10000 + ((ch - 0xd800) << 10) + (s[(*i)++] - 0xdc00);
+	return ch;
+}
+
+static FT_UInt
+char_glyph(FT_Face ft, const struct w32x_font_metrics *m, FT_ULong ch)
+{
+	FT_UInt index = FT_Get_Char_Index(ft, ch);
+
+	/* Missing characters are drawn as the default character */
+	return index != 0 ? index : FT_Get_Char_Index(ft, m->default_char);
+}
+
+/* Blend a rendered glyph in, its top left pixel at x, y */
+static void
+glyph_draw(const struct target *t, const FT_Bitmap *bm, int x, int y,
+    uint32_t pixel)
+{
+	const unsigned char *src;
+	uint32_t *row, d;
+	unsigned int a;
+	int gy, i, l, r, shift;
+
+	for (gy = 0; gy < (int)bm->rows; gy++) {
+		src = bm->pitch >= 0 ? bm->buffer + gy * bm->pitch :
+		    bm->buffer + (bm->rows - 1 - gy) * -bm->pitch;
+		i = 0;
+		while (span_next(t, y + gy, x, x + (int)bm->width, &i, &l,
+		    &r)) {
+			row = target_row(t, y + gy);
+			for (; l < r; l++) {
+				if (bm->pixel_mode == FT_PIXEL_MODE_MONO)
+					a = (src[(l - x) >> 3] &
+					    (0x80 >> ((l - x) & 7))) ? 255 : 0;
+				else
+					a = src[l - x];
+				if (a == 0)
+					continue;
+				if (a == 255) {
+					row[l] = pixel;
+					continue;
+				}
+				d = 0;
+				for (shift = 0; shift <= 16; shift += 8) {
+					d |= ((((pixel >> shift) & 0xff) * a +
+					    ((row[l] >> shift) & 0xff) *
+					    (255 - a) + 127) / 255) << shift;
+				}
+				row[l] = d;
+			}
+		}
+	}
+}
+#endif
+
+/* TextOutW for memory DCs */
+BOOL
+w32x_mem_text_out(HDC hdc, int x, int y, LPCWSTR s, int c)
+{
+#ifdef HAVE_XFT_H
+	struct gdi_font *font = w32x_gdi_get(hdc->selectedFont,
+	    GDI_TYPE_FONT);
+	const struct w32x_font_metrics *m;
+	uint32_t pixel = color_pixel(hdc->textColor);
+	struct target t;
+	FT_Face ft;
+	int i = 0;
+
+	if (font == NULL || (m = w32x_font_mem_metrics(font)) == NULL ||
+	    !target_get(hdc, &t))
+		return FALSE;
+
+	/* The face is shared by all threads */
+	w32x_lock();
+	ft = w32x_font_ft(font);
+	y += m->ascent;
+	while (i < c) {
+		if (FT_Load_Glyph(ft, char_glyph(ft, m, next_char(s, c, &i)),
+		    FT_LOAD_RENDER) != 0)
+			continue;
+		glyph_draw(&t, &ft->glyph->bitmap, x + ft->glyph->bitmap_left,
+		    y - ft->glyph->bitmap_top, pixel);
+		x += (ft->glyph->advance.x + 32) >> 6;
+	}
+	w32x_unlock();
+	return TRUE;
+#else
+	fprintf(stderr, "XXX: Text on memory DCs needs Xft\n");
+	return FALSE;
+#endif
+}
+
+/* GetTextExtentPoint32W for memory DCs */
+BOOL
+w32x_mem_text_extent(HDC hdc, LPCWSTR s, int c, LPSIZE size)
+{
+#ifdef HAVE_XFT_H
+	struct gdi_font *font = w32x_gdi_get(hdc->selectedFont,
+	    GDI_TYPE_FONT);
+	const struct w32x_font_metrics *m;
+	FT_ULong ch;
+	FT_Face ft;
+	int i = 0, width = 0;
+
+	if (font == NULL || (m = w32x_font_mem_metrics(font)) == NULL)
+		return FALSE;
+
+	w32x_lock();
+	ft = w32x_font_ft(font);
+	while (i < c) {
+		/* The table has the first 256 */
+		if ((ch = next_char(s, c, &i)) < 256)
+			width += m->advance[ch];
+		else if (FT_Load_Glyph(ft, char_glyph(ft, m, ch),
+		    FT_LOAD_DEFAULT) == 0)
+			width += (ft->glyph->advance.x + 32) >> 6;
+	}
+	w32x_unlock();
+
+	size->cx = width;
+	size->cy = m->ascent + m->descent;
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+/*
+ * A memory DC starts out with a 1x1 stock bitmap selected, as on Win32;
+ * it is drawn on once the application selects a bitmap of its own. hdc,
+ * the DC it is meant to be compatible with, is not needed: memory DCs
+ * always hold 32 bit pixels.
+ */
+HDC
+CreateCompatibleDC(HDC hdc)
+{
+	HDC dc;
+
+	if ((dc = calloc(1, sizeof(struct WndDC))) == NULL) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return NULL;
+	}
+	dc->mem = TRUE;
+	dc->fgColor = CLR_INVALID;
+	dc->textColor = RGB(0, 0, 0);
+	dc->clip_serial = 1;
+	w32x_region_set_rect(&dc->clip_rgn, 0, 0, 0, 0);
+	w32x_region_set_rect(&dc->clip_both, 0, 0, 0, 0);
+
+	dc->selectedBitmap = w32x_stock_bitmap();
+	w32x_gdi_select(dc->selectedBitmap, NULL);
+	return dc;
+}
+
+/* Deletes a memory DC; window DCs belong to their window. The objects
+ * selected into it can be deleted afterwards. */
+BOOL
+DeleteDC(HDC hdc)
+{
+	if (hdc == NULL || !hdc->mem) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	w32x_gdi_select(NULL, hdc->selectedBitmap);
+	w32x_gdi_select(NULL, hdc->selectedPen);
+	w32x_gdi_select(NULL, hdc->selectedBrush);
+	w32x_gdi_select(NULL, hdc->selectedFont);
+	free(hdc->clip_rgn.heap);
+	free(hdc->clip_both.heap);
+	free(hdc);
+	return TRUE;
+}
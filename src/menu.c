@@ -25,27 +25,67 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/queue.h>
 #include <windows.h>
 
 #define MENU_MAGIC 0x574d4e55 /* 'WMNU' */
 
+/*
+ * Each menu keeps its items in an array by position, and each menu tree
+ * keeps a hash of every item in it by command ID. The hash lives on the
+ * root menu; attaching a popup to another menu moves the popup's items
+ * into the new root's hash. Finding an item by position is an array
+ * index and finding it by command is a hash lookup plus a walk up the
+ * (short) chain of parent menus to check it belongs to the menu asked
+ * about.
+ */
+
 struct w32x_menuitem {
 	MENUITEMINFO info;
-	TAILQ_ENTRY(w32x_menuitem) list;
+	HMENU menu;                   /* menu the item is in */
+	struct w32x_menuitem *id_next; /* same hash bucket */
+};
+
+/* Menu bar geometry, laid out once per change to the menu */
+struct bar_item {
+	int x;          /* left edge, items are contiguous */
+	int ul_x, ul_w; /* mnemonic underline from the text start, or 0 */
+	char *label;    /* text with the '&' markers taken out */
+	int len;
+};
+
+struct menu_bar {
+	BOOL valid;
+	struct bar_item *items;
+	unsigned int nitem;
+	int width;       /* right edge of the last item */
+	int text_height;
+	int pressed;     /* item under a held button, or -1 */
+};
+
+struct menu_index {
+	struct w32x_menuitem **buckets;
+	unsigned int mask;
+	unsigned int count;
 };
 
 struct WndMenu {
 	int magic;
 	unsigned int nitem;
+	unsigned int size;
+	struct w32x_menuitem **items; /* by position */
 	HWND menuwnd;
 	HMENU parent;
-	TAILQ_HEAD(menulist, w32x_menuitem) item;
+	struct menu_index index; /* command IDs of the tree, root only */
+	struct menu_bar bar;
 };
 
+#define MENU_INDEX_MIN_SIZE 16
+#define MENU_BAR_PAD 6 /* space either side of a menu bar label */
+
 static LRESULT CALLBACK MenuWindowProc(HWND wnd, unsigned int msg,
     WPARAM wParam, LPARAM lParam);
 
@@ -53,22 +93,442 @@ WNDCLASS MenuClass = {
 	"#32768", (HBRUSH)(COLOR_MENUBAR + 1), MenuWindowProc, NULL, 0
 };
 
+/*
+ * Menu bar.
+ *
+ * The geometry of the bar (item edges, labels without their '&' markers
+ * and mnemonic underlines) is measured once and kept on the menu until
+ * the menu changes, so painting only replays it and a click is a binary
+ * search over the item edges. Paints only visit the items that intersect
+ * the paint rectangle.
+ */
+
+static void
+bar_free(struct menu_bar *bar)
+{
+	unsigned int i;
+
+	for (i = 0; i < bar->nitem; i++)
+		free(bar->items[i].label);
+	free(bar->items);
+	bar->items = NULL;
+	bar->nitem = 0;
+	bar->valid = FALSE;
+}
+
+/* Called whenever items are added, removed or relabelled */
+static void
+bar_invalidate(HMENU menu)
+{
+	menu->bar.valid = FALSE;
+	menu->bar.pressed = -1;
+}
+
+static BOOL
+bar_layout(HMENU menu, HDC hdc)
+{
+	struct menu_bar *bar = &menu->bar;
+	struct bar_item *bi;
+	const char *s;
+	TEXTMETRIC tm;
+	SIZE sz;
+	unsigned int i;
+	int x = 0, n, ul;
+
+	if (bar->valid)
+		return TRUE;
+
+	bar_free(bar);
+	bar->items = calloc(menu->nitem, sizeof(struct bar_item));
+	if (bar->items == NULL && menu->nitem > 0)
+		return FALSE;
+	bar->nitem = menu->nitem;
+
+	GetTextMetrics(hdc, &tm);
+	bar->text_height = tm.tmHeight;
+
+	for (i = 0; i < menu->nitem; i++) {
+		bi = &bar->items[i];
+		bi->x = x;
+		s = menu->items[i]->info.fType == MFT_STRING ?
+		    menu->items[i]->info.dwTypeData : "";
+		if ((bi->label = malloc(strlen(s) + 1)) == NULL) {
+			bar_free(bar);
+			return FALSE;
+		}
+
+		/* "&&" is a literal '&', any other '&' marks the mnemonic */
+		for (n = 0, ul = -1; *s != '\0'; s++) {
+			if (*s == '&' && s[1] != '\0') {
+				s++;
+				if (*s != '&' && ul == -1)
+					ul = n;
+			}
+			bi->label[n++] = *s;
+		}
+		bi->label[n] = '\0';
+		bi->len = n;
+
+		if (ul != -1) {
+			GetTextExtentPoint32(hdc, bi->label, ul, &sz);
+			bi->ul_x = sz.cx;
+			GetTextExtentPoint32(hdc, bi->label + ul, 1, &sz);
+			bi->ul_w = sz.cx;
+		}
+		GetTextExtentPoint32(hdc, bi->label, n, &sz);
+		x += sz.cx + MENU_BAR_PAD * 2;
+	}
+	bar->width = x;
+	bar->valid = TRUE;
+	return TRUE;
+}
+
+static int
+bar_item_right(const struct menu_bar *bar, int i)
+{
+	return (unsigned int)i + 1 < bar->nitem ? bar->items[i + 1].x :
+	    bar->width;
+}
+
+/* Index of the item at x, or -1 */
+static int
+bar_hit(const struct menu_bar *bar, int x)
+{
+	int lo = 0, hi = (int)bar->nitem - 1, mid;
+
+	if (bar->nitem == 0 || x < 0 || x >= bar->width)
+		return -1;
+
+	/* Last item starting at or before x */
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (bar->items[mid].x <= x)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+static void
+bar_invalidate_item(HWND wnd, const struct menu_bar *bar, int i)
+{
+	RECT rc;
+
+	if (i < 0 || (unsigned int)i >= bar->nitem)
+		return;
+	GetClientRect(wnd, &rc);
+	rc.left = bar->items[i].x;
+	rc.right = bar_item_right(bar, i);
+	InvalidateRect(wnd, &rc, TRUE);
+}
+
+static void
+bar_paint(HWND wnd, HMENU menu)
+{
+	struct menu_bar *bar = &menu->bar;
+	struct bar_item *bi;
+	PAINTSTRUCT ps;
+	COLORREF cr;
+	RECT rc, client;
+	HDC hdc;
+	int i, y;
+
+	hdc = BeginPaint(wnd, &ps);
+	SelectObject(hdc, GetStockObject(SYSTEM_FONT));
+	if (menu == NULL || !bar_layout(menu, hdc)) {
+		EndPaint(wnd, &ps);
+		return;
+	}
+
+	GetClientRect(wnd, &client);
+	y = (client.bottom - bar->text_height) / 2;
+
+	i = bar_hit(bar, ps.rcPaint.left);
+	for (; i >= 0 && (unsigned int)i < bar->nitem &&
+	    bar->items[i].x < ps.rcPaint.right; i++) {
+		bi = &bar->items[i];
+		if (i == bar->pressed) {
+			SetRect(&rc, bi->x, 0, bar_item_right(bar, i),
+			    client.bottom);
+			FillRect(hdc, &rc, (HBRUSH)(COLOR_MENUHILIGHT + 1));
+			cr = GetSysColor(COLOR_HIGHLIGHTTEXT);
+		} else if (menu->items[i]->info.fState & MF_GRAYED) {
+			cr = GetSysColor(COLOR_GRAYTEXT);
+		} else {
+			cr = GetSysColor(COLOR_MENUTEXT);
+		}
+
+		SetTextColor(hdc, cr);
+		TextOut(hdc, bi->x + MENU_BAR_PAD, y, bi->label, bi->len);
+		if (bi->ul_w > 0) {
+			SelectObject(hdc, GetStockObject(DC_BRUSH));
+			SetDCBrushColor(hdc, cr);
+			SetRect(&rc, bi->x + MENU_BAR_PAD + bi->ul_x,
+			    y + bar->text_height - 1,
+			    bi->x + MENU_BAR_PAD + bi->ul_x + bi->ul_w,
+			    y + bar->text_height);
+			FillRect(hdc, &rc, GetStockObject(DC_BRUSH));
+		}
+	}
+
+	EndPaint(wnd, &ps);
+}
+
+/* Pressing an item highlights it, releasing the button over the same
+ * item chooses it. The owner gets WM_INITMENU on the press, and
+ * WM_INITMENUPOPUP too if the item has a submenu. */
+static void
+bar_click(HWND wnd, HMENU menu, BOOL down, int x)
+{
+	struct menu_bar *bar = &menu->bar;
+	struct w32x_menuitem *item;
+	HMENU sub;
+	HDC hdc;
+	BOOL ok;
+	int i, pressed = bar->pressed;
+
+	hdc = GetDC(wnd);
+	SelectObject(hdc, GetStockObject(SYSTEM_FONT));
+	ok = bar_layout(menu, hdc);
+	ReleaseDC(wnd, hdc);
+	if (!ok)
+		return;
+
+	i = bar_hit(bar, x);
+	if (i >= 0 && (menu->items[i]->info.fState & MF_GRAYED))
+		i = -1;
+
+	if (down) {
+		bar->pressed = i;
+		if (i >= 0) {
+			SendMessage(GetParent(wnd), WM_INITMENU, (WPARAM)menu,
+			    0);
+			/* The owner may have changed the menu */
+			if ((unsigned int)i < menu->nitem &&
+			    (sub = menu->items[i]->info.hSubMenu) != NULL) {
+				SendMessage(GetParent(wnd), WM_INITMENUPOPUP,
+				    (WPARAM)sub, MAKELPARAM(i, FALSE));
+				fprintf(stderr, "XXX: Drop down menus not "
+				    "supported\n");
+			}
+		}
+	} else {
+		bar->pressed = -1;
+		if (i >= 0 && i == pressed) {
+			item = menu->items[i];
+			if (item->info.hSubMenu == NULL) {
+				SendMessage(GetParent(wnd), WM_COMMAND,
+				    MAKEWPARAM(item->info.wID, 0), 0);
+			}
+		}
+	}
+
+	if (pressed != bar->pressed) {
+		bar_invalidate_item(wnd, bar, pressed);
+		bar_invalidate_item(wnd, bar, bar->pressed);
+	}
+}
+
 static LRESULT CALLBACK
 MenuWindowProc(HWND wnd, unsigned int msg, WPARAM wParam, LPARAM lParam)
 {
+	HMENU menu = GetMenu(GetParent(wnd));
+
 	switch (msg) {
 	case WM_PAINT:
-		printf("Need to paint menubar\n");
-		break;
-	case WM_SIZE:
-		printf("need to size\n");
-		break;
+		bar_paint(wnd, IsMenu(menu) ? menu : NULL);
+		return 0;
+	case WM_LBUTTONDOWN:
+	case WM_LBUTTONUP:
+		if (IsMenu(menu)) {
+			bar_click(wnd, menu, msg == WM_LBUTTONDOWN,
+			    (short)LOWORD(lParam));
+		}
+		return 0;
 	default:
 		break;
 	}
 	return DefWindowProc(wnd, msg, wParam, lParam);
 }
 
+static unsigned int
+index_hash(UINT id)
+{
+	return (unsigned int)((id * 0x9e3779b9u) >> 8);
+}
+
+static BOOL
+index_resize(struct menu_index *idx, unsigned int size)
+{
+	struct w32x_menuitem **buckets, *item, *next;
+	unsigned int i, b;
+
+	buckets = calloc(size, sizeof(struct w32x_menuitem *));
+	if (buckets == NULL)
+		return FALSE;
+
+	for (i = 0; idx->buckets != NULL && i <= idx->mask; i++) {
+		for (item = idx->buckets[i]; item != NULL; item = next) {
+			next = item->id_next;
+			b = index_hash(item->info.wID) & (size - 1);
+			item->id_next = buckets[b];
+			buckets[b] = item;
+		}
+	}
+	free(idx->buckets);
+	idx->buckets = buckets;
+	idx->mask = size - 1;
+	return TRUE;
+}
+
+static BOOL
+index_add(struct menu_index *idx, struct w32x_menuitem *item)
+{
+	unsigned int b;
+
+	if (idx->buckets == NULL || idx->count > idx->mask) {
+		if (!index_resize(idx, idx->buckets == NULL ?
+		    MENU_INDEX_MIN_SIZE : (idx->mask + 1) * 2))
+			return FALSE;
+	}
+
+	b = index_hash(item->info.wID) & idx->mask;
+	item->id_next = idx->buckets[b];
+	idx->buckets[b] = item;
+	idx->count++;
+	return TRUE;
+}
+
+static void
+index_remove(struct menu_index *idx, struct w32x_menuitem *item)
+{
+	struct w32x_menuitem **pp;
+
+	pp = &idx->buckets[index_hash(item->info.wID) & idx->mask];
+	while (*pp != item)
+		pp = &(*pp)->id_next;
+	*pp = item->id_next;
+	idx->count--;
+}
+
+static HMENU
+menu_root(HMENU menu)
+{
+	while (menu->parent != NULL)
+		menu = menu->parent;
+	return menu;
+}
+
+/* Is menu the same as or a submenu of ancestor? */
+static BOOL
+menu_within(HMENU menu, HMENU ancestor)
+{
+	for (; menu != NULL; menu = menu->parent) {
+		if (menu == ancestor)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* An item by position in menu, or by command anywhere below it */
+static struct w32x_menuitem *
+menu_find_item(HMENU menu, UINT pos, BOOL bypos)
+{
+	struct menu_index *idx;
+	struct w32x_menuitem *item;
+
+	if (bypos)
+		return pos < menu->nitem ? menu->items[pos] : NULL;
+
+	idx = &menu_root(menu)->index;
+	if (idx->buckets == NULL)
+		return NULL;
+	for (item = idx->buckets[index_hash(pos) & idx->mask]; item != NULL;
+	    item = item->id_next) {
+		if (item->info.wID == pos && menu_within(item->menu, menu))
+			return item;
+	}
+	return NULL;
+}
+
+/* Make room in menu's position array for an item at pos */
+static BOOL
+menu_insert_at(HMENU menu, unsigned int pos, struct w32x_menuitem *item)
+{
+	struct w32x_menuitem **items;
+	unsigned int size;
+
+	if (menu->nitem == menu->size) {
+		size = menu->size == 0 ? 8 : menu->size * 2;
+		items = realloc(menu->items, size * sizeof(*items));
+		if (items == NULL)
+			return FALSE;
+		menu->items = items;
+		menu->size = size;
+	}
+	if (pos > menu->nitem)
+		pos = menu->nitem;
+	memmove(&menu->items[pos + 1], &menu->items[pos],
+	    (menu->nitem - pos) * sizeof(*menu->items));
+	menu->items[pos] = item;
+	menu->nitem++;
+	item->menu = menu;
+	return TRUE;
+}
+
+/* Hang submenu off item, moving its command IDs into the tree's index */
+static void
+menu_attach(HMENU menu, HMENU submenu)
+{
+	struct menu_index *from = &submenu->index, *to;
+	struct w32x_menuitem *item, *next;
+	unsigned int i;
+
+	submenu->parent = menu;
+	to = &menu_root(menu)->index;
+	for (i = 0; from->buckets != NULL && i <= from->mask; i++) {
+		for (item = from->buckets[i]; item != NULL; item = next) {
+			next = item->id_next;
+			if (!index_add(to, item))
+				printf("%s: out of memory\n", __func__);
+		}
+	}
+	free(from->buckets);
+	memset(from, 0, sizeof(*from));
+}
+
+static void
+menu_free_item(struct w32x_menuitem *item)
+{
+	if (item->info.fType == MFT_STRING)
+		free(item->info.dwTypeData);
+	free(item);
+}
+
+/* Free a menu and everything below it. Its items are dropped from idx,
+ * unless idx is the menu's own index which goes away with it. */
+static void
+menu_destroy(HMENU menu, struct menu_index *idx)
+{
+	struct w32x_menuitem *item;
+	unsigned int i;
+
+	for (i = 0; i < menu->nitem; i++) {
+		item = menu->items[i];
+		if (item->info.hSubMenu != NULL && IsMenu(item->info.hSubMenu))
+			menu_destroy(item->info.hSubMenu, idx);
+		if (idx != &menu->index)
+			index_remove(idx, item);
+		menu_free_item(item);
+	}
+	free(menu->items);
+	free(menu->index.buckets);
+	bar_free(&menu->bar);
+	menu->magic = 0;
+	free(menu);
+}
+
 BOOL
 IsMenu(HMENU menu)
 {
@@ -84,10 +544,14 @@ CreateMenu(void)
 	struct WndMenu *menu;
 
 	menu = calloc(1, sizeof(struct WndMenu));
+	if (menu == NULL) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return NULL;
+	}
 	menu->magic = MENU_MAGIC;
 	menu->nitem = 0;
 	menu->parent = NULL;
-	TAILQ_INIT(&menu->item);
+	menu->bar.pressed = -1;
 
 	return menu;
 }
@@ -98,32 +562,37 @@ CreatePopupMenu(void)
 	return CreateMenu();
 }
 
+/*
+ * Free a menu and all of its submenus. A submenu still attached to
+ * another menu is detached from it first.
+ */
 BOOL
-AppendMenu(HMENU menu, UINT flags, UINT_PTR id, LPCSTR title)
+DestroyMenu(HMENU menu)
 {
-	return InsertMenu(menu, 0xffffffff, flags | MF_BYPOSITION, id, title);
-}
+	HMENU parent;
+	unsigned int i;
 
-static BOOL
-menu_insert_item(HMENU menu, UINT id, struct w32x_menuitem *item)
-{
-	struct w32x_menuitem *after;
-	HMENU submenu;
+	if (!IsMenu(menu)) {
+		SetLastError(ERROR_INVALID_MENU_HANDLE);
+		return FALSE;
+	}
 
-	TAILQ_FOREACH(after, &menu->item, list) {
-		if (after->info.wID == id) {
-			TAILQ_INSERT_BEFORE(after, item, list);
-			menu->nitem++;
-			return TRUE;
-		}
-		if (after->info.hSubMenu != NULL) {
-			submenu = after->info.hSubMenu;
-			if (menu_insert_item(submenu, id, item))
-				return TRUE;
+	if ((parent = menu->parent) != NULL) {
+		for (i = 0; i < parent->nitem; i++) {
+			if (parent->items[i]->info.hSubMenu == menu)
+				parent->items[i]->info.hSubMenu = NULL;
 		}
+		menu_destroy(menu, &menu_root(menu)->index);
+	} else {
+		menu_destroy(menu, &menu->index);
 	}
+	return TRUE;
+}
 
-	return FALSE;
+BOOL
+AppendMenu(HMENU menu, UINT flags, UINT_PTR id, LPCSTR title)
+{
+	return InsertMenu(menu, 0xffffffff, flags | MF_BYPOSITION, id, title);
 }
 
 static void
@@ -160,45 +629,53 @@ copy_menuiteminfo(MENUITEMINFO *dinfo, DWORD mask, LPCMENUITEMINFO sinfo)
 		dinfo->fMask |= MIIM_FTYPE | MIIM_STRING;
 }
 
-BOOL
-InsertMenu(HMENU menu, UINT pos, UINT flags, UINT_PTR id, LPCSTR ptr)
+/* The MENUITEMINFO InsertMenu and ModifyMenu flags describe */
+static void
+menu_flags_to_info(MENUITEMINFO *info, UINT flags, UINT_PTR id, LPCSTR ptr)
 {
-	MENUITEMINFO info;
-
-	if (!IsMenu(menu)) {
-		return FALSE;
-	}
-	memset(&info, 0, sizeof(info));
-	info.cbSize = sizeof(info);
-	info.fMask = MIIM_STATE | MIIM_ID | MIIM_TYPE;
-	info.fState = MFS_ENABLED;
+	memset(info, 0, sizeof(*info));
+	info->cbSize = sizeof(*info);
+	info->fMask = MIIM_STATE | MIIM_ID | MIIM_TYPE;
+	info->fState = MFS_ENABLED;
 	if (flags & MF_POPUP) {
-		info.hSubMenu = (HMENU)id;
-		info.fMask |= MIIM_SUBMENU;
+		info->hSubMenu = (HMENU)id;
+		info->fMask |= MIIM_SUBMENU;
 	} else {
-		info.hSubMenu = NULL;
+		info->hSubMenu = NULL;
 	}
 	if (flags & MF_CHECKED) {
-		info.fState = MFS_CHECKED;
+		info->fState = MFS_CHECKED;
 	}
-	info.wID = id;
-	info.dwTypeData = (LPSTR)ptr;
+	info->fState |= flags & (MF_GRAYED | MF_DISABLED);
+	info->wID = id;
+	info->dwTypeData = (LPSTR)ptr;
 	if (flags & MF_BITMAP) {
-		info.fType = MFT_BITMAP;
+		info->fType = MFT_BITMAP;
 	} else if (flags & MF_OWNERDRAW) {
-		info.fType = MFT_OWNERDRAW;
+		info->fType = MFT_OWNERDRAW;
 	} else if (flags & MF_SEPARATOR) {
-		info.fType = MFT_SEPARATOR;
+		info->fType = MFT_SEPARATOR;
 	} else {
 		/* Default: MF_STRING */
-		info.fType = MFT_STRING;
+		info->fType = MFT_STRING;
 		if (ptr != NULL) {
-			info.cch = strlen(ptr);
+			info->cch = strlen(ptr);
 		} else {
-			info.cch = 0;
-			info.dwTypeData = "";
+			info->cch = 0;
+			info->dwTypeData = "";
 		}
 	}
+}
+
+BOOL
+InsertMenu(HMENU menu, UINT pos, UINT flags, UINT_PTR id, LPCSTR ptr)
+{
+	MENUITEMINFO info;
+
+	if (!IsMenu(menu)) {
+		return FALSE;
+	}
+	menu_flags_to_info(&info, flags, id, ptr);
 	return InsertMenuItem(menu, pos, (flags & MF_BYPOSITION) ? TRUE : FALSE,
 			&info);
 }
@@ -206,49 +683,196 @@ InsertMenu(HMENU menu, UINT pos, UINT flags, UINT_PTR id, LPCSTR ptr)
 BOOL
 InsertMenuItem(HMENU menu, UINT pos, BOOL bypos, LPCMENUITEMINFO info)
 {
-	struct w32x_menuitem *item, *after;
+	struct w32x_menuitem *item, *before;
+	HMENU target = menu;
 
 	if (!IsMenu(menu)) {
 		return FALSE;
 	}
 
-	item = malloc(sizeof(struct w32x_menuitem));
-	memset(item, 0, sizeof(struct w32x_menuitem));
-	item->info.cbSize = sizeof(item->info);
-	copy_menuiteminfo(&item->info, info->fMask, info);
-	if (info->fType == MFT_STRING) {
-		item->info.dwTypeData = strdup(info->dwTypeData);
-	}
-
-	if (bypos != FALSE) {
-		unsigned int i;
+	if (bypos == FALSE) {
 		/*
-		 * pos == position (nth item)
+		 * pos == item ID, insert in front of it in whichever menu
+		 * of the tree holds it
 		 */
-		after = TAILQ_FIRST(&menu->item);
-		for (i = 0; after != NULL && i < pos; i++) {
-			after = TAILQ_NEXT(after, list);
-		}
-		if (after != NULL) {
-			TAILQ_INSERT_BEFORE(after, item, list);
-		} else {
-			TAILQ_INSERT_TAIL(&menu->item, item, list);
-		}
-		menu->nitem++;
-	} else {
-		/*
-		 * pos == item ID
-		 */
-		if (!menu_insert_item(menu, pos, item)) {
+		before = menu_find_item(menu, pos, FALSE);
+		if (before == NULL) {
 			printf("%s: No specified ID %u in HMENU %p\n", __func__,
 			    pos, menu);
-			free(item);
+			SetLastError(ERROR_MENU_ITEM_NOT_FOUND);
 			return FALSE;
 		}
+		target = before->menu;
+		for (pos = 0; target->items[pos] != before; pos++)
+			;
+	} else if (pos > menu->nitem) {
+		/*
+		 * pos == position (nth item), past the end appends
+		 */
+		pos = menu->nitem;
+	}
+
+	item = calloc(1, sizeof(struct w32x_menuitem));
+	if (item == NULL) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	item->info.cbSize = sizeof(item->info);
+	copy_menuiteminfo(&item->info, info->fMask, info);
+	if (item->info.fType == MFT_STRING) {
+		item->info.dwTypeData = strdup(info->dwTypeData != NULL ?
+		    info->dwTypeData : "");
+	}
+
+	if (!index_add(&menu_root(target)->index, item)) {
+		menu_free_item(item);
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	if (!menu_insert_at(target, pos, item)) {
+		index_remove(&menu_root(target)->index, item);
+		menu_free_item(item);
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+
+	if (IsMenu(item->info.hSubMenu))
+		menu_attach(target, item->info.hSubMenu);
+	bar_invalidate(target);
+	return TRUE;
+}
+
+/*
+ * Replace an item with the one flags describes. As on Win32, a submenu
+ * the item no longer opens is destroyed.
+ */
+BOOL
+ModifyMenu(HMENU menu, UINT pos, UINT flags, UINT_PTR id, LPCSTR ptr)
+{
+	struct w32x_menuitem *item;
+	struct menu_index *idx;
+	MENUITEMINFO info;
+	HMENU old;
+
+	if (!IsMenu(menu)) {
+		SetLastError(ERROR_INVALID_MENU_HANDLE);
+		return FALSE;
+	}
+	if ((item = menu_find_item(menu, pos, flags & MF_BYPOSITION)) == NULL) {
+		SetLastError(ERROR_MENU_ITEM_NOT_FOUND);
+		return FALSE;
 	}
-	if (item->info.hSubMenu != NULL) {
-		HMENU psm = item->info.hSubMenu;
-		psm->parent = menu;
+
+	menu_flags_to_info(&info, flags, id, ptr);
+	idx = &menu_root(menu)->index;
+
+	old = item->info.hSubMenu;
+	if (old != info.hSubMenu && IsMenu(old) && old->parent == item->menu) {
+		item->info.hSubMenu = NULL;
+		menu_destroy(old, idx);
+	}
+
+	/* Re-file the item if its command changes; the index has just
+	 * shrunk by one so adding it back cannot fail */
+	if (item->info.wID != info.wID) {
+		index_remove(idx, item);
+		item->info.wID = info.wID;
+		index_add(idx, item);
 	}
+
+	if (item->info.fType == MFT_STRING)
+		free(item->info.dwTypeData);
+	item->info.fType = info.fType;
+	item->info.fState = info.fState;
+	item->info.hSubMenu = info.hSubMenu;
+	item->info.cch = info.cch;
+	item->info.dwTypeData = info.fType == MFT_STRING ?
+	    strdup(info.dwTypeData) : info.dwTypeData;
+
+	if (IsMenu(info.hSubMenu) && info.hSubMenu->parent != item->menu)
+		menu_attach(item->menu, info.hSubMenu);
+	bar_invalidate(item->menu);
 	return TRUE;
 }
+
+BOOL
+GetMenuItemInfo(HMENU menu, UINT pos, BOOL bypos, LPMENUITEMINFO info)
+{
+	struct w32x_menuitem *item;
+	size_t len;
+
+	if (!IsMenu(menu) || info == NULL) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	if ((item = menu_find_item(menu, pos, bypos)) == NULL) {
+		SetLastError(ERROR_MENU_ITEM_NOT_FOUND);
+		return FALSE;
+	}
+
+	if (info->fMask & MIIM_STATE)
+		info->fState = item->info.fState;
+	if (info->fMask & MIIM_ID)
+		info->wID = item->info.wID;
+	if (info->fMask & MIIM_SUBMENU)
+		info->hSubMenu = item->info.hSubMenu;
+	if (info->fMask & MIIM_CHECKMARKS) {
+		info->hbmpChecked = item->info.hbmpChecked;
+		info->hbmpUnchecked = item->info.hbmpUnchecked;
+	}
+	if (info->fMask & MIIM_DATA)
+		info->dwItemData = item->info.dwItemData;
+	if (info->fMask & (MIIM_TYPE | MIIM_FTYPE))
+		info->fType = item->info.fType;
+
+	/* Strings are copied into the caller's buffer of cch characters,
+	 * cch comes back as the length of the item's text */
+	if ((info->fMask & (MIIM_TYPE | MIIM_STRING)) &&
+	    item->info.fType == MFT_STRING) {
+		len = strlen(item->info.dwTypeData);
+		if (info->dwTypeData != NULL && info->cch > 0) {
+			if (len > info->cch - 1)
+				len = info->cch - 1;
+			memcpy(info->dwTypeData, item->info.dwTypeData, len);
+			info->dwTypeData[len] = '\0';
+		}
+		info->cch = strlen(item->info.dwTypeData);
+	}
+	return TRUE;
+}
+
+/* Returns the previous MF_CHECKED/MF_UNCHECKED state or -1 */
+DWORD
+CheckMenuItem(HMENU menu, UINT id, UINT check)
+{
+	struct w32x_menuitem *item;
+	DWORD prev;
+
+	if (!IsMenu(menu) ||
+	    (item = menu_find_item(menu, id, check & MF_BYPOSITION)) == NULL)
+		return (DWORD)-1;
+
+	prev = (item->info.fState & MFS_CHECKED) ? MF_CHECKED : MF_UNCHECKED;
+	if (check & MF_CHECKED)
+		item->info.fState |= MFS_CHECKED;
+	else
+		item->info.fState &= ~MFS_CHECKED;
+	return prev;
+}
+
+/* Returns the previous MF_ENABLED/MF_GRAYED/MF_DISABLED state or -1 */
+BOOL
+EnableMenuItem(HMENU menu, UINT id, UINT enable)
+{
+	struct w32x_menuitem *item;
+	BOOL prev;
+
+	if (!IsMenu(menu) ||
+	    (item = menu_find_item(menu, id, enable & MF_BYPOSITION)) == NULL)
+		return -1;
+
+	prev = item->info.fState & (MF_GRAYED | MF_DISABLED);
+	item->info.fState &= ~(MF_GRAYED | MF_DISABLED);
+	item->info.fState |= enable & (MF_GRAYED | MF_DISABLED);
+	return prev;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2018 Devin Smith <devin@devinsmith.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef HAVE_XFT_H
+#include <X11/Xft/Xft.h>
+#endif
+
+#include <windows.h>
+#include "w32x_priv.h"
+
+/*
+ * Mouse input.
+ *
+ * Pointer motion reaches the application as WM_MOUSEMOVE, which is
+ * coalesced so a slow window procedure only ever sees the latest
+ * position. Every sample the server sent is still recorded here, before
+ * compression, so drawing programs can get the full path back with
+ * GetMouseMovePointsEx.
+ */
+
+#define MOTION_HISTORY 64 /* samples kept, as on Win32 */
+
+static MOUSEMOVEPOINT history[MOTION_HISTORY];
+static unsigned int history_next; /* total samples ever recorded */
+
+/* Called for each MotionNotify as it is read from the server */
+void
+w32x_mouse_record(const XMotionEvent *e)
+{
+	MOUSEMOVEPOINT *p;
+
+	w32x_lock();
+	p = &history[history_next++ % MOTION_HISTORY];
+	p->x = e->x_root;
+	p->y = e->y_root;
+	p->time = e->time;
+	p->dwExtraInfo = 0;
+	w32x_unlock();
+}
+
+/* MK_* flags for an X key and button state mask */
+WPARAM
+w32x_mouse_keys(unsigned int state)
+{
+	WPARAM keys = 0;
+
+	if (state & Button1Mask)
+		keys |= MK_LBUTTON;
+	if (state & Button2Mask)
+		keys |= MK_MBUTTON;
+	if (state & Button3Mask)
+		keys |= MK_RBUTTON;
+	if (state & ShiftMask)
+		keys |= MK_SHIFT;
+	if (state & ControlMask)
+		keys |= MK_CONTROL;
+	return keys;
+}
+
+/*
+ * Copy up to nBufPoints samples, newest first, starting at the most
+ * recent sample matching lppt (and its time, if not zero). Coordinates
+ * are in screen pixels. Returns the number of points copied or -1.
+ */
+int
+GetMouseMovePointsEx(UINT cbSize, LPMOUSEMOVEPOINT lppt,
+    LPMOUSEMOVEPOINT lpptBuf, int nBufPoints, DWORD resolution)
+{
+	unsigned int avail, i, start;
+	int n;
+
+	if (cbSize != sizeof(MOUSEMOVEPOINT) || lppt == NULL ||
+	    nBufPoints < 0 || nBufPoints > MOTION_HISTORY ||
+	    (lpptBuf == NULL && nBufPoints > 0) ||
+	    resolution != GMMP_USE_DISPLAY_POINTS) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return -1;
+	}
+
+	/* The history is shared by all threads, as the pointer is */
+	w32x_lock();
+	avail = history_next < MOTION_HISTORY ? history_next : MOTION_HISTORY;
+	for (i = 0; i < avail; i++) {
+		const MOUSEMOVEPOINT *p =
+		    &history[(history_next - 1 - i) % MOTION_HISTORY];
+
+		if (p->x == lppt->x && p->y == lppt->y &&
+		    (lppt->time == 0 || p->time == lppt->time))
+			break;
+	}
+	if (i == avail) {
+		w32x_unlock();
+		SetLastError(ERROR_POINT_NOT_FOUND);
+		return -1;
+	}
+
+	start = i;
+	for (n = 0; n < nBufPoints && start + n < avail; n++) {
+		lpptBuf[n] = history[(history_next - 1 - start - n) %
+		    MOTION_HISTORY];
+	}
+	w32x_unlock();
+	return n;
+}
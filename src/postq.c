@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) 2018 Devin Smith <devin@devinsmith.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef HAVE_XFT_H
+#include <X11/Xft/Xft.h>
+#endif
+
+#include <windows.h>
+#include "w32x_priv.h"
+
+/*
+ * Messages posted and sent from other threads.
+ *
+ * The message ring in w32x.c belongs to the thread owning the queue.
+ * Other threads post into this bounded lock-free queue instead (Vyukov's
+ * array queue: each cell carries a sequence number telling producers and
+ * the consumer whose turn it is), which the owner moves into the ring
+ * whenever it looks for messages. Posting takes no lock and makes no
+ * X request.
+ *
+ * A sleeping thread is woken through an eventfd in its epoll set. Only
+ * the first post after it last woke up writes to it; the wake_pending
+ * flag tells later producers a wakeup is already on its way.
+ *
+ * Messages sent from other threads are pushed onto a separate lock-free
+ * stack, as they are handled before anything posted. A sender without a
+ * queue of its own sleeps on a futex in the node until the result has
+ * been stored. One with a queue is woken through its eventfd instead, so
+ * it can handle messages sent to it in the meantime, as two threads
+ * sending to each other would otherwise deadlock.
+ *
+ * Other threads may still hold a pointer to the queue when its owner
+ * exits. They count themselves in users while they touch the cells or
+ * the eventfd, and the owner sets POSTQ_CLOSED and waits for the count
+ * to drop to zero before freeing either. Later producers see the flag
+ * and give up, so a message sent to a thread that has gone returns 0
+ * instead of waiting for ever.
+ */
+
+#define POSTQ_SIZE 8192 /* power of two */
+#define POSTQ_CLOSED 0x80000000u
+
+struct postq_cell {
+	atomic_uint seq;
+	MSG msg;
+};
+
+/* Set up the queue, returns the eventfd to wait on or -1 */
+int
+w32x_postq_init(struct w32x_postq *q)
+{
+	unsigned int i;
+
+	q->cells = malloc(POSTQ_SIZE * sizeof(*q->cells));
+	if (q->cells == NULL)
+		return -1;
+	for (i = 0; i < POSTQ_SIZE; i++)
+		atomic_init(&q->cells[i].seq, i);
+	atomic_init(&q->enqueue_pos, 0);
+	q->dequeue_pos = 0;
+	atomic_init(&q->wake_pending, 0);
+	atomic_init(&q->sent_head, NULL);
+	atomic_init(&q->users, 0);
+
+	q->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (q->wake_fd == -1) {
+		free(q->cells);
+		q->cells = NULL;
+	}
+	return q->wake_fd;
+}
+
+/* Hold off the teardown of the queue while we use it, FALSE once closed */
+static BOOL
+postq_enter(struct w32x_postq *q)
+{
+	if (atomic_fetch_add(&q->users, 1) & POSTQ_CLOSED) {
+		atomic_fetch_sub(&q->users, 1);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+postq_leave(struct w32x_postq *q)
+{
+	atomic_fetch_sub(&q->users, 1);
+}
+
+/* Whether the owner of the queue has exited */
+BOOL
+w32x_postq_closed(struct w32x_postq *q)
+{
+	return (atomic_load(&q->users) & POSTQ_CLOSED) != 0;
+}
+
+/* Wake the owner of the queue if it is not already being woken */
+void
+w32x_postq_wake(struct w32x_postq *q)
+{
+	uint64_t one = 1;
+
+	if (!postq_enter(q))
+		return;
+	if (!atomic_exchange(&q->wake_pending, 1)) {
+		while (write(q->wake_fd, &one, sizeof(one)) == -1 &&
+		    errno == EINTR)
+			;
+	}
+	postq_leave(q);
+}
+
+/* Queue a message for the owner. FALSE when the queue is full or closed. */
+BOOL
+w32x_postq_push(struct w32x_postq *q, HWND hwnd, UINT message,
+    WPARAM wParam, LPARAM lParam)
+{
+	struct postq_cell *cell;
+	unsigned int pos, seq;
+	int diff;
+
+	if (!postq_enter(q))
+		return FALSE;
+	pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+	for (;;) {
+		cell = &q->cells[pos & (POSTQ_SIZE - 1)];
+		seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+		diff = (int)(seq - pos);
+		if (diff == 0) {
+			/* The cell is free, claim it */
+			if (atomic_compare_exchange_weak_explicit(
+			    &q->enqueue_pos, &pos, pos + 1,
+			    memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			/* The owner has not caught up a lap behind */
+			postq_leave(q);
+			return FALSE;
+		} else {
+			pos = atomic_load_explicit(&q->enqueue_pos,
+			    memory_order_relaxed);
+		}
+	}
+
+	cell->msg.hwnd = hwnd;
+	cell->msg.message = message;
+	cell->msg.wParam = wParam;
+	cell->msg.lParam = lParam;
+	atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+	w32x_postq_wake(q);
+	postq_leave(q);
+	return TRUE;
+}
+
+/* Take the oldest message off the queue, owner only. */
+BOOL
+w32x_postq_pop(struct w32x_postq *q, LPMSG msg)
+{
+	struct postq_cell *cell;
+
+	cell = &q->cells[q->dequeue_pos & (POSTQ_SIZE - 1)];
+	if (atomic_load_explicit(&cell->seq, memory_order_acquire) !=
+	    q->dequeue_pos + 1)
+		return FALSE;
+
+	*msg = cell->msg;
+	/* Hand the cell to the producers of the next lap */
+	atomic_store_explicit(&cell->seq, q->dequeue_pos + POSTQ_SIZE,
+	    memory_order_release);
+	q->dequeue_pos++;
+	return TRUE;
+}
+
+/*
+ * The eventfd fired. Re-arm the wakeup before the queue is drained, so a
+ * message posted after the drain wakes the owner again.
+ */
+void
+w32x_postq_ack(struct w32x_postq *q)
+{
+	uint64_t count;
+
+	while (read(q->wake_fd, &count, sizeof(count)) == -1 &&
+	    errno == EINTR)
+		;
+	atomic_store(&q->wake_pending, 0);
+}
+
+/* Hand a sent message to the owner of the queue. */
+void
+w32x_sent_push(struct w32x_postq *q, struct w32x_sent *node)
+{
+	struct w32x_sent *head;
+
+	atomic_init(&node->done, 0);
+	if (!postq_enter(q)) {
+		/* The owner has gone and its windows with it */
+		w32x_sent_complete(node, 0);
+		return;
+	}
+	head = atomic_load_explicit(&q->sent_head, memory_order_relaxed);
+	do {
+		node->next = head;
+	} while (!atomic_compare_exchange_weak_explicit(&q->sent_head, &head,
+	    node, memory_order_release, memory_order_relaxed));
+	w32x_postq_wake(q);
+	postq_leave(q);
+}
+
+BOOL
+w32x_sent_pending(struct w32x_postq *q)
+{
+	return atomic_load_explicit(&q->sent_head,
+	    memory_order_relaxed) != NULL;
+}
+
+/* Take every sent message, oldest first. Owner only. */
+struct w32x_sent *
+w32x_sent_take(struct w32x_postq *q)
+{
+	struct w32x_sent *node, *next, *list = NULL;
+
+	if (!w32x_sent_pending(q))
+		return NULL;
+	node = atomic_exchange_explicit(&q->sent_head, NULL,
+	    memory_order_acquire);
+	/* The stack has the newest on top */
+	for (; node != NULL; node = next) {
+		next = node->next;
+		node->next = list;
+		list = node;
+	}
+	return list;
+}
+
+/* Drop a reference to a heap node, freeing it with the last one */
+static void
+sent_unref(struct w32x_sent *node)
+{
+	if (atomic_fetch_sub(&node->refs, 1) == 1)
+		free(node);
+}
+
+/*
+ * Store the result of a sent message and wake its sender. Once done is
+ * set a blocking sender may return and its stack node go away, so only
+ * the futex wake touches the address after that.
+ */
+void
+w32x_sent_complete(struct w32x_sent *node, LRESULT result)
+{
+	struct w32x_postq *reply_to = node->reply_to;
+	BOOL heap = node->heap;
+
+	node->result = result;
+	atomic_store_explicit(&node->done, 1, memory_order_release);
+	if (reply_to != NULL)
+		w32x_postq_wake(reply_to);
+	else
+		syscall(SYS_futex, &node->done, FUTEX_WAKE_PRIVATE, 1, NULL,
+		    NULL, 0);
+	if (heap)
+		sent_unref(node);
+}
+
+/*
+ * Tear down the queue of a thread that is exiting. Once no other thread
+ * is using it, sent messages still waiting complete with 0 and the cells
+ * and eventfd are freed. The struct itself stays, as windows and sent
+ * messages of other threads may still point at it.
+ */
+void
+w32x_postq_close(struct w32x_postq *q)
+{
+	struct w32x_sent *node, *next;
+
+	atomic_fetch_or(&q->users, POSTQ_CLOSED);
+	while ((atomic_load(&q->users) & ~POSTQ_CLOSED) != 0)
+		sched_yield();
+
+	for (node = w32x_sent_take(q); node != NULL; node = next) {
+		next = node->next;
+		w32x_sent_complete(node, 0);
+	}
+	close(q->wake_fd);
+	q->wake_fd = -1;
+	free(q->cells);
+	q->cells = NULL;
+}
+
+/* Milliseconds left until deadline, 0 once it has passed */
+static int
+ms_left(const struct timespec *deadline)
+{
+	struct timespec now;
+	long ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (deadline->tv_sec - now.tv_sec) * 1000 +
+	    (deadline->tv_nsec - now.tv_nsec + 999999) / 1000000;
+	return ms > 0 ? (int)ms : 0;
+}
+
+/*
+ * Wait until the owner has handled node, for at most timeout ms (-1 for
+ * no limit), and fetch the result. The sender's own queue, if it has one,
+ * keeps handling sent messages meanwhile. Returns FALSE on timeout; a heap
+ * node is released either way.
+ */
+BOOL
+w32x_sent_wait(struct w32x_sent *node, int timeout, LRESULT *result)
+{
+	struct w32x_postq *q = node->reply_to;
+	struct timespec deadline, rel;
+	struct pollfd pfd;
+	BOOL done;
+	int left = -1;
+
+	if (timeout >= 0) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout / 1000;
+		deadline.tv_nsec += (timeout % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+
+	while (!(done = atomic_load_explicit(&node->done,
+	    memory_order_acquire))) {
+		if (timeout >= 0 && (left = ms_left(&deadline)) == 0)
+			break;
+		if (q != NULL) {
+			/* Messages sent to us first, the reply wakes the
+			 * eventfd like they do */
+			pfd.fd = q->wake_fd;
+			pfd.events = POLLIN;
+			w32x_dispatch_sent();
+			if (atomic_load_explicit(&node->done,
+			    memory_order_acquire))
+				continue;
+			if (poll(&pfd, 1, left) > 0)
+				w32x_postq_ack(q);
+		} else if (timeout < 0) {
+			syscall(SYS_futex, &node->done, FUTEX_WAIT_PRIVATE, 0,
+			    NULL, NULL, 0);
+		} else {
+			rel.tv_sec = left / 1000;
+			rel.tv_nsec = (left % 1000) * 1000000L;
+			syscall(SYS_futex, &node->done, FUTEX_WAIT_PRIVATE, 0,
+			    &rel, NULL, 0);
+		}
+	}
+
+	if (done)
+		*result = node->result;
+	if (node->heap)
+		sent_unref(node);
+	return done;
+}
@@ -0,0 +1,593 @@
+/*
+ * Copyright (c) 2018 Devin Smith <devin@devinsmith.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef HAVE_XFT_H
+#include <X11/Xft/Xft.h>
+#endif
+
+#include <windows.h>
+#include "w32x_priv.h"
+
+/*
+ * Regions.
+ *
+ * A region is kept as a list of rectangles in y-x banded form, the same
+ * representation the X server uses: rectangles are sorted by top, then
+ * left; rectangles in the same band share their top and bottom; bands do
+ * not overlap; spans within a band neither overlap nor touch; and
+ * vertically adjacent bands with identical spans are merged. The form is
+ * canonical, so a region with one rectangle is SIMPLEREGION and the
+ * complexity and bounding box are kept up to date instead of computed on
+ * demand.
+ *
+ * The first few rectangles live inside the region itself. Larger regions
+ * move to a heap array that is kept, and reused, for the life of the
+ * region. Operations sweep both inputs band by band into a shared scratch
+ * list which is then copied over the destination, so the destination may
+ * be either source and steady state operations do not allocate.
+ */
+
+extern Display *disp;
+
+#define REGION_KEEP_RECTS 256 /* largest array kept on a deleted region */
+
+/* Output of the region operations, see region_sweep */
+static __thread RECT *scratch;
+static __thread int scratch_size;
+static __thread int scratch_count;
+static __thread int prev_band; /* index of the band before the one being built */
+
+static __thread XRectangle *xrects;
+static __thread int xrects_size;
+
+static RECT *
+region_rects(const struct w32x_region *r)
+{
+	return r->heap != NULL ? r->heap : (RECT *)r->inline_rects;
+}
+
+static BOOL
+region_reserve(struct w32x_region *r, int n)
+{
+	RECT *heap;
+	int size;
+
+	if ((r->heap == NULL && n <= REGION_INLINE_RECTS) ||
+	    (r->heap != NULL && n <= r->size))
+		return TRUE;
+
+	size = MAX(n, MAX(r->size * 2, 16));
+	heap = realloc(r->heap, size * sizeof(RECT));
+	if (heap == NULL) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	if (r->heap == NULL)
+		memcpy(heap, r->inline_rects, r->nrects * sizeof(RECT));
+	r->heap = heap;
+	r->size = size;
+	return TRUE;
+}
+
+static void
+region_set_empty(struct w32x_region *r)
+{
+	r->nrects = 0;
+	SetRectEmpty(&r->extents);
+	r->complexity = NULLREGION;
+}
+
+void
+w32x_region_set_rect(struct w32x_region *r, int left, int top, int right,
+    int bottom)
+{
+	RECT *rc;
+
+	if (left > right) {
+		int t = left;
+		left = right;
+		right = t;
+	}
+	if (top > bottom) {
+		int t = top;
+		top = bottom;
+		bottom = t;
+	}
+	if (left == right || top == bottom) {
+		region_set_empty(r);
+		return;
+	}
+
+	rc = region_rects(r);
+	SetRect(rc, left, top, right, bottom);
+	r->nrects = 1;
+	r->extents = *rc;
+	r->complexity = SIMPLEREGION;
+}
+
+/* Empty a deleted region, keeping a reasonably sized array for the next
+ * region created in its slot. */
+void
+w32x_region_trim(struct w32x_region *r)
+{
+	if (r->heap != NULL && r->size > REGION_KEEP_RECTS) {
+		free(r->heap);
+		r->heap = NULL;
+		r->size = 0;
+	}
+	region_set_empty(r);
+}
+
+static BOOL
+region_copy(struct w32x_region *dest, const struct w32x_region *src)
+{
+	if (dest == src)
+		return TRUE;
+	if (!region_reserve(dest, src->nrects))
+		return FALSE;
+
+	memcpy(region_rects(dest), region_rects(src),
+	    src->nrects * sizeof(RECT));
+	dest->nrects = src->nrects;
+	dest->extents = src->extents;
+	dest->complexity = src->complexity;
+	return TRUE;
+}
+
+static BOOL
+rect_contains(const RECT *outer, const RECT *inner)
+{
+	return outer->left <= inner->left && outer->top <= inner->top &&
+	    outer->right >= inner->right && outer->bottom >= inner->bottom;
+}
+
+/* Rectangles exclude their right and bottom edges */
+static BOOL
+rect_has_point(const RECT *r, int x, int y)
+{
+	return x >= r->left && x < r->right && y >= r->top && y < r->bottom;
+}
+
+static BOOL
+rect_overlaps(const RECT *a, const RECT *b)
+{
+	return a->left < b->right && b->left < a->right &&
+	    a->top < b->bottom && b->top < a->bottom;
+}
+
+static BOOL
+scratch_reserve(int n)
+{
+	RECT *p;
+	int size;
+
+	if (n <= scratch_size)
+		return TRUE;
+
+	size = MAX(n, MAX(scratch_size * 2, 64));
+	p = realloc(scratch, size * sizeof(RECT));
+	if (p == NULL) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	scratch = p;
+	scratch_size = size;
+	return TRUE;
+}
+
+/* Finish the band starting at index start, merging it into the previous
+ * band if that one ends where it begins and has the same spans. */
+static void
+scratch_end_band(int start)
+{
+	int n = scratch_count - start;
+	int i;
+
+	if (n == 0)
+		return;
+
+	if (prev_band >= 0 && start - prev_band == n &&
+	    scratch[prev_band].bottom == scratch[start].top) {
+		for (i = 0; i < n; i++) {
+			if (scratch[prev_band + i].left != scratch[start + i].left ||
+			    scratch[prev_band + i].right != scratch[start + i].right)
+				break;
+		}
+		if (i == n) {
+			for (i = 0; i < n; i++) {
+				scratch[prev_band + i].bottom =
+				    scratch[start + i].bottom;
+			}
+			scratch_count = start;
+			return;
+		}
+	}
+	prev_band = start;
+}
+
+static BOOL
+span_inside(int mode, BOOL in_a, BOOL in_b)
+{
+	switch (mode) {
+	case RGN_AND:
+		return in_a && in_b;
+	case RGN_OR:
+		return in_a || in_b;
+	case RGN_DIFF:
+		return in_a && !in_b;
+	default: /* RGN_XOR */
+		return in_a != in_b;
+	}
+}
+
+/*
+ * Combine the spans of one band of each source (either may be empty) by
+ * walking their edges from left to right.
+ */
+static BOOL
+band_op(int mode, int top, int bottom, const RECT *a, int na, const RECT *b,
+    int nb)
+{
+	BOOL in_a = FALSE, in_b = FALSE, inside = FALSE;
+	int start = scratch_count;
+	int i = 0, j = 0, left = 0;
+	int x, xa, xb;
+
+	/* Worst case every edge starts or ends a span */
+	if (!scratch_reserve(scratch_count + na + nb))
+		return FALSE;
+
+	while (i < na || j < nb) {
+		xa = i < na ? (in_a ? a[i].right : a[i].left) : INT_MAX;
+		xb = j < nb ? (in_b ? b[j].right : b[j].left) : INT_MAX;
+		x = MIN(xa, xb);
+
+		if (xa == x) {
+			if (in_a)
+				i++;
+			in_a = !in_a;
+		}
+		if (xb == x) {
+			if (in_b)
+				j++;
+			in_b = !in_b;
+		}
+
+		if (span_inside(mode, in_a, in_b) != inside) {
+			inside = !inside;
+			if (inside) {
+				left = x;
+			} else {
+				SetRect(&scratch[scratch_count++], left, top,
+				    x, bottom);
+			}
+		}
+	}
+
+	scratch_end_band(start);
+	return TRUE;
+}
+
+static int
+band_end(const RECT *r, int n, int i)
+{
+	int top = r[i].top;
+
+	while (i < n && r[i].top == top)
+		i++;
+	return i;
+}
+
+/*
+ * Sweep both regions from top to bottom. The y range is cut wherever a
+ * band of either region starts or ends, and every piece covered by at
+ * least one of them is combined with band_op.
+ */
+static BOOL
+region_sweep(const struct w32x_region *ra, const struct w32x_region *rb,
+    int mode)
+{
+	const RECT *a = region_rects(ra), *b = region_rects(rb);
+	int na = ra->nrects, nb = rb->nrects;
+	int ia = 0, ib = 0, ea = 0, eb = 0;
+	BOOL in_a, in_b;
+	int y, ynext;
+
+	scratch_count = 0;
+	prev_band = -1;
+
+	if (na > 0)
+		ea = band_end(a, na, 0);
+	if (nb > 0)
+		eb = band_end(b, nb, 0);
+	y = MIN(na > 0 ? a[0].top : INT_MAX, nb > 0 ? b[0].top : INT_MAX);
+
+	while (ia < na || ib < nb) {
+		/* Nothing left can produce output */
+		if ((mode == RGN_AND && (ia >= na || ib >= nb)) ||
+		    (mode == RGN_DIFF && ia >= na))
+			break;
+
+		in_a = ia < na && a[ia].top <= y;
+		in_b = ib < nb && b[ib].top <= y;
+
+		ynext = INT_MAX;
+		if (ia < na)
+			ynext = MIN(ynext, in_a ? a[ia].bottom : a[ia].top);
+		if (ib < nb)
+			ynext = MIN(ynext, in_b ? b[ib].bottom : b[ib].top);
+
+		if ((in_a || in_b) && !band_op(mode, y, ynext,
+		    a + ia, in_a ? ea - ia : 0, b + ib, in_b ? eb - ib : 0))
+			return FALSE;
+
+		y = ynext;
+		if (in_a && a[ia].bottom <= y) {
+			ia = ea;
+			if (ia < na)
+				ea = band_end(a, na, ia);
+		}
+		if (in_b && b[ib].bottom <= y) {
+			ib = eb;
+			if (ib < nb)
+				eb = band_end(b, nb, ib);
+		}
+	}
+	return TRUE;
+}
+
+/* Replace the contents of r with the scratch list. */
+static BOOL
+region_take_scratch(struct w32x_region *r)
+{
+	RECT *rc;
+	int i;
+
+	if (!region_reserve(r, scratch_count))
+		return FALSE;
+
+	if (scratch_count == 0) {
+		region_set_empty(r);
+		return TRUE;
+	}
+
+	rc = region_rects(r);
+	memcpy(rc, scratch, scratch_count * sizeof(RECT));
+	r->nrects = scratch_count;
+
+	r->extents.top = rc[0].top;
+	r->extents.bottom = rc[scratch_count - 1].bottom;
+	r->extents.left = rc[0].left;
+	r->extents.right = rc[0].right;
+	for (i = 1; i < scratch_count; i++) {
+		r->extents.left = MIN(r->extents.left, rc[i].left);
+		r->extents.right = MAX(r->extents.right, rc[i].right);
+	}
+	r->complexity = scratch_count == 1 ? SIMPLEREGION : COMPLEXREGION;
+	return TRUE;
+}
+
+/*
+ * Combine regions a and b into dest, which may be either of them. b is
+ * not used for RGN_COPY. Returns the complexity of the result, or ERROR.
+ */
+int
+w32x_region_combine(struct w32x_region *dest, const struct w32x_region *a,
+    const struct w32x_region *b, int mode)
+{
+	const struct w32x_region *same = NULL;
+
+	switch (mode) {
+	case RGN_COPY:
+		same = a;
+		break;
+	case RGN_AND:
+		if (a->nrects == 0 || b->nrects == 0 ||
+		    !rect_overlaps(&a->extents, &b->extents)) {
+			region_set_empty(dest);
+			return NULLREGION;
+		}
+		if (a->nrects == 1 && b->nrects == 1) {
+			w32x_region_set_rect(dest,
+			    MAX(a->extents.left, b->extents.left),
+			    MAX(a->extents.top, b->extents.top),
+			    MIN(a->extents.right, b->extents.right),
+			    MIN(a->extents.bottom, b->extents.bottom));
+			return dest->complexity;
+		}
+		if (a->nrects == 1 && rect_contains(&a->extents, &b->extents))
+			same = b;
+		else if (b->nrects == 1 &&
+		    rect_contains(&b->extents, &a->extents))
+			same = a;
+		break;
+	case RGN_OR:
+		if (a->nrects == 0 || (b->nrects == 1 &&
+		    rect_contains(&b->extents, &a->extents)))
+			same = b;
+		else if (b->nrects == 0 || (a->nrects == 1 &&
+		    rect_contains(&a->extents, &b->extents)))
+			same = a;
+		break;
+	case RGN_DIFF:
+		if (a->nrects == 0 || (b->nrects == 1 &&
+		    rect_contains(&b->extents, &a->extents))) {
+			region_set_empty(dest);
+			return NULLREGION;
+		}
+		if (b->nrects == 0 || !rect_overlaps(&a->extents, &b->extents))
+			same = a;
+		break;
+	case RGN_XOR:
+		if (a->nrects == 0)
+			same = b;
+		else if (b->nrects == 0)
+			same = a;
+		break;
+	default:
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return ERROR;
+	}
+
+	if (same != NULL) {
+		if (!region_copy(dest, same))
+			return ERROR;
+		return dest->complexity;
+	}
+
+	if (!region_sweep(a, b, mode) || !region_take_scratch(dest))
+		return ERROR;
+	return dest->complexity;
+}
+
+/* Add a rectangle to a region in place. */
+BOOL
+w32x_region_union_rect(struct w32x_region *r, const RECT *rc)
+{
+	struct w32x_region tmp;
+
+	if (IsRectEmpty(rc) || (r->nrects == 1 &&
+	    rect_contains(&r->extents, rc)))
+		return TRUE;
+	if (r->nrects == 0 || rect_contains(rc, &r->extents)) {
+		w32x_region_set_rect(r, rc->left, rc->top, rc->right,
+		    rc->bottom);
+		return TRUE;
+	}
+
+	tmp.heap = NULL;
+	tmp.size = 0;
+	w32x_region_set_rect(&tmp, rc->left, rc->top, rc->right, rc->bottom);
+	return w32x_region_combine(r, r, &tmp, RGN_OR) != ERROR;
+}
+
+/* Remove a rectangle from a region in place. */
+BOOL
+w32x_region_subtract_rect(struct w32x_region *r, const RECT *rc)
+{
+	struct w32x_region tmp;
+
+	if (r->nrects == 0 || IsRectEmpty(rc) ||
+	    !rect_overlaps(&r->extents, rc))
+		return TRUE;
+	if (rect_contains(rc, &r->extents)) {
+		region_set_empty(r);
+		return TRUE;
+	}
+
+	tmp.heap = NULL;
+	tmp.size = 0;
+	w32x_region_set_rect(&tmp, rc->left, rc->top, rc->right, rc->bottom);
+	return w32x_region_combine(r, r, &tmp, RGN_DIFF) != ERROR;
+}
+
+BOOL
+w32x_region_contains_point(const struct w32x_region *r, int x, int y)
+{
+	const RECT *rc = region_rects(r);
+	int i;
+
+	if (!rect_has_point(&r->extents, x, y))
+		return FALSE;
+
+	/* Bands are sorted by top; none past y can hold the point */
+	for (i = 0; i < r->nrects; i++) {
+		if (rc[i].top > y)
+			break;
+		if (rect_has_point(&rc[i], x, y))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* The rectangles of a region, in y-x banded order, for the software
+ * rasterizer. Valid until the region changes. */
+const RECT *
+w32x_region_rects(const struct w32x_region *r, int *n)
+{
+	*n = r->nrects;
+	return region_rects(r);
+}
+
+static short
+clamp_short(int v)
+{
+	return v < SHRT_MIN ? SHRT_MIN : (v > SHRT_MAX ? SHRT_MAX : v);
+}
+
+/*
+ * Convert a region to the XRectangles handed to the server as a clip
+ * list; the only place that happens. The list stays valid until the next
+ * call. Returns NULL if it cannot be allocated.
+ */
+const XRectangle *
+w32x_region_xrects(const struct w32x_region *r, int *n)
+{
+	const RECT *rc = region_rects(r);
+	XRectangle *p;
+	int i;
+
+	if (r->nrects > xrects_size) {
+		p = realloc(xrects, r->nrects * sizeof(XRectangle));
+		if (p == NULL)
+			return NULL;
+		xrects = p;
+		xrects_size = r->nrects;
+	}
+
+	for (i = 0; i < r->nrects; i++) {
+		xrects[i].x = clamp_short(rc[i].left);
+		xrects[i].y = clamp_short(rc[i].top);
+		xrects[i].width = MIN(rc[i].right - rc[i].left, USHRT_MAX);
+		xrects[i].height = MIN(rc[i].bottom - rc[i].top, USHRT_MAX);
+	}
+	*n = r->nrects;
+	return xrects;
+}
+
+/* Install a region as the clip list of a GC. An empty region clips out
+ * everything. */
+void
+w32x_region_set_gc_clip(GC gc, const struct w32x_region *r)
+{
+	const XRectangle *rects;
+	int n;
+
+	if ((rects = w32x_region_xrects(r, &n)) == NULL) {
+		/* Better to draw too much than nothing at all */
+		XSetClipMask(disp, gc, None);
+		return;
+	}
+	XSetClipRectangles(disp, gc, 0, 0, (XRectangle *)rects, n, YXBanded);
+}
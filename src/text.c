@@ -0,0 +1,601 @@
+/*
+ * Copyright (c) 2018 Devin Smith <devin@devinsmith.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef HAVE_XFT_H
+#include <X11/Xft/Xft.h>
+#endif
+#include <sys/queue.h>
+
+#include <windows.h>
+#include "w32x_priv.h"
+
+/*
+ * Unicode text.
+ *
+ * The W entry points draw UTF-16 text with Xft, which renders through
+ * XRender and is not limited to the 256 characters of the core fonts
+ * TextOut uses. DrawText takes UTF-8 and converts it.
+ *
+ * Most of the cost of Xft text is on the client: decoding the string and
+ * mapping every character to a glyph through fontconfig and FreeType.
+ * Applications redraw the same labels and table cells every frame, so the
+ * glyphs and width of each string drawn are kept in a glyph run cache
+ * keyed on the font and the text, and a repeated string costs one hash
+ * lookup and an XftDrawGlyphs call. Each DC also keeps the XftDraws for
+ * the last two drawables it drew text on (a window and its back buffer)
+ * instead of creating one per call, and only reloads their clip list when
+ * a paint cycle changes it.
+ *
+ * Without Xft the W entry points draw the Latin-1 subset of the text with
+ * the core font. Memory DCs draw text themselves (memdc.c).
+ */
+
+extern Display *disp;
+
+#define TEXT_CHUNK 256 /* characters converted per pass on the stack */
+
+/* DrawText's UTF-16 conversion of its UTF-8 argument */
+static __thread WCHAR *utf16;
+static __thread int utf16_size;
+
+#ifdef HAVE_XFT_H
+
+#define RUN_MAX_LEN 128     /* longest string cached */
+#define RUN_CACHE_SIZE 1024 /* runs kept */
+#define RUN_HASH_SIZE 2048  /* buckets, power of two */
+
+struct glyph_run {
+	XftFont *font; /* NULL when the entry is free */
+	uint32_t hash;
+	int len; /* UTF-16 units */
+	WCHAR text[RUN_MAX_LEN];
+	FT_UInt glyphs[RUN_MAX_LEN];
+	int nglyphs;
+	int width;
+	struct glyph_run *next; /* hash chain */
+	TAILQ_ENTRY(glyph_run) lru;
+};
+
+static struct glyph_run *run_hash[RUN_HASH_SIZE];
+static TAILQ_HEAD(run_list, glyph_run) run_lru = TAILQ_HEAD_INITIALIZER(run_lru);
+static int run_count;
+
+/* Runs too long to cache are shaped here */
+static struct {
+	FT_UInt *glyphs;
+	int size;
+	struct glyph_run run;
+} scratch;
+
+static uint32_t
+run_hash_key(XftFont *font, const WCHAR *s, int len)
+{
+	uintptr_t p = (uintptr_t)font;
+	uint32_t h = 2166136261u;
+	int i;
+
+	for (i = 0; i < (int)sizeof(p); i++, p >>= 8)
+		h = (h ^ (p & 0xff)) * 16777619u;
+	for (i = 0; i < len; i++) {
+		h = (h ^ (s[i] & 0xff)) * 16777619u;
+		h = (h ^ (s[i] >> 8)) * 16777619u;
+	}
+	return h;
+}
+
+/* Map UTF-16 to glyphs, combining surrogate pairs. Returns the glyph
+ * count, which is at most len. */
+static int
+run_shape(XftFont *font, const WCHAR *s, int len, FT_UInt *glyphs)
+{
+	FcChar32 ch;
+	int i, n = 0;
+
+	for (i = 0; i < len; i++) {
+		ch = s[i];
+		if (ch >= 0xd800 && ch <= 0xdbff && i + 1 < len &&
+		    s[i + 1] >= 0xdc00 && s[i + 1] <= 0xdfff) {
+			ch = 0x10000 + ((ch - 0xd800) << 10) + (s[i + 1] - 0xdc00);
+			i++;
+		}
+		glyphs[n++] = XftCharIndex(disp, font, ch);
+	}
+	return n;
+}
+
+static int
+run_width(XftFont *font, const FT_UInt *glyphs, int n)
+{
+	XGlyphInfo ext;
+
+	if (n == 0)
+		return 0;
+	XftGlyphExtents(disp, font, glyphs, n, &ext);
+	return ext.xOff;
+}
+
+static void
+run_unhash(struct glyph_run *run)
+{
+	struct glyph_run **pp = &run_hash[run->hash & (RUN_HASH_SIZE - 1)];
+
+	while (*pp != run)
+		pp = &(*pp)->next;
+	*pp = run->next;
+	run->font = NULL;
+}
+
+/* An uncached run, valid until the next call */
+static struct glyph_run *
+run_scratch(XftFont *font, const WCHAR *s, int len)
+{
+	FT_UInt *p;
+
+	if (len > scratch.size) {
+		p = realloc(scratch.glyphs, len * sizeof(FT_UInt));
+		if (p == NULL)
+			return NULL;
+		scratch.glyphs = p;
+		scratch.size = len;
+	}
+	scratch.run.nglyphs = run_shape(font, s, len, scratch.glyphs);
+	scratch.run.width = run_width(font, scratch.glyphs,
+	    scratch.run.nglyphs);
+	return &scratch.run;
+}
+
+/* Glyphs for s in font, from the cache when it has been drawn before */
+static const struct glyph_run *
+run_get(XftFont *font, const WCHAR *s, int len, const FT_UInt **glyphs)
+{
+	struct glyph_run *run;
+	uint32_t h;
+
+	if (len > RUN_MAX_LEN) {
+		if ((run = run_scratch(font, s, len)) != NULL)
+			*glyphs = scratch.glyphs;
+		return run;
+	}
+
+	h = run_hash_key(font, s, len);
+	for (run = run_hash[h & (RUN_HASH_SIZE - 1)]; run; run = run->next) {
+		if (run->hash == h && run->font == font && run->len == len &&
+		    memcmp(run->text, s, len * sizeof(WCHAR)) == 0) {
+			TAILQ_REMOVE(&run_lru, run, lru);
+			TAILQ_INSERT_HEAD(&run_lru, run, lru);
+			*glyphs = run->glyphs;
+			return run;
+		}
+	}
+
+	/* Miss, shape it into a new entry or the least recently used one */
+	if (run_count < RUN_CACHE_SIZE &&
+	    (run = malloc(sizeof(struct glyph_run))) != NULL) {
+		run_count++;
+	} else {
+		if ((run = TAILQ_LAST(&run_lru, run_list)) == NULL)
+			return NULL;
+		if (run->font != NULL)
+			run_unhash(run);
+		TAILQ_REMOVE(&run_lru, run, lru);
+	}
+
+	run->font = font;
+	run->hash = h;
+	run->len = len;
+	memcpy(run->text, s, len * sizeof(WCHAR));
+	run->nglyphs = run_shape(font, s, len, run->glyphs);
+	run->width = run_width(font, run->glyphs, run->nglyphs);
+	run->next = run_hash[h & (RUN_HASH_SIZE - 1)];
+	run_hash[h & (RUN_HASH_SIZE - 1)] = run;
+	TAILQ_INSERT_HEAD(&run_lru, run, lru);
+
+	*glyphs = run->glyphs;
+	return run;
+}
+
+/* Called by font.c, with the library lock held, before it closes an Xft
+ * font */
+void
+w32x_text_forget_font(XftFont *font)
+{
+	struct glyph_run *run, *next;
+
+	for (run = TAILQ_FIRST(&run_lru); run != NULL; run = next) {
+		next = TAILQ_NEXT(run, lru);
+		if (run->font != font)
+			continue;
+		/* Free entries are reused first */
+		run_unhash(run);
+		TAILQ_REMOVE(&run_lru, run, lru);
+		TAILQ_INSERT_TAIL(&run_lru, run, lru);
+	}
+}
+
+/* The XftDraw for the drawable the DC currently targets */
+static XftDraw *
+dc_xft_draw(HDC hdc)
+{
+	const XRectangle *rects;
+	int i, n;
+
+	for (i = 0; i < 2; i++) {
+		if (hdc->xft[i].draw != NULL &&
+		    hdc->xft[i].drawable == hdc->drawable)
+			break;
+	}
+
+	if (i == 2) {
+		i = !hdc->xft_last;
+		if (hdc->xft[i].draw != NULL)
+			XftDrawDestroy(hdc->xft[i].draw);
+		hdc->xft[i].draw = XftDrawCreate(disp, hdc->drawable,
+		    DefaultVisual(disp, DefaultScreen(disp)),
+		    DefaultColormap(disp, DefaultScreen(disp)));
+		if (hdc->xft[i].draw == NULL)
+			return NULL;
+		hdc->xft[i].drawable = hdc->drawable;
+		hdc->xft[i].clip_serial = 0;
+	}
+	hdc->xft_last = i;
+
+	/* Follow the paint region the DC's GC is clipped to */
+	if (hdc->xft[i].clip_serial != hdc->clip_serial) {
+		if (hdc->clip != NULL &&
+		    (rects = w32x_region_xrects(hdc->clip, &n)) != NULL) {
+			XftDrawSetClipRectangles(hdc->xft[i].draw, 0, 0,
+			    rects, n);
+		} else {
+			XftDrawSetClip(hdc->xft[i].draw, NULL);
+		}
+		hdc->xft[i].clip_serial = hdc->clip_serial;
+	}
+	return hdc->xft[i].draw;
+}
+
+static XftFont *
+dc_xft_font(HDC hdc)
+{
+	struct gdi_font *font = w32x_gdi_get(hdc->selectedFont,
+	    GDI_TYPE_FONT);
+
+	if (font == NULL)
+		return NULL;
+	return w32x_font_xft(font);
+}
+
+#endif /* HAVE_XFT_H */
+
+/* Called before the DC's drawable is freed */
+void
+w32x_dc_forget_drawable(HDC hdc, Drawable drawable)
+{
+#ifdef HAVE_XFT_H
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (hdc->xft[i].draw != NULL &&
+		    hdc->xft[i].drawable == drawable) {
+			XftDrawDestroy(hdc->xft[i].draw);
+			hdc->xft[i].draw = NULL;
+		}
+	}
+#endif
+}
+
+/* Latin-1 chunk of a UTF-16 string for the core font path */
+static int
+latin1_chunk(const WCHAR *s, int c, char *buf)
+{
+	int i, n = c < TEXT_CHUNK ? c : TEXT_CHUNK;
+
+	for (i = 0; i < n; i++)
+		buf[i] = s[i] <= 0xff ? s[i] : '?';
+	return n;
+}
+
+static BOOL
+core_text_out(HDC hdc, int x, int y, LPCWSTR s, int c)
+{
+	char buf[TEXT_CHUNK];
+	SIZE sz;
+	int n;
+
+	while (c > 0) {
+		n = latin1_chunk(s, c, buf);
+		if (!TextOut(hdc, x, y, buf, n) ||
+		    !GetTextExtentPoint32(hdc, buf, n, &sz))
+			return FALSE;
+		x += sz.cx;
+		s += n;
+		c -= n;
+	}
+	return TRUE;
+}
+
+static BOOL
+core_text_extent(HDC hdc, LPCWSTR s, int c, LPSIZE lpSize)
+{
+	char buf[TEXT_CHUNK];
+	SIZE sz;
+	int n;
+
+	if (!GetTextExtentPoint32(hdc, "", 0, lpSize))
+		return FALSE;
+	while (c > 0) {
+		n = latin1_chunk(s, c, buf);
+		GetTextExtentPoint32(hdc, buf, n, &sz);
+		lpSize->cx += sz.cx;
+		s += n;
+		c -= n;
+	}
+	return TRUE;
+}
+
+BOOL
+TextOutW(HDC hdc, int nXStart, int nYStart, LPCWSTR lpString,
+    int cchString)
+{
+#ifdef HAVE_XFT_H
+	const struct glyph_run *run;
+	const FT_UInt *glyphs;
+	XftFont *font;
+	XftDraw *draw;
+	XftColor color;
+	COLORREF cr = hdc->textColor;
+#endif
+
+	if (lpString == NULL || cchString < 0) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	if (hdc->mem)
+		return w32x_mem_text_out(hdc, nXStart, nYStart, lpString,
+		    cchString);
+
+#ifdef HAVE_XFT_H
+	if ((font = dc_xft_font(hdc)) != NULL) {
+		/* The run cache is shared by all threads, the run is only
+		 * good while the lock is held */
+		w32x_lock();
+		if ((run = run_get(font, lpString, cchString, &glyphs)) == NULL) {
+			w32x_unlock();
+			return FALSE;
+		}
+
+		/* Queued shapes go first so they stay underneath the text */
+		w32x_dc_flush(hdc);
+		if ((draw = dc_xft_draw(hdc)) == NULL) {
+			w32x_unlock();
+			return FALSE;
+		}
+
+		color.pixel = w32x_color_to_pixel(cr);
+		color.color.red = GetRValue(cr) * 257;
+		color.color.green = GetGValue(cr) * 257;
+		color.color.blue = GetBValue(cr) * 257;
+		color.color.alpha = 0xffff;
+
+		/* nYStart is the top of the text, Xft wants the baseline */
+		XftDrawGlyphs(draw, &color, font, nXStart,
+		    nYStart + font->ascent, glyphs, run->nglyphs);
+		w32x_unlock();
+		return TRUE;
+	}
+#endif
+	return core_text_out(hdc, nXStart, nYStart, lpString, cchString);
+}
+
+BOOL
+GetTextExtentPoint32W(HDC hdc, LPCWSTR lpString, int c, LPSIZE lpSize)
+{
+#ifdef HAVE_XFT_H
+	const struct glyph_run *run;
+	const FT_UInt *glyphs;
+	XftFont *font;
+#endif
+
+	if (lpString == NULL || c < 0 || lpSize == NULL) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	if (hdc->mem)
+		return w32x_mem_text_extent(hdc, lpString, c, lpSize);
+
+#ifdef HAVE_XFT_H
+	if ((font = dc_xft_font(hdc)) != NULL) {
+		w32x_lock();
+		if ((run = run_get(font, lpString, c, &glyphs)) == NULL) {
+			w32x_unlock();
+			return FALSE;
+		}
+		lpSize->cx = run->width;
+		lpSize->cy = font->ascent + font->descent;
+		w32x_unlock();
+		return TRUE;
+	}
+#endif
+	return core_text_extent(hdc, lpString, c, lpSize);
+}
+
+/*
+ * Draw or measure (DT_CALCRECT) text in a rectangle, one line per '\n'
+ * unless DT_SINGLELINE is given. Text is not clipped to the rectangle and
+ * lines are not wrapped. Returns the height of the text.
+ */
+static int
+draw_text(HDC hdc, const WCHAR *text, int len, LPRECT lprc, UINT format)
+{
+	const WCHAR *line, *end, *eol;
+	int height = 0, width = 0, x, y, n;
+	SIZE sz;
+
+	y = lprc->top;
+	end = text + len;
+	for (line = text; line <= end; line = eol + 1) {
+		eol = line;
+		if (format & DT_SINGLELINE)
+			eol = end;
+		while (eol < end && *eol != '\n')
+			eol++;
+		n = eol - line;
+		if (n > 0 && line[n - 1] == '\r')
+			n--;
+
+		if (!GetTextExtentPoint32W(hdc, line, n, &sz))
+			return 0;
+		if (sz.cx > width)
+			width = sz.cx;
+
+		if (format & DT_SINGLELINE) {
+			if (format & DT_BOTTOM)
+				y = lprc->bottom - sz.cy;
+			else if (format & DT_VCENTER)
+				y = lprc->top + (lprc->bottom - lprc->top -
+				    sz.cy) / 2;
+		}
+
+		if (!(format & DT_CALCRECT)) {
+			if (format & DT_CENTER)
+				x = lprc->left + (lprc->right - lprc->left -
+				    sz.cx) / 2;
+			else if (format & DT_RIGHT)
+				x = lprc->right - sz.cx;
+			else
+				x = lprc->left;
+			TextOutW(hdc, x, y, line, n);
+		}
+
+		y += sz.cy;
+		height += sz.cy;
+	}
+
+	if (format & DT_CALCRECT) {
+		lprc->right = lprc->left + width;
+		lprc->bottom = lprc->top + height;
+	}
+	return height;
+}
+
+int
+DrawTextW(HDC hdc, LPCWSTR lpchText, int cchText, LPRECT lprc, UINT format)
+{
+	if (lpchText == NULL || lprc == NULL) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return 0;
+	}
+	if (cchText < 0) {
+		for (cchText = 0; lpchText[cchText] != 0; cchText++)
+			;
+	}
+	return draw_text(hdc, lpchText, cchText, lprc, format);
+}
+
+/* Decode UTF-8, replacing malformed sequences with U+FFFD. Returns the
+ * number of UTF-16 units written to out, which has room for len. */
+static int
+utf8_to_utf16(const unsigned char *s, int len, WCHAR *out)
+{
+	const unsigned char *end = s + len;
+	uint32_t ch;
+	int n, i, o = 0;
+
+	while (s < end) {
+		ch = *s++;
+		if (ch < 0x80) {
+			out[o++] = ch;
+			continue;
+		} else if (ch >= 0xc2 && ch <= 0xdf) {
+			ch &= 0x1f;
+			n = 1;
+		} else if (ch >= 0xe0 && ch <= 0xef) {
+			ch &= 0x0f;
+			n = 2;
+		} else if (ch >= 0xf0 && ch <= 0xf4) {
+			ch &= 0x07;
+			n = 3;
+		} else {
+			out[o++] = 0xfffd;
+			continue;
+		}
+
+		for (i = 0; i < n && s + i < end && (s[i] & 0xc0) == 0x80; i++)
+			ch = (ch << 6) | (s[i] & 0x3f);
+		if (i < n || (n == 2 && (ch < 0x800 ||
+		    (ch >= 0xd800 && ch <= 0xdfff))) ||
+		    (n == 3 && (ch < 0x10000 || ch > 0x10ffff))) {
+			s += i;
+			out[o++] = 0xfffd;
+			continue;
+		}
+		s += n;
+
+		/* A 4 byte sequence becomes a surrogate pair, which still
+		 * fits as it was 4 input bytes */
+		if (ch >= 0x10000) {
+			ch -= 0x10000;
+			out[o++] = 0xd800 + (ch >> 10);
+			out[o++] = 0xdc00 + (ch & 0x3ff);
+		} else {
+			out[o++] = ch;
+		}
+	}
+	return o;
+}
+
+/* DrawTextW for UTF-8 text */
+int
+DrawText(HDC hdc, const char *lpchText, int cchText, LPRECT lprc,
+    UINT format)
+{
+	WCHAR *p;
+	int n;
+
+	if (lpchText == NULL || lprc == NULL) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return 0;
+	}
+	if (cchText < 0)
+		cchText = strlen(lpchText);
+	if (cchText > utf16_size) {
+		p = realloc(utf16, cchText * sizeof(WCHAR));
+		if (p == NULL) {
+			SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+			return 0;
+		}
+		utf16 = p;
+		utf16_size = cchText;
+	}
+
+	n = utf8_to_utf16((const unsigned char *)lpchText, cchText, utf16);
+	return draw_text(hdc, utf16, n, lprc, format);
+}
@@ -0,0 +1,452 @@
+/*
+ * Copyright (c) 2018 Devin Smith <devin@devinsmith.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <sys/queue.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef HAVE_XFT_H
+#include <X11/Xft/Xft.h>
+#endif
+
+#include <windows.h>
+#include "w32x_priv.h"
+
+/*
+ * SetTimer timers.
+ *
+ * Timers waiting to expire are kept in a binary min-heap ordered by
+ * deadline, so the message loop can sleep exactly until the earliest one
+ * and expiring timers costs O(log n) each however many exist.
+ *
+ * An expired timer leaves the heap for the ready list, where GetMessage
+ * finds it once there is nothing else to do and turns it into a
+ * WM_TIMER. It goes back into the heap only when that message has been
+ * retrieved, so a timer has at most one WM_TIMER pending and one the
+ * application is slow to pick up does not wake the process again.
+ *
+ * Timers are found by window and id through a chained hash table.
+ */
+
+#define TIMER_HASH_MIN 64
+#define HEAP_NONE ((unsigned int)-1)
+
+struct w32x_timer {
+	HWND hwnd;
+	UINT_PTR id;
+	UINT elapse;
+	TIMERPROC proc;
+	uint64_t due;           /* CLOCK_MONOTONIC ms */
+	unsigned int heap_pos;  /* HEAP_NONE while ready */
+
+	TAILQ_ENTRY(w32x_timer) ready_entries;
+	struct w32x_timer *hash_next;
+};
+
+TAILQ_HEAD(timer_ready_list, w32x_timer);
+
+/* Timers belong to the thread that set them, like its message queue */
+static __thread struct w32x_timer **heap;
+static __thread unsigned int heap_count, heap_size;
+static __thread struct timer_ready_list ready;
+
+static __thread struct w32x_timer **buckets;
+static __thread unsigned int bucket_mask; /* size - 1, a power of two */
+static __thread unsigned int timer_count;
+static __thread UINT_PTR next_timer_id = 1;
+
+static uint64_t
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+DWORD
+GetTickCount(void)
+{
+	return (DWORD)now_ms();
+}
+
+static unsigned int
+timer_hash(HWND hwnd, UINT_PTR id)
+{
+	uint64_t key = (uint64_t)(uintptr_t)hwnd ^ ((uint64_t)id << 32 | id);
+
+	return (unsigned int)((key * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+static struct w32x_timer **
+timer_slot(HWND hwnd, UINT_PTR id)
+{
+	struct w32x_timer **tp;
+
+	if (buckets == NULL)
+		return NULL;
+	tp = &buckets[timer_hash(hwnd, id) & bucket_mask];
+	while (*tp != NULL && ((*tp)->hwnd != hwnd || (*tp)->id != id))
+		tp = &(*tp)->hash_next;
+	return tp;
+}
+
+/* Double the bucket array once the chains average more than one timer */
+static BOOL
+timer_hash_grow(void)
+{
+	struct w32x_timer **nb, *t, *next;
+	unsigned int i, size, mask;
+
+	size = buckets == NULL ? TIMER_HASH_MIN : (bucket_mask + 1) * 2;
+	nb = calloc(size, sizeof(*nb));
+	if (nb == NULL)
+		return FALSE;
+	mask = size - 1;
+
+	if (buckets != NULL) {
+		for (i = 0; i <= bucket_mask; i++) {
+			for (t = buckets[i]; t != NULL; t = next) {
+				next = t->hash_next;
+				t->hash_next = nb[timer_hash(t->hwnd, t->id) & mask];
+				nb[timer_hash(t->hwnd, t->id) & mask] = t;
+			}
+		}
+		free(buckets);
+	}
+	buckets = nb;
+	bucket_mask = mask;
+	return TRUE;
+}
+
+static void
+heap_set(unsigned int pos, struct w32x_timer *t)
+{
+	heap[pos] = t;
+	t->heap_pos = pos;
+}
+
+static void
+heap_sift_up(unsigned int pos)
+{
+	struct w32x_timer *t = heap[pos];
+	unsigned int parent;
+
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (heap[parent]->due <= t->due)
+			break;
+		heap_set(pos, heap[parent]);
+		pos = parent;
+	}
+	heap_set(pos, t);
+}
+
+static void
+heap_sift_down(unsigned int pos)
+{
+	struct w32x_timer *t = heap[pos];
+	unsigned int child;
+
+	while ((child = pos * 2 + 1) < heap_count) {
+		if (child + 1 < heap_count &&
+		    heap[child + 1]->due < heap[child]->due)
+			child++;
+		if (t->due <= heap[child]->due)
+			break;
+		heap_set(pos, heap[child]);
+		pos = child;
+	}
+	heap_set(pos, t);
+}
+
+/*
+ * Room in the heap for one more timer, ensured before a timer is made so
+ * putting a ready timer back never fails
+ */
+static BOOL
+heap_reserve(void)
+{
+	struct w32x_timer **nh;
+	unsigned int size;
+
+	if (timer_count < heap_size)
+		return TRUE;
+	size = heap_size == 0 ? TIMER_HASH_MIN : heap_size * 2;
+	nh = realloc(heap, size * sizeof(*nh));
+	if (nh == NULL)
+		return FALSE;
+	heap = nh;
+	heap_size = size;
+	return TRUE;
+}
+
+static void
+heap_insert(struct w32x_timer *t)
+{
+	heap_set(heap_count++, t);
+	heap_sift_up(t->heap_pos);
+}
+
+static void
+heap_remove(struct w32x_timer *t)
+{
+	unsigned int pos = t->heap_pos;
+
+	t->heap_pos = HEAP_NONE;
+	if (pos == --heap_count)
+		return;
+	heap_set(pos, heap[heap_count]);
+	if (pos > 0 && heap[(pos - 1) / 2]->due > heap[pos]->due)
+		heap_sift_up(pos);
+	else
+		heap_sift_down(pos);
+}
+
+/* Take the timer out of the heap or the ready list */
+static void
+timer_unschedule(struct w32x_timer *t)
+{
+	if (t->heap_pos != HEAP_NONE)
+		heap_remove(t);
+	else
+		TAILQ_REMOVE(&ready, t, ready_entries);
+}
+
+/* Move every timer whose deadline has passed to the ready list */
+static void
+timer_expire(void)
+{
+	struct w32x_timer *t;
+	uint64_t now;
+
+	if (heap_count == 0)
+		return;
+	now = now_ms();
+	while (heap_count > 0 && heap[0]->due <= now) {
+		t = heap[0];
+		heap_remove(t);
+		TAILQ_INSERT_TAIL(&ready, t, ready_entries);
+	}
+}
+
+UINT_PTR
+SetTimer(HWND hwnd, UINT_PTR nIDEvent, UINT uElapse, TIMERPROC lpTimerFunc)
+{
+	struct w32x_timer **tp, *t;
+
+	if (hwnd != NULL && !IsWindow(hwnd)) {
+		SetLastError(ERROR_INVALID_WINDOW_HANDLE);
+		return 0;
+	}
+	/* WM_TIMER comes from the queue of the thread owning the window */
+	if (hwnd != NULL && hwnd->owner != w32x_current_thread()) {
+		SetLastError(ERROR_ACCESS_DENIED);
+		return 0;
+	}
+	if (ready.tqh_last == NULL)
+		TAILQ_INIT(&ready);
+
+	if (uElapse < USER_TIMER_MINIMUM)
+		uElapse = USER_TIMER_MINIMUM;
+	else if (uElapse > USER_TIMER_MAXIMUM)
+		uElapse = USER_TIMER_MAXIMUM;
+
+	/*
+	 * Timers without a window get an id of their own unless nIDEvent
+	 * names one of the thread's timers, which is then reset. So does a
+	 * window timer set with id 0, as returning 0 would mean failure.
+	 */
+	tp = timer_slot(hwnd, nIDEvent);
+	if (nIDEvent == 0 || (hwnd == NULL && (tp == NULL || *tp == NULL))) {
+		do {
+			nIDEvent = next_timer_id++;
+			if (next_timer_id == 0)
+				next_timer_id = 1;
+			tp = timer_slot(hwnd, nIDEvent);
+		} while (tp != NULL && *tp != NULL);
+	}
+
+	tp = timer_slot(hwnd, nIDEvent);
+	if (tp != NULL && (t = *tp) != NULL) {
+		/* Setting an existing timer restarts it */
+		timer_unschedule(t);
+	} else {
+		if (!heap_reserve() || (timer_count >= bucket_mask &&
+		    !timer_hash_grow())) {
+			SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+			return 0;
+		}
+		if ((t = calloc(1, sizeof(*t))) == NULL) {
+			SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+			return 0;
+		}
+		t->hwnd = hwnd;
+		t->id = nIDEvent;
+		tp = timer_slot(hwnd, nIDEvent);
+		*tp = t;
+		timer_count++;
+		if (hwnd != NULL)
+			hwnd->timers++;
+	}
+
+	t->elapse = uElapse;
+	t->proc = lpTimerFunc;
+	t->due = now_ms() + uElapse;
+	heap_insert(t);
+	return nIDEvent;
+}
+
+static void
+timer_free(struct w32x_timer **tp)
+{
+	struct w32x_timer *t = *tp;
+
+	timer_unschedule(t);
+	*tp = t->hash_next;
+	timer_count--;
+	if (t->hwnd != NULL)
+		t->hwnd->timers--;
+	free(t);
+}
+
+BOOL
+KillTimer(HWND hwnd, UINT_PTR uIDEvent)
+{
+	struct w32x_timer **tp;
+
+	tp = timer_slot(hwnd, uIDEvent);
+	if (tp == NULL || *tp == NULL) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	timer_free(tp);
+	return TRUE;
+}
+
+/* Kill the timers of a window being destroyed */
+void
+w32x_timer_forget_window(HWND hwnd)
+{
+	struct w32x_timer **tp;
+	unsigned int i;
+
+	for (i = 0; hwnd->timers > 0 && i <= bucket_mask; i++) {
+		tp = &buckets[i];
+		while (*tp != NULL) {
+			if ((*tp)->hwnd == hwnd)
+				timer_free(tp);
+			else
+				tp = &(*tp)->hash_next;
+		}
+	}
+}
+
+/* Kill every timer of a thread that is exiting */
+void
+w32x_timer_exit(void)
+{
+	unsigned int i;
+
+	for (i = 0; timer_count > 0 && i <= bucket_mask; i++) {
+		while (buckets[i] != NULL)
+			timer_free(&buckets[i]);
+	}
+	free(buckets);
+	buckets = NULL;
+	bucket_mask = 0;
+	free(heap);
+	heap = NULL;
+	heap_size = 0;
+}
+
+/*
+ * Milliseconds until the next timer expires, 0 if one is ready and -1 if
+ * there are no timers waiting.
+ */
+int
+w32x_timer_timeout(void)
+{
+	uint64_t now;
+
+	if (!TAILQ_EMPTY(&ready))
+		return 0;
+	if (heap_count == 0)
+		return -1;
+	now = now_ms();
+	if (heap[0]->due <= now)
+		return 0;
+	if (heap[0]->due - now > INT32_MAX)
+		return INT32_MAX;
+	return (int)(heap[0]->due - now);
+}
+
+BOOL
+w32x_timer_ready(void)
+{
+	timer_expire();
+	return !TAILQ_EMPTY(&ready);
+}
+
+/*
+ * Fill msg with the WM_TIMER of the first expired timer for hwnd (any
+ * window if NULL). With remove set the timer starts its next period.
+ */
+BOOL
+w32x_timer_get(LPMSG msg, HWND hwnd, BOOL remove)
+{
+	struct w32x_timer *t;
+	uint64_t now;
+
+	timer_expire();
+	TAILQ_FOREACH(t, &ready, ready_entries) {
+		if (hwnd == NULL || t->hwnd == hwnd)
+			break;
+	}
+	if (t == NULL)
+		return FALSE;
+
+	msg->hwnd = t->hwnd;
+	msg->message = WM_TIMER;
+	msg->wParam = t->id;
+	msg->lParam = (LPARAM)t->proc;
+
+	if (remove) {
+		/* Periods missed while the message waited are dropped */
+		TAILQ_REMOVE(&ready, t, ready_entries);
+		now = now_ms();
+		t->due += t->elapse;
+		if (t->due <= now)
+			t->due = now + t->elapse;
+		heap_insert(t);
+	}
+	return TRUE;
+}
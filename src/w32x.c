@@ -27,16 +27,25 @@
  */
 
 #define _GNU_SOURCE
+#include <config.h>
+
 #include <sys/queue.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
 #include <errno.h>
 #include <link.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xresource.h>
+#ifdef HAVE_XFT_H
+#include <X11/Xft/Xft.h>
+#endif
 
 #include <windows.h>
 #include "w32x_priv.h"
@@ -45,25 +54,72 @@ Colormap colormap;
 int blackpixel;
 int whitepixel;
 Display *disp;
-XContext ctxt;
 
-static DWORD last_error;
+static __thread DWORD last_error;
 
-struct msgq_entry {
-	MSG msg;
-	TAILQ_ENTRY(msgq_entry) entries;
+/*
+ * Posted messages live in a power-of-two ring of MSG slots. The ring only
+ * ever grows, so once it has reached the application's working size,
+ * posting and retrieving messages does not allocate.
+ */
+struct msg_ring {
+	MSG *slots;
+	unsigned int mask;  /* capacity - 1 */
+	unsigned int head;  /* next slot to read */
+	unsigned int tail;  /* next slot to write */
 };
 
-struct paint_entry {
-	Wnd *wnd;
+#define MSG_RING_INITIAL 256
 
-	TAILQ_ENTRY(paint_entry) entries;
-};
+/* An application file descriptor registered with WSAAsyncSelect. */
+struct async_fd {
+	int fd;
+	HWND hwnd;
+	UINT msg;
+	long events;   /* FD_* events the caller asked for */
+	long revents;  /* FD_* events that fired, valid while ready */
+	BOOL ready;
 
-TAILQ_HEAD(msg_queue, msgq_entry) g_msg_queue;
-TAILQ_HEAD(paint_queue, paint_entry) g_paint_queue;
+	TAILQ_ENTRY(async_fd) entries;
+	TAILQ_ENTRY(async_fd) ready_entries;
+};
 
-static WndClass *class_list = NULL;
+/*
+ * Every thread that creates a window or asks for messages gets a queue of
+ * its own: the message ring, paint queue and WSAAsyncSelect fds below are
+ * thread local, and self is what other threads see of it. A window's
+ * messages go to the queue of the thread that created it.
+ *
+ * The X connection is shared. Whichever thread finds events queued on it
+ * reads them and passes those for other threads' windows on to their
+ * inboxes; xevent_lock keeps the events of a window in order while doing
+ * so.
+ */
+static __thread struct w32x_thread *self;
+static __thread struct msg_ring g_msg_queue;
+static __thread BOOL quit_posted;
+static __thread int quit_code;
+static __thread TAILQ_HEAD(paint_queue, paint_entry) g_paint_queue;
+static __thread TAILQ_HEAD(async_list, async_fd) g_async_fds;
+static __thread TAILQ_HEAD(async_ready_list, async_fd) g_ready_fds;
+
+/* Single epoll set per thread holding the X connection and all registered
+ * fds. The X connection is the entry whose data.ptr is NULL, the eventfd
+ * other threads wake us with the one pointing at postq_wake. */
+static __thread int epoll_fd = -1;
+static char postq_wake;
+
+static LIST_HEAD(, w32x_thread) threads = LIST_HEAD_INITIALIZER(threads);
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t xevent_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Guards what all threads share besides the X connection: the window map,
+ * window classes, GDI handles and the font, glyph and color caches. It
+ * may be taken recursively. */
+static pthread_mutex_t global_lock;
+
+#define W32X_MAX_EVENTS 32
 
 extern WNDCLASS ButtonClass;
 extern WNDCLASS MenuClass;
@@ -83,6 +139,118 @@ callback(struct dl_phdr_info *info, size_t size, void *data)
 	return 0;
 }
 
+void
+w32x_lock(void)
+{
+	pthread_mutex_lock(&global_lock);
+}
+
+void
+w32x_unlock(void)
+{
+	pthread_mutex_unlock(&global_lock);
+}
+
+static int
+w32x_init_wait(struct w32x_thread *t)
+{
+	struct epoll_event ev;
+	int fd;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1)
+		return -1;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (disp != NULL &&
+	    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ConnectionNumber(disp), &ev) == -1)
+		return -1;
+
+	ev.data.ptr = &postq_wake;
+	if ((fd = w32x_postq_init(&t->postq)) == -1)
+		return -1;
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*
+ * A thread with a queue is exiting. Its windows go with it, as nothing
+ * would handle their messages any more, and so does the queue. The
+ * struct stays, as other threads may still hold windows pointing at it;
+ * with the postq closed, messages sent to them return 0 straight away.
+ */
+static void
+thread_exit(void *arg)
+{
+	struct w32x_thread *t = arg;
+	struct async_fd *afd;
+	HWND wnd;
+
+	while ((wnd = w32x_wndmap_owned(t)) != NULL)
+		DestroyWindow(wnd);
+	w32x_timer_exit();
+
+	w32x_lock();
+	LIST_REMOVE(t, entries);
+	w32x_unlock();
+	w32x_postq_close(&t->postq);
+
+	pthread_mutex_lock(&t->inbox_lock);
+	free(t->inbox);
+	t->inbox = NULL;
+	t->inbox_count = t->inbox_size = 0;
+	pthread_mutex_unlock(&t->inbox_lock);
+
+	while ((afd = TAILQ_FIRST(&g_async_fds)) != NULL) {
+		TAILQ_REMOVE(&g_async_fds, afd, entries);
+		free(afd);
+	}
+	TAILQ_INIT(&g_ready_fds);
+	close(epoll_fd);
+	epoll_fd = -1;
+	free(g_msg_queue.slots);
+	memset(&g_msg_queue, 0, sizeof(g_msg_queue));
+	self = NULL;
+}
+
+static void
+thread_key_create(void)
+{
+	pthread_key_create(&thread_key, thread_exit);
+}
+
+/* The calling thread's queue, set up on first use. */
+struct w32x_thread *
+w32x_current_thread(void)
+{
+	struct w32x_thread *t;
+
+	if (self != NULL)
+		return self;
+
+	if ((t = calloc(1, sizeof(*t))) == NULL ||
+	    w32x_init_wait(t) == -1) {
+		fprintf(stderr, "Unable to create message queue.\n");
+		exit(1);
+	}
+	t->id = GetCurrentThreadId();
+	pthread_mutex_init(&t->inbox_lock, NULL);
+	TAILQ_INIT(&g_paint_queue);
+	TAILQ_INIT(&g_async_fds);
+	TAILQ_INIT(&g_ready_fds);
+
+	w32x_lock();
+	LIST_INSERT_HEAD(&threads, t, entries);
+	w32x_unlock();
+	self = t;
+
+	/* The main thread's queue lives until exit() */
+	pthread_once(&thread_key_once, thread_key_create);
+	pthread_setspecific(thread_key, t);
+	return t;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -90,20 +258,35 @@ main(int argc, char *argv[])
 	size_t length = 0;
 	int result = 1;
 	const char *display = getenv("DISPLAY");
+	pthread_mutexattr_t attr;
 	dl_iterate_phdr(callback, NULL);
 
-	if ((display == NULL) ||
-	    (disp = XOpenDisplay(display)) == NULL) {
-		fprintf(stderr, "Unable to open display.\n");
-		exit(1);
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&global_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	/* Any thread may create windows and draw */
+	XInitThreads();
+
+	/* Without a display there are no windows, but memory DCs, timers
+	 * and thread messages still work, e.g. to render on a build box */
+	if (display != NULL && (disp = XOpenDisplay(display)) != NULL) {
+		colormap = DefaultColormap(disp, DefaultScreen(disp));
+
+		/* Initialize color */
+		blackpixel = BlackPixel(disp, DefaultScreen(disp));
+		whitepixel = WhitePixel(disp, DefaultScreen(disp));
+		w32x_color_init();
+		w32x_keyboard_init();
+
+		/* Capture the WM_DELETE_WINDOW atom, if it exists. We'll use
+		 * this later to tell the window manager that we're interested
+		 * in handling the close/delete events for top level
+		 * windows */
+		WM_DELETE_WINDOW = XInternAtom(disp, "WM_DELETE_WINDOW", 0);
 	}
 
-	colormap = DefaultColormap(disp, DefaultScreen(disp));
-
-	/* Initialize color */
-	blackpixel = BlackPixel(disp, DefaultScreen(disp));
-	whitepixel = WhitePixel(disp, DefaultScreen(disp));
-
 	/* Initialize lpCmdLine. */
 	for (i=0; i < argc; i++) {
 		length += strlen(argv[i]);
@@ -120,14 +303,7 @@ main(int argc, char *argv[])
 	}
 	lpCmdLine[length] = '\0';
 
-	/* Capture the WM_DELETE_WINDOW atom, if it exists. We'll use this later
-	 * to tell the window manager that we're interested in handling the
-	 * close/delete events for top level windows */
-	WM_DELETE_WINDOW = XInternAtom(disp, "WM_DELETE_WINDOW", 0);
-	ctxt = XUniqueContext();
-
-	TAILQ_INIT(&g_msg_queue);
-	TAILQ_INIT(&g_paint_queue);
+	w32x_current_thread();
 
 	/* Register built in classes. */
 	RegisterClass(&ButtonClass);
@@ -141,67 +317,6 @@ main(int argc, char *argv[])
 	return result;
 }
 
-WndClass *get_class_by_name(const char *name)
-{
-	WndClass *wc;
-
-	/* Iterate through list of window classes to see if this
-	 * class has already been registered. */
-	for (wc = class_list; wc != NULL; wc = wc->next) {
-		if (strcmp(wc->name, name) == 0) {
-			return wc;
-		}
-	}
-
-	return NULL;
-}
-
-int
-RegisterClass(WNDCLASS *wndClass)
-{
-	WndClass *wc;
-	XColor back_col;
-	char rgb_template[13];
-	COLORREF cr;
-
-	if (wndClass == NULL)
-		return -1;
-
-	wc = get_class_by_name(wndClass->lpszClassName);
-	if (wc != NULL) {
-		/* Already registered */
-		return 1;
-	}
-
-	if (wndClass->hbrBackground >= (HBRUSH)(COLOR_SCROLLBAR + 1) &&
-	    wndClass->hbrBackground <= (HBRUSH)(COLOR_MENUBAR + 1)) {
-		cr = GetSysColor(((long)wndClass->hbrBackground) - 1);
-	} else {
-		LOGBRUSH lb;
-
-		GetObject(wndClass->hbrBackground, sizeof(LOGBRUSH), &lb);
-		cr = lb.lbColor;
-	}
-
-	snprintf(rgb_template, sizeof(rgb_template), "rgb:%02x/%02x/%02x",
-	    (cr & 0xff), ((cr & 0xffff) >> 8) & 0xff, (cr >> 16) & 0xff);
-	/* Lookup colors */
-	XParseColor(disp, colormap, rgb_template, &back_col);
-	XAllocColor(disp, colormap, &back_col);
-
-	/* Register a new class */
-	wc = calloc(1, sizeof(WndClass));
-	wc->name = strdup(wndClass->lpszClassName);
-	wc->border_pixel = blackpixel;
-	wc->background_pixel = back_col.pixel;
-	wc->wndExtra = wndClass->cbWndExtra;
-	wc->proc = wndClass->lpfnWndProc;
-	wc->next = class_list;
-	class_list = wc;
-
-	return 0;
-}
-
 void
 ShowWindow(HWND wnd, int nCmdShow)
 {
@@ -218,11 +333,41 @@ ShowWindow(HWND wnd, int nCmdShow)
 	}
 }
 
+/* Whether a message for wnd has to go through its owner's queue */
+static BOOL
+other_thread(HWND wnd)
+{
+	return wnd != NULL && wnd->owner != self;
+}
+
+static LRESULT
+destroy_window(HWND wnd, WPARAM wParam, LPARAM lParam)
+{
+	DestroyWindow(wnd);
+	return 0;
+}
+
 void
 DestroyWindow(HWND wnd)
 {
+	if (other_thread(wnd)) {
+		w32x_call_owner(wnd, destroy_window, 0, 0);
+		return;
+	}
+
 	SendMessage(wnd, WM_DESTROY, 0, 0);
 
+	w32x_unqueue_paint(wnd);
+	w32x_timer_forget_window(wnd);
+	w32x_dc_flush(wnd->hdc);
+	if (wnd->backbuf != None) {
+		w32x_dc_forget_drawable(wnd->hdc, wnd->backbuf);
+		XFreePixmap(disp, wnd->backbuf);
+		wnd->backbuf = None;
+	}
+
+	w32x_dc_forget_drawable(wnd->hdc, wnd->window);
+	w32x_wndmap_remove(wnd->window);
 	XDestroyWindow(disp, wnd->window);
 }
 
@@ -232,6 +377,12 @@ SetLastError(DWORD err)
   last_error = err;
 }
 
+DWORD
+GetLastError(void)
+{
+  return last_error;
+}
+
 void
 SetWindowName(HWND wnd, const char *name)
 {
@@ -253,8 +404,8 @@ GetWindowText(HWND wnd, char *lpString, int nMaxCount)
 	return strlen(lpString);
 }
 
-int
-SendMessage(HWND wnd, unsigned int msg, WPARAM wParam, LPARAM lParam)
+static LRESULT
+call_proc(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
 	WNDPROC proc = (wnd == NULL || wnd->proc == NULL)
 	    ? DefWindowProc : wnd->proc;
@@ -262,27 +413,542 @@ SendMessage(HWND wnd, unsigned int msg, WPARAM wParam, LPARAM lParam)
 	return proc(wnd, msg, wParam, lParam);
 }
 
+/*
+ * Window procedures only run on the thread owning the window. Other
+ * threads hand the message over and, unless they only notify, wait for
+ * the result.
+ */
+static struct w32x_sent *
+sent_alloc(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam, int refs)
+{
+	struct w32x_sent *node;
+
+	if ((node = malloc(sizeof(*node))) == NULL) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return NULL;
+	}
+	node->hwnd = wnd;
+	node->message = msg;
+	node->wParam = wParam;
+	node->lParam = lParam;
+	node->heap = TRUE;
+	node->reply_to = self != NULL ? &self->postq : NULL;
+	node->call = NULL;
+	atomic_init(&node->refs, refs);
+	return node;
+}
+
+/* Hand a message or call to the owner of wnd and wait for its result */
+static LRESULT
+send_wait(HWND wnd, UINT msg, LRESULT (*call)(HWND, WPARAM, LPARAM),
+    WPARAM wParam, LPARAM lParam)
+{
+	struct w32x_sent node;
+	LRESULT result = 0;
+
+	if (!IsWindow(wnd)) {
+		SetLastError(ERROR_INVALID_WINDOW_HANDLE);
+		return 0;
+	}
+	node.hwnd = wnd;
+	node.message = msg;
+	node.wParam = wParam;
+	node.lParam = lParam;
+	node.heap = FALSE;
+	node.reply_to = self != NULL ? &self->postq : NULL;
+	node.call = call;
+	w32x_sent_push(&wnd->owner->postq, &node);
+	w32x_sent_wait(&node, -1, &result);
+	return result;
+}
+
+LRESULT
+SendMessage(HWND wnd, unsigned int msg, WPARAM wParam, LPARAM lParam)
+{
+	if (!other_thread(wnd))
+		return call_proc(wnd, msg, wParam, lParam);
+	return send_wait(wnd, msg, NULL, wParam, lParam);
+}
+
+/*
+ * The update region, paint queue entry, timers and pending drawing of a
+ * window belong to the thread that owns it. Calls changing them from
+ * other threads are run there instead, the caller waiting as it would in
+ * SendMessage.
+ */
+LRESULT
+w32x_call_owner(HWND wnd, LRESULT (*call)(HWND, WPARAM, LPARAM),
+    WPARAM wParam, LPARAM lParam)
+{
+	if (!other_thread(wnd))
+		return call(wnd, wParam, lParam);
+	return send_wait(wnd, 0, call, wParam, lParam);
+}
+
+/*
+ * SendMessage that gives up after uTimeout ms. The message is still
+ * handled if the UI thread gets to it later. fuFlags is ignored, the UI
+ * thread is never considered hung.
+ */
+LRESULT
+SendMessageTimeout(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam,
+    UINT fuFlags, UINT uTimeout, PDWORD_PTR lpdwResult)
+{
+	struct w32x_sent *node;
+	LRESULT result;
+
+	if (!IsWindow(wnd)) {
+		SetLastError(ERROR_INVALID_WINDOW_HANDLE);
+		return 0;
+	}
+
+	if (!other_thread(wnd)) {
+		result = call_proc(wnd, msg, wParam, lParam);
+	} else {
+		/* One reference for the sender, one for the receiver */
+		if ((node = sent_alloc(wnd, msg, wParam, lParam, 2)) == NULL)
+			return 0;
+		w32x_sent_push(&wnd->owner->postq, node);
+		if (!w32x_sent_wait(node,
+		    uTimeout > INT32_MAX ? -1 : (int)uTimeout, &result)) {
+			SetLastError(ERROR_TIMEOUT);
+			return 0;
+		}
+	}
+	if (lpdwResult != NULL)
+		*lpdwResult = result;
+	return 1;
+}
+
+/* Send without waiting for the result when called from another thread */
+BOOL
+SendNotifyMessage(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+	struct w32x_sent *node;
+
+	if (!IsWindow(wnd)) {
+		SetLastError(ERROR_INVALID_WINDOW_HANDLE);
+		return FALSE;
+	}
+
+	if (!other_thread(wnd)) {
+		call_proc(wnd, msg, wParam, lParam);
+		return TRUE;
+	}
+	if ((node = sent_alloc(wnd, msg, wParam, lParam, 1)) == NULL)
+		return FALSE;
+	w32x_sent_push(&wnd->owner->postq, node);
+	return TRUE;
+}
+
+/* Run the window procedures for messages other threads sent. */
+void
+w32x_dispatch_sent(void)
+{
+	struct w32x_sent *node, *next;
+	LRESULT result;
+
+	while ((node = w32x_sent_take(&w32x_current_thread()->postq)) !=
+	    NULL) {
+		for (; node != NULL; node = next) {
+			/* The node may be gone once it is complete */
+			next = node->next;
+			if (!IsWindow(node->hwnd))
+				result = 0;
+			else if (node->call != NULL)
+				result = node->call(node->hwnd, node->wParam,
+				    node->lParam);
+			else
+				result = call_proc(node->hwnd, node->message,
+				    node->wParam, node->lParam);
+			w32x_sent_complete(node, result);
+		}
+	}
+}
+
 void *GetWindowLongPtr(HWND wnd, int nIndex)
 {
 	return wnd->wndExtra;
 }
 
+static unsigned int
+msg_ring_count(const struct msg_ring *q)
+{
+	return q->tail - q->head;
+}
+
+static BOOL
+msg_ring_grow(struct msg_ring *q)
+{
+	unsigned int i, count, size;
+	MSG *slots;
+
+	size = q->slots == NULL ? MSG_RING_INITIAL : (q->mask + 1) * 2;
+	slots = malloc(size * sizeof(MSG));
+	if (slots == NULL)
+		return FALSE;
+
+	/* Unwrap the old contents to the front of the new ring */
+	count = msg_ring_count(q);
+	for (i = 0; i < count; i++)
+		slots[i] = q->slots[(q->head + i) & q->mask];
+
+	free(q->slots);
+	q->slots = slots;
+	q->mask = size - 1;
+	q->head = 0;
+	q->tail = count;
+	return TRUE;
+}
+
+static BOOL
+msg_ring_push(struct msg_ring *q, HWND hwnd, UINT message, WPARAM wParam,
+    LPARAM lParam)
+{
+	MSG *slot;
+
+	if (q->slots == NULL || msg_ring_count(q) > q->mask) {
+		if (!msg_ring_grow(q))
+			return FALSE;
+	}
+
+	slot = &q->slots[q->tail & q->mask];
+	slot->hwnd = hwnd;
+	slot->message = message;
+	slot->wParam = wParam;
+	slot->lParam = lParam;
+	q->tail++;
+	return TRUE;
+}
+
+/* Queue a message ahead of everything else. */
+static BOOL
+msg_ring_push_front(struct msg_ring *q, HWND hwnd, UINT message,
+    WPARAM wParam, LPARAM lParam)
+{
+	MSG *slot;
+
+	if (q->slots == NULL || msg_ring_count(q) > q->mask) {
+		if (!msg_ring_grow(q))
+			return FALSE;
+	}
+
+	q->head--;
+	slot = &q->slots[q->head & q->mask];
+	slot->hwnd = hwnd;
+	slot->message = message;
+	slot->wParam = wParam;
+	slot->lParam = lParam;
+	return TRUE;
+}
+
+/* Remove the n-th queued message, closing the gap it leaves. */
+static void
+msg_ring_remove(struct msg_ring *q, unsigned int n)
+{
+	unsigned int i;
+
+	if (n == 0) {
+		q->head++;
+		return;
+	}
+	for (i = q->head + n; i + 1 != q->tail; i++)
+		q->slots[i & q->mask] = q->slots[(i + 1) & q->mask];
+	q->tail--;
+}
+
+static BOOL
+msg_filter_match(const MSG *msg, HWND hwnd, UINT wMsgFilterMin,
+    UINT wMsgFilterMax)
+{
+	if (hwnd != NULL && msg->hwnd != hwnd)
+		return FALSE;
+	if (wMsgFilterMin == 0 && wMsgFilterMax == 0)
+		return TRUE;
+	return msg->message >= wMsgFilterMin && msg->message <= wMsgFilterMax;
+}
+
+DWORD
+GetCurrentThreadId(void)
+{
+	return (DWORD)syscall(SYS_gettid);
+}
+
+/* Queue a message for thread t from any thread. */
+static BOOL
+post_message(struct w32x_thread *t, HWND hwnd, UINT msg, WPARAM wParam,
+    LPARAM lParam)
+{
+	if (t != self) {
+		if (!w32x_postq_push(&t->postq, hwnd, msg, wParam, lParam)) {
+			SetLastError(w32x_postq_closed(&t->postq) ?
+			    ERROR_INVALID_THREAD_ID : ERROR_NOT_ENOUGH_QUOTA);
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	if (!msg_ring_push(&g_msg_queue, hwnd, msg, wParam, lParam)) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+BOOL
+PostMessage(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+	if (hwnd != NULL && !IsWindow(hwnd)) {
+		SetLastError(ERROR_INVALID_WINDOW_HANDLE);
+		return FALSE;
+	}
+	/* Without a window the message is for the calling thread */
+	return post_message(hwnd != NULL ? hwnd->owner :
+	    w32x_current_thread(), hwnd, msg, wParam, lParam);
+}
+
+BOOL
+PostThreadMessage(DWORD idThread, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+	struct w32x_thread *t;
+
+	w32x_lock();
+	LIST_FOREACH(t, &threads, entries) {
+		if (t->id == idThread)
+			break;
+	}
+	w32x_unlock();
+
+	if (t == NULL) {
+		SetLastError(ERROR_INVALID_THREAD_ID);
+		return FALSE;
+	}
+	return post_message(t, NULL, msg, wParam, lParam);
+}
+
+/* Move messages other threads posted into the message ring. */
+static void
+drain_posted(void)
+{
+	struct w32x_postq *q = &w32x_current_thread()->postq;
+	MSG msg;
+
+	while (w32x_postq_pop(q, &msg)) {
+		if (!msg_ring_push(&g_msg_queue, msg.hwnd, msg.message,
+		    msg.wParam, msg.lParam))
+			fprintf(stderr, "XXX: Out of memory for messages\n");
+	}
+}
+
+/* Mark a window as needing a WM_PAINT. */
+void
+w32x_queue_paint(Wnd *wnd)
+{
+	if (wnd->paint.queued)
+		return;
+
+	wnd->paint.wnd = wnd;
+	wnd->paint.queued = TRUE;
+	TAILQ_INSERT_TAIL(&g_paint_queue, &wnd->paint, entries);
+}
+
+void
+w32x_unqueue_paint(Wnd *wnd)
+{
+	if (!wnd->paint.queued)
+		return;
+
+	TAILQ_REMOVE(&g_paint_queue, &wnd->paint, entries);
+	wnd->paint.queued = FALSE;
+}
+
+/* Like Win32, WM_QUIT is not queued; it is returned once the queue has
+ * been emptied. */
 void PostQuitMessage(int nExitCode)
 {
-	struct msgq_entry *q_msg;
+	quit_posted = TRUE;
+	quit_code = nExitCode;
+}
 
-	q_msg = malloc(sizeof(struct msgq_entry));
-	q_msg->msg.message = WM_QUIT;
+/*
+ * X event compression.
+ *
+ * Everything Xlib has read is drained into a batch, and the batch is
+ * walked backwards once before any of it is translated, so each rule
+ * knows whether a later event for the same window supersedes an earlier
+ * one:
+ *
+ * - a run of MotionNotify events with the same button state, not broken
+ *   by another event for the window, is reduced to its last event;
+ * - ConfigureNotify events fold into the first of them, which takes the
+ *   final size, so later events in the batch see the window at its new
+ *   size.
+ *
+ * Expose rectangles always merge into the window's update region and
+ * produce a single WM_PAINT, which is how Win32 paints as well; the stats
+ * only count them. The motion and configure rules can be turned off per
+ * window with SetWindowEventCompression.
+ */
+static __thread XEvent *batch;
+static __thread Wnd **batch_wnd;
+static __thread int batch_size;
+static __thread unsigned int batch_serial;
+static __thread EVENTCOMPRESSIONSTATS compression_stats;
+
+#define XEVENT_DROPPED 0 /* not a valid event type */
 
-	TAILQ_INSERT_TAIL(&g_msg_queue, q_msg, entries);
+static BOOL
+batch_reserve(int n)
+{
+	XEvent *events;
+	Wnd **wnds;
+
+	if (n <= batch_size)
+		return TRUE;
+	if (n < batch_size * 2)
+		n = batch_size * 2;
+	if ((events = realloc(batch, n * sizeof(XEvent))) == NULL)
+		return FALSE;
+	batch = events;
+	if ((wnds = realloc(batch_wnd, n * sizeof(Wnd *))) == NULL)
+		return FALSE;
+	batch_wnd = wnds;
+	batch_size = n;
+	return TRUE;
 }
 
-static void translate_xevent_to_msg(XEvent *e, LPMSG msg)
+static void
+batch_compress(int n)
 {
-	RECT r;
-	Wnd *win = NULL;
+	XEvent *e;
+	Wnd *win;
+	int i;
+
+	batch_serial++;
+	for (i = n - 1; i >= 0; i--) {
+		e = &batch[i];
+		if ((win = batch_wnd[i]) == NULL)
+			continue;
+		if (win->cmp_batch != batch_serial) {
+			win->cmp_batch = batch_serial;
+			win->cmp_motion = -1;
+			win->cmp_configure = -1;
+			win->cmp_exposed = FALSE;
+		}
 
-	XFindContext(e->xany.display, e->xany.window, ctxt, (XPointer *)&win);
+		switch (e->type) {
+		case MotionNotify:
+			if ((win->compress & ECF_MOTION) &&
+			    win->cmp_motion != -1 &&
+			    batch[win->cmp_motion].xmotion.state ==
+			    e->xmotion.state) {
+				e->type = XEVENT_DROPPED;
+				compression_stats.dwMotionDropped++;
+				continue;
+			}
+			win->cmp_motion = i;
+			continue;
+		case ConfigureNotify:
+			if ((win->compress & ECF_CONFIGURE) &&
+			    win->cmp_configure != -1) {
+				XConfigureEvent *later =
+				    &batch[win->cmp_configure].xconfigure;
+
+				e->xconfigure.width = later->width;
+				e->xconfigure.height = later->height;
+				if (later->send_event) {
+					/* MOVE */
+					e->xconfigure.x = later->x;
+					e->xconfigure.y = later->y;
+				}
+				later->type = XEVENT_DROPPED;
+				compression_stats.dwConfigureFolded++;
+			}
+			win->cmp_configure = i;
+			break;
+		case Expose:
+			if (win->cmp_exposed)
+				compression_stats.dwExposeMerged++;
+			win->cmp_exposed = TRUE;
+			break;
+		default:
+			break;
+		}
+		/* Anything else for the window ends a motion run */
+		win->cmp_motion = -1;
+	}
+}
+
+/*
+ * Choose which compression rules (ECF_MOTION, ECF_CONFIGURE) apply to
+ * the X events of a window. All of them do by default.
+ */
+BOOL
+SetWindowEventCompression(HWND hwnd, DWORD flags)
+{
+	if (!IsWindow(hwnd)) {
+		SetLastError(ERROR_INVALID_WINDOW_HANDLE);
+		return FALSE;
+	}
+	hwnd->compress = flags & ECF_ALL;
+	return TRUE;
+}
+
+/* Totals of events each compression rule has removed from the calling
+ * thread's input */
+BOOL
+GetEventCompressionStats(EVENTCOMPRESSIONSTATS *stats)
+{
+	if (stats == NULL) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	*stats = compression_stats;
+	return TRUE;
+}
+
+/* Mouse buttons 1-3 and the wheel, which X reports as buttons 4-7 */
+static void
+translate_button(const XButtonEvent *e, LPMSG msg)
+{
+	static const struct {
+		UINT down, up;
+		unsigned int mask;
+	} buttons[] = {
+		{ WM_LBUTTONDOWN, WM_LBUTTONUP, Button1Mask },
+		{ WM_MBUTTONDOWN, WM_MBUTTONUP, Button2Mask },
+		{ WM_RBUTTONDOWN, WM_RBUTTONUP, Button3Mask },
+	};
+	BOOL down = e->type == ButtonPress;
+	unsigned int state = e->state;
+	short delta;
+
+	if (e->button >= 1 && e->button <= 3) {
+		/* X reports the state from before the event, Win32 from
+		 * after it */
+		if (down)
+			state |= buttons[e->button - 1].mask;
+		else
+			state &= ~buttons[e->button - 1].mask;
+		msg->message = down ? buttons[e->button - 1].down :
+		    buttons[e->button - 1].up;
+		msg->wParam = w32x_mouse_keys(state);
+		msg->lParam = MAKELPARAM(e->x, e->y);
+	} else if (down && e->button >= 4 && e->button <= 7) {
+		/* Up and left are 4 and 6, the wheel position is in screen
+		 * coordinates */
+		delta = (e->button & 1) ? -WHEEL_DELTA : WHEEL_DELTA;
+		if (e->button >= 6)
+			delta = -delta;
+		msg->message = e->button <= 5 ? WM_MOUSEWHEEL : WM_MOUSEHWHEEL;
+		msg->wParam = MAKEWPARAM(w32x_mouse_keys(state), delta);
+		msg->lParam = MAKELPARAM(e->x_root, e->y_root);
+	}
+}
+
+static void translate_xevent_to_msg(XEvent *e, Wnd *win, LPMSG msg)
+{
+	RECT r;
 
 	msg->hwnd = win;
 
@@ -294,23 +960,36 @@ static void translate_xevent_to_msg(XEvent *e, LPMSG msg)
 		// Nothing to do for this event.
 		break;
 	case ConfigureNotify:
-		// What do we do for this?
+		if (win == NULL)
+			break;
+		if (e->xconfigure.width != win->width ||
+		    e->xconfigure.height != win->height) {
+			win->width = e->xconfigure.width;
+			win->height = e->xconfigure.height;
+			/* Resize the back buffer on the next paint */
+			win->backbuf_stale = TRUE;
+			/* The menu bar spans the window */
+			if (win->menubar != NULL && win->width > 0) {
+				XResizeWindow(disp, win->menubar->window,
+				    win->width, win->menubar->height);
+			}
+		}
 		msg->message = WM_SIZE;
 		msg->wParam = 0;
+		msg->lParam = MAKELPARAM(win->width, win->height);
 		break;
-	case ButtonPress:
-		if (e->xbutton.button == 1) {
-			msg->message = WM_LBUTTONDOWN;
-			msg->wParam = 0;
-			msg->lParam = 0;
-		}
+	case MotionNotify:
+		msg->message = WM_MOUSEMOVE;
+		msg->wParam = w32x_mouse_keys(e->xmotion.state);
+		msg->lParam = MAKELPARAM(e->xmotion.x, e->xmotion.y);
 		break;
+	case ButtonPress:
 	case ButtonRelease:
-		if (e->xbutton.button == 1) {
-			msg->message = WM_LBUTTONUP;
-			msg->wParam = 0;
-			msg->lParam = 0;
-		}
+		translate_button(&e->xbutton, msg);
+		break;
+	case KeyPress:
+	case KeyRelease:
+		w32x_keyboard_translate(&e->xkey, msg);
 		break;
 	case Expose:
 		/*
@@ -329,16 +1008,9 @@ static void translate_xevent_to_msg(XEvent *e, LPMSG msg)
 		if (r.bottom < 0)
 			r.bottom = 0;
 
+		/* Only accumulate the damage; GetMessage hands out a single
+		 * WM_PAINT once the rest of the queue is empty. */
 		InvalidateRect(msg->hwnd, &r, TRUE);
-		if (e->xexpose.count == 0) {
-#if 0
-			/* Don't bubble this up, instead put it in a queue */
-			msg->message = WM_PAINT;
-			msg->wParam = 0;
-			msg->lParam = 0;
-#endif
-			UpdateWindow(msg->hwnd);
-		}
 		break;
 	case ClientMessage:
 		if (e->xclient.format == 32 && e->xclient.data.l[0] == WM_DELETE_WINDOW) {
@@ -355,127 +1027,489 @@ static void translate_xevent_to_msg(XEvent *e, LPMSG msg)
 	}
 }
 
-static void w32x_process_xevent(LPMSG msg)
+static struct async_fd *
+async_fd_find(int fd)
 {
-	XEvent event;
+	struct async_fd *afd;
 
-	XNextEvent(disp, &event);
+	TAILQ_FOREACH(afd, &g_async_fds, entries) {
+		if (afd->fd == fd)
+			return afd;
+	}
+	return NULL;
+}
 
-	/* Compress configure events */
-	if (event.xany.type == ConfigureNotify) {
-		XEvent e;
+static uint32_t
+async_fd_epoll_events(long events)
+{
+	uint32_t ev = EPOLLONESHOT;
+
+	if (events & FD_READ)
+		ev |= EPOLLIN;
+	if (events & FD_WRITE)
+		ev |= EPOLLOUT;
+	if (events & FD_CLOSE)
+		ev |= EPOLLRDHUP;
+	return ev;
+}
 
-		while (XCheckTypedWindowEvent(disp, event.xconfigure.window,
-		    ConfigureNotify, &e)) {
-			event.xconfigure.width = e.xconfigure.width;
-			event.xconfigure.height = e.xconfigure.height;
-			if (e.xconfigure.send_event) {
-				/* MOVE */
-				event.xconfigure.x = e.xconfigure.x;
-				event.xconfigure.y = e.xconfigure.y;
-			}
+/* Re-enable notifications for an fd once its message was retrieved. The
+ * fd is registered one-shot so a caller that has not yet read from it does
+ * not make every wait return immediately. */
+static void
+async_fd_rearm(struct async_fd *afd)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = async_fd_epoll_events(afd->events);
+	ev.data.ptr = afd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, afd->fd, &ev);
+}
+
+static void
+async_fd_signal(struct async_fd *afd, uint32_t events)
+{
+	long revents = 0;
+
+	if (events & (EPOLLIN | EPOLLERR))
+		revents |= FD_READ;
+	if (events & EPOLLOUT)
+		revents |= FD_WRITE;
+	if (events & (EPOLLRDHUP | EPOLLHUP))
+		revents |= FD_CLOSE;
+
+	afd->revents = revents & afd->events;
+	if (afd->revents == 0) {
+		async_fd_rearm(afd);
+		return;
+	}
+	if (!afd->ready) {
+		afd->ready = TRUE;
+		TAILQ_INSERT_TAIL(&g_ready_fds, afd, ready_entries);
+	}
+}
+
+/*
+ * Requests a window message whenever one of the lEvent conditions is met
+ * on the file descriptor s. The message arrives with wParam set to the fd
+ * and the low word of lParam set to the FD_* events that fired. Only one
+ * message per fd is outstanding at a time. An lEvent of 0 cancels the
+ * registration.
+ */
+int
+WSAAsyncSelect(int s, HWND hwnd, UINT wMsg, long lEvent)
+{
+	struct async_fd *afd;
+	struct epoll_event ev;
+	int op;
+
+	/* The fd is watched by the calling thread's queue */
+	w32x_current_thread();
+	afd = async_fd_find(s);
+
+	if (lEvent == 0) {
+		if (afd == NULL)
+			return 0;
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s, NULL);
+		if (afd->ready)
+			TAILQ_REMOVE(&g_ready_fds, afd, ready_entries);
+		TAILQ_REMOVE(&g_async_fds, afd, entries);
+		free(afd);
+		return 0;
+	}
+
+	if (afd == NULL) {
+		afd = calloc(1, sizeof(struct async_fd));
+		if (afd == NULL)
+			return -1;
+		afd->fd = s;
+		op = EPOLL_CTL_ADD;
+	} else {
+		op = EPOLL_CTL_MOD;
+	}
+	afd->hwnd = hwnd;
+	afd->msg = wMsg;
+	afd->events = lEvent;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = async_fd_epoll_events(lEvent);
+	ev.data.ptr = afd;
+	if (epoll_ctl(epoll_fd, op, s, &ev) == -1) {
+		if (op == EPOLL_CTL_ADD)
+			free(afd);
+		return -1;
+	}
+	if (op == EPOLL_CTL_ADD)
+		TAILQ_INSERT_TAIL(&g_async_fds, afd, entries);
+
+	return 0;
+}
+
+/* Hand an event for one of its windows to another thread. */
+static void
+inbox_push(struct w32x_thread *t, const XEvent *e)
+{
+	XEvent *inbox;
+	unsigned int size;
+
+	pthread_mutex_lock(&t->inbox_lock);
+	if (w32x_postq_closed(&t->postq)) {
+		/* The window has gone with its thread */
+		pthread_mutex_unlock(&t->inbox_lock);
+		return;
+	}
+	if (t->inbox_count == t->inbox_size) {
+		size = t->inbox_size == 0 ? 64 : t->inbox_size * 2;
+		if ((inbox = realloc(t->inbox, size * sizeof(XEvent))) == NULL) {
+			pthread_mutex_unlock(&t->inbox_lock);
+			fprintf(stderr, "XXX: Out of memory for X events\n");
+			return;
 		}
+		t->inbox = inbox;
+		t->inbox_size = size;
 	}
+	t->inbox[t->inbox_count++] = *e;
+	pthread_mutex_unlock(&t->inbox_lock);
+	w32x_postq_wake(&t->postq);
+}
 
-	/* Process events */
-	translate_xevent_to_msg(&event, msg);
+static unsigned int
+inbox_count(struct w32x_thread *t)
+{
+	unsigned int n;
+
+	pthread_mutex_lock(&t->inbox_lock);
+	n = t->inbox_count;
+	pthread_mutex_unlock(&t->inbox_lock);
+	return n;
 }
 
-BOOL GetMessage(LPMSG msg, HWND wnd, UINT wMsgFilterMin, UINT wMsgFilterMax)
+/* Add an event for one of our windows to the batch */
+static void
+batch_add_event(int *n, const XEvent *e, Wnd *wnd)
 {
-	struct msgq_entry *q_msg;
-	struct paint_entry *q_paint;
-	int x_fd, fds, nf;
-	fd_set readset;
-	struct timeval tmout, *tptr;
+	if (!batch_reserve(*n + 1)) {
+		fprintf(stderr, "XXX: Out of memory for X events\n");
+		return;
+	}
+	batch[*n] = *e;
+	batch_wnd[*n] = wnd;
+	(*n)++;
+}
 
-	msg->message = 0;
+static BOOL
+queue_has_input(void)
+{
+	struct w32x_thread *t = w32x_current_thread();
 
-	/* Something waiting, handle right away */
-	if (XPending(disp)) {
-		w32x_process_xevent(msg);
-		if (msg->message != 0) {
-			return TRUE;
-		}
+	drain_posted();
+	return w32x_sent_pending(&t->postq) || inbox_count(t) != 0 ||
+	    (disp != NULL && XEventsQueued(disp, QueuedAlready)) ||
+	    msg_ring_count(&g_msg_queue) != 0 || !TAILQ_EMPTY(&g_ready_fds) ||
+	    !TAILQ_EMPTY(&g_paint_queue) || quit_posted || w32x_timer_ready();
+}
+
+/*
+ * Blocks in a single epoll_wait until the X connection or a registered fd
+ * becomes ready, or the timeout (in ms, -1 for none) expires. Returns the
+ * epoll_wait result.
+ */
+static int
+w32x_wait(int timeout)
+{
+	struct epoll_event events[W32X_MAX_EVENTS];
+	struct async_fd *afd;
+	int i, nf;
+
+	/* Push out pending requests before going to sleep; the reply may be
+	 * what we are waiting for. Flushing can also read events. */
+	w32x_gdi_flush_all();
+	if (disp != NULL) {
+		XFlush(disp);
+		if (XEventsQueued(disp, QueuedAlready))
+			return 1;
 	}
 
-	/* Do a quick poll */
-	x_fd = ConnectionNumber(disp);
-	fds = x_fd + 1;
+	nf = epoll_wait(epoll_fd, events, W32X_MAX_EVENTS, timeout);
+	for (i = 0; i < nf; i++) {
+		afd = events[i].data.ptr;
+		if (afd == NULL) {
+			XEventsQueued(disp, QueuedAfterReading);
+		} else if (events[i].data.ptr == &postq_wake) {
+			w32x_postq_ack(&self->postq);
+		} else {
+			async_fd_signal(afd, events[i].events);
+		}
+	}
+	return nf;
+}
 
-	FD_ZERO(&readset);
-	FD_SET(x_fd, &readset);
+/*
+ * Queue a message translated from an X event. A WM_MOUSEMOVE replaces one
+ * still waiting at the end of the queue for the same window and keys, so
+ * the window procedure never falls behind the pointer.
+ */
+static void
+post_input(const MSG *msg)
+{
+	struct msg_ring *q = &g_msg_queue;
+	MSG *last;
+
+	if (msg->message == WM_MOUSEMOVE &&
+	    (msg->hwnd->compress & ECF_MOTION) && msg_ring_count(q) != 0) {
+		last = &q->slots[(q->tail - 1) & q->mask];
+		if (last->message == WM_MOUSEMOVE && last->hwnd == msg->hwnd &&
+		    last->wParam == msg->wParam) {
+			last->lParam = msg->lParam;
+			compression_stats.dwMotionDropped++;
+			return;
+		}
+	}
+	msg_ring_push(q, msg->hwnd, msg->message, msg->wParam, msg->lParam);
+}
 
-	tmout.tv_sec = tmout.tv_usec = 0;
-	nf = select(fds, &readset, NULL, NULL, &tmout);
-	if (nf <= 0) {
-		FD_ZERO(&readset);
+/*
+ * Translate every event Xlib has already read for our windows into the
+ * posted queue, and pass the others on to the threads owning them.
+ */
+static void
+w32x_pump_xevents(void)
+{
+	struct w32x_thread *t = w32x_current_thread();
+	XEvent e;
+	MSG msg;
+	Wnd *wnd;
+	int i, n = 0;
+	unsigned int j;
+
+	pthread_mutex_lock(&xevent_lock);
+
+	/* Events other threads read for us first, they are older. The
+	 * window may have gone in the meantime. */
+	pthread_mutex_lock(&t->inbox_lock);
+	for (j = 0; j < t->inbox_count; j++) {
+		wnd = w32x_wndmap_lookup(t->inbox[j].xany.window);
+		if (wnd != NULL)
+			batch_add_event(&n, &t->inbox[j], wnd);
+	}
+	t->inbox_count = 0;
+	pthread_mutex_unlock(&t->inbox_lock);
+
+	while (disp != NULL && XEventsQueued(disp, QueuedAlready) > 0) {
+		XNextEvent(disp, &e);
+		if (e.type == MotionNotify)
+			w32x_mouse_record(&e.xmotion);
+		else if (e.type == MappingNotify)
+			w32x_keyboard_mapping(&e.xmapping);
+		/* Drop events for windows that are not (or no longer)
+		 * ours */
+		if ((wnd = w32x_wndmap_lookup(e.xany.window)) == NULL)
+			continue;
+		if (wnd->owner != t)
+			inbox_push(wnd->owner, &e);
+		else
+			batch_add_event(&n, &e, wnd);
 	}
+	pthread_mutex_unlock(&xevent_lock);
 
-	while (1) {
+	if (n > 0) {
+		batch_compress(n);
 
-		if ((nf > 0) || ((nf == -1) && (errno == EINTR))) {
-			if (FD_ISSET(x_fd, &readset)) {
-				w32x_process_xevent(msg);
-				if (msg->message != 0) {
-					return TRUE;
-				}
+		for (i = 0; i < n; i++) {
+			if (batch_wnd[i] == NULL ||
+			    batch[i].type == XEVENT_DROPPED)
 				continue;
-			} else {
-//				return TRUE;
-			}
+			memset(&msg, 0, sizeof(msg));
+			translate_xevent_to_msg(&batch[i], batch_wnd[i], &msg);
+			if (msg.message != 0)
+				post_input(&msg);
 		}
+	}
+}
 
-		/* Anything in the queue? */
-		q_msg = TAILQ_FIRST(&g_msg_queue);
-		if (q_msg != NULL) {
-			if (q_msg->msg.message == WM_QUIT) {
-				free(q_msg);
-				return FALSE;
-			}
+static BOOL
+w32x_peek_message(LPMSG msg, HWND hwnd, UINT wMsgFilterMin,
+    UINT wMsgFilterMax, UINT wRemoveMsg)
+{
+	struct msg_ring *q = &g_msg_queue;
+	static const MSG paint_msg = { NULL, WM_PAINT, 0, 0 };
+	static const MSG timer_msg = { NULL, WM_TIMER, 0, 0 };
+	struct paint_entry *q_paint;
+	struct async_fd *afd;
+	unsigned int i, count;
+	MSG *slot;
+
+	/* Sent messages are handled here rather than returned */
+	w32x_dispatch_sent();
+	w32x_pump_xevents();
+	drain_posted();
+
+	/* Anything in the queue? */
+	count = msg_ring_count(q);
+	for (i = 0; i < count; i++) {
+		slot = &q->slots[(q->head + i) & q->mask];
+		if (!msg_filter_match(slot, hwnd, wMsgFilterMin,
+		    wMsgFilterMax))
+			continue;
 
-			TAILQ_REMOVE(&g_msg_queue, q_msg, entries);
-			msg->hwnd = q_msg->msg.hwnd;
-			msg->message = q_msg->msg.message;
-			msg->lParam = q_msg->msg.lParam;
-			msg->wParam = q_msg->msg.wParam;
-			free(q_msg);
-			return TRUE;
+		*msg = *slot;
+		if (wRemoveMsg & PM_REMOVE)
+			msg_ring_remove(q, i);
+		return TRUE;
+	}
+
+	/* Any application fds ready? */
+	TAILQ_FOREACH(afd, &g_ready_fds, ready_entries) {
+		msg->hwnd = afd->hwnd;
+		msg->message = afd->msg;
+		msg->wParam = afd->fd;
+		msg->lParam = afd->revents;
+		if (!msg_filter_match(msg, hwnd, wMsgFilterMin, wMsgFilterMax))
+			continue;
+
+		if (wRemoveMsg & PM_REMOVE) {
+			TAILQ_REMOVE(&g_ready_fds, afd, ready_entries);
+			afd->ready = FALSE;
+			async_fd_rearm(afd);
 		}
+		return TRUE;
+	}
 
-		/* Anything in the paint queue? */
+	/* Anything in the paint queue? WM_PAINT stays queued until
+	 * BeginPaint validates the window. */
+	if (msg_filter_match(&paint_msg, NULL, wMsgFilterMin, wMsgFilterMax)) {
 		TAILQ_FOREACH(q_paint, &g_paint_queue, entries) {
-			printf("TODO: Handle Event.\n");
-		
+			if (hwnd != NULL && q_paint->wnd != hwnd)
+				continue;
+
+			msg->hwnd = q_paint->wnd;
+			msg->message = WM_PAINT;
+			msg->wParam = 0;
+			msg->lParam = 0;
+			return TRUE;
 		}
+	}
 
-		tptr = NULL;
-		fds = x_fd + 1;
-		tmout.tv_sec = tmout.tv_usec = 0;
-		FD_ZERO(&readset);
-		FD_SET(x_fd, &readset);
+	/* Expired timers come last, one WM_TIMER per timer however many
+	 * periods have passed */
+	if (msg_filter_match(&timer_msg, NULL, wMsgFilterMin, wMsgFilterMax) &&
+	    w32x_timer_get(msg, hwnd, wRemoveMsg & PM_REMOVE))
+		return TRUE;
+
+	if (quit_posted) {
+		msg->hwnd = NULL;
+		msg->message = WM_QUIT;
+		msg->wParam = quit_code;
+		msg->lParam = 0;
+		if (wRemoveMsg & PM_REMOVE)
+			quit_posted = FALSE;
+		return TRUE;
+	}
 
-		nf = select(fds, &readset, NULL, NULL, &tmout);
-		if (nf <= 0) {
-			FD_ZERO(&readset);
-		} else {
-			continue;
-		}
+	return FALSE;
+}
 
-		/* sleep until next event */
-		fds = x_fd + 1;
-		FD_ZERO(&readset);
-		FD_SET(x_fd, &readset);
+BOOL GetMessage(LPMSG msg, HWND wnd, UINT wMsgFilterMin, UINT wMsgFilterMax)
+{
+	while (1) {
+		if (w32x_peek_message(msg, wnd, wMsgFilterMin, wMsgFilterMax,
+		    PM_REMOVE)) {
+			return msg->message != WM_QUIT;
+		}
 
-		nf = select(fds, &readset, NULL, NULL, tptr);
-		if (nf == -1) {
-			FD_ZERO(&readset);
+		/* sleep until the next event or timer */
+		if (w32x_wait(w32x_timer_timeout()) == -1 && errno != EINTR) {
+			return -1;
 		}
 	}
 
 	return TRUE;
 }
 
+BOOL
+PeekMessage(LPMSG msg, HWND wnd, UINT wMsgFilterMin, UINT wMsgFilterMax,
+    UINT wRemoveMsg)
+{
+	if (w32x_peek_message(msg, wnd, wMsgFilterMin, wMsgFilterMax,
+	    wRemoveMsg))
+		return TRUE;
+
+	/* Nothing buffered, check the connection and fds without blocking */
+	if (w32x_wait(0) <= 0)
+		return FALSE;
+
+	return w32x_peek_message(msg, wnd, wMsgFilterMin, wMsgFilterMax,
+	    wRemoveMsg);
+}
+
+/*
+ * Waits until one of the fds in pHandles is readable or, if dwWakeMask is
+ * non-zero, until there is input for the message queue. Returns
+ * WAIT_OBJECT_0 + index of the ready fd, WAIT_OBJECT_0 + nCount for queue
+ * input, WAIT_TIMEOUT or WAIT_FAILED. Waiting for all handles is not
+ * supported.
+ */
+DWORD
+MsgWaitForMultipleObjects(DWORD nCount, const int *pHandles, BOOL fWaitAll,
+    DWORD dwMilliseconds, DWORD dwWakeMask)
+{
+	struct pollfd pfds[MAXIMUM_WAIT_OBJECTS + 1];
+	DWORD i;
+	int nf, timeout, timer_timeout;
+
+	if (fWaitAll || nCount > MAXIMUM_WAIT_OBJECTS) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return WAIT_FAILED;
+	}
+
+	w32x_current_thread();
+	if (dwWakeMask != 0 && queue_has_input())
+		return WAIT_OBJECT_0 + nCount;
+
+	for (i = 0; i < nCount; i++) {
+		pfds[i].fd = pHandles[i];
+		pfds[i].events = POLLIN;
+		pfds[i].revents = 0;
+	}
+	/* The epoll set itself polls readable when the X connection or any
+	 * WSAAsyncSelect fd is ready, so one poll covers everything. */
+	pfds[nCount].fd = epoll_fd;
+	pfds[nCount].events = POLLIN;
+	pfds[nCount].revents = 0;
+
+	if (disp != NULL) {
+		XFlush(disp);
+		if (dwWakeMask != 0 && XEventsQueued(disp, QueuedAlready))
+			return WAIT_OBJECT_0 + nCount;
+	}
+
+	/* An expiring timer is queue input too */
+	timeout = dwMilliseconds == INFINITE ? -1 : (int)dwMilliseconds;
+	timer_timeout = dwWakeMask != 0 ? w32x_timer_timeout() : -1;
+	if (timer_timeout != -1 && (timeout == -1 || timer_timeout < timeout))
+		timeout = timer_timeout;
+	else
+		timer_timeout = -1;
+
+	do {
+		nf = poll(pfds, dwWakeMask != 0 ? nCount + 1 : nCount,
+		    timeout);
+	} while (nf == -1 && errno == EINTR);
+
+	if (nf == -1)
+		return WAIT_FAILED;
+	if (nf == 0)
+		return timer_timeout != -1 ? WAIT_OBJECT_0 + nCount :
+		    WAIT_TIMEOUT;
+
+	for (i = 0; i < nCount; i++) {
+		if (pfds[i].revents != 0)
+			return WAIT_OBJECT_0 + i;
+	}
+	return WAIT_OBJECT_0 + nCount;
+}
+
 HWND GetParent(HWND wnd)
 {
 	HWND parent = 0;
@@ -488,11 +1522,42 @@ HWND GetParent(HWND wnd)
 	return parent;
 }
 
+/*
+ * Post the characters a WM_KEYDOWN types as WM_CHAR messages, so they
+ * are the next ones GetMessage returns.
+ */
+BOOL
+TranslateMessage(const MSG *msg)
+{
+	WPARAM chars[8];
+	int n;
+
+	if (msg->message != WM_KEYDOWN || msg->hwnd == NULL)
+		return FALSE;
+
+	n = w32x_keyboard_chars(msg, chars, 8);
+	/* Pushed to the front backwards to keep them in order */
+	while (n-- > 0) {
+		msg_ring_push_front(&g_msg_queue, msg->hwnd, WM_CHAR,
+		    chars[n], msg->lParam & 0x7fffffff);
+	}
+	return TRUE;
+}
+
 int DispatchMessage(const MSG *msg)
 {
 	Wnd *wnd = msg->hwnd;
 
-	wnd->proc(wnd, msg->message, msg->wParam, msg->lParam);
+	/* A timer with a callback calls it instead of the window */
+	if (msg->message == WM_TIMER && msg->lParam != 0) {
+		((TIMERPROC)msg->lParam)(wnd, WM_TIMER, msg->wParam,
+		    GetTickCount());
+		return 0;
+	}
 
-	return 0;
+	/* Thread messages have no window to go to */
+	if (wnd == NULL || wnd->proc == NULL)
+		return 0;
+
+	return wnd->proc(wnd, msg->message, msg->wParam, msg->lParam);
 }
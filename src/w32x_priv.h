@@ -28,6 +28,31 @@
 #ifndef __W32X_PRIV_H__
 #define __W32X_PRIV_H__
 
+#include <sys/queue.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Entry in the paint queue, embedded in every window so that marking a
+ * window dirty never allocates. */
+struct paint_entry {
+	struct Wnd *wnd;
+	BOOL queued;
+
+	TAILQ_ENTRY(paint_entry) entries;
+};
+
+/* Y-X banded region, see region.c */
+#define REGION_INLINE_RECTS 4
+
+struct w32x_region {
+	int nrects;
+	int complexity; /* NULLREGION, SIMPLEREGION or COMPLEXREGION */
+	RECT extents;
+	RECT *heap; /* rectangles once they outgrow inline_rects */
+	int size; /* of heap */
+	RECT inline_rects[REGION_INLINE_RECTS];
+};
+
 struct Wnd {
 	Window window;
 	DWORD dwStyle;
@@ -38,43 +63,314 @@ struct Wnd {
 	int width;
 	int height;
 
-	HRGN update;
+	struct w32x_region update; /* client coordinates */
 	BOOL erase;
+	struct paint_entry paint;
+
+	/* Off-screen buffer BeginPaint draws into, cached across paints and
+	 * reallocated lazily after the window has been resized. */
+	Pixmap backbuf;
+	int backbuf_width;
+	int backbuf_height;
+	BOOL backbuf_stale;
+	struct w32x_region paint_rgn; /* being painted by Begin/EndPaint */
+	unsigned long background_pixel;
 
 	char *label;
 	int isTopLevel;
 	HDC hdc;
 	HMENU menu;
+	struct Wnd *menubar; /* "#32768" child drawing the menu */
 	WNDPROC proc;
+	struct w32x_thread *owner; /* thread whose queue gets its messages */
+
+	/* X event compression state, see w32x.c */
+	DWORD compress;         /* ECF_* rules that apply */
+	unsigned int cmp_batch; /* batch the fields below are valid for */
+	int cmp_motion;         /* later motion event of the run, or -1 */
+	int cmp_configure;      /* later configure event, or -1 */
+	BOOL cmp_exposed;
+
+	unsigned int timers; /* SetTimer timers, see timer.c */
 
 	char wndExtra[];
 };
 typedef struct Wnd Wnd;
 
 struct WndClass {
-	struct WndClass *next;
 	char *name;
+	uint32_t hash; /* of the name, see class.c */
+	ATOM atom;
 	unsigned long border_pixel;
 	unsigned long background_pixel;
 	WNDPROC proc;
 	size_t wndExtra;
 };
 
+/* GDI object types, kept in the handle (see gdiobj.c) */
+enum gdi_type {
+	GDI_TYPE_PEN = 1,
+	GDI_TYPE_BRUSH,
+	GDI_TYPE_FONT,
+	GDI_TYPE_BITMAP,
+	GDI_TYPE_REGION,
+	GDI_TYPE_LAST = GDI_TYPE_REGION
+};
+
+struct gdi_pen {
+	COLORREF color;
+	int style;
+	int width;
+};
+
+struct gdi_brush {
+	COLORREF color;
+	UINT style;
+};
+
+/* Metrics of a core font, built once when it is loaded (font.c) */
+struct w32x_font_metrics {
+	int ascent;
+	int descent;
+	int ave_width;
+	int max_width;
+	int weight;
+	BOOL italic;
+	BOOL fixed_pitch;
+	BYTE first_char;
+	BYTE last_char;
+	BYTE default_char;
+	short advance[256];
+};
+
+struct gdi_font {
+	struct w32x_font *face; /* shared through the font cache */
+	LOGFONT lf; /* as given to CreateFontIndirect */
+};
+
+struct gdi_bitmap {
+	struct w32x_dib *dib; /* bitmap.c */
+};
+
+/* Pixels of a bitmap as the software rasterizer sees them: 32 bit BGRX,
+ * row 0 at the top. pitch is in pixels and negative for bitmaps stored
+ * bottom-up. */
+struct w32x_surface {
+	uint32_t *bits;
+	int width;
+	int height;
+	int pitch;
+};
+
+struct gdi_region {
+	struct w32x_region region; /* storage is kept when the slot is reused */
+};
+
+/* Shapes queued on a DC, in runs sent as one poly request each when the
+ * DC is flushed. */
+#define GDI_BATCH_MAX 256
+#define GDI_RUNS_MAX 4
+
+enum gdi_shape {
+	GDI_SHAPE_RECT,
+	GDI_SHAPE_ARC
+};
+
+struct gdi_batch {
+	BOOL fill;
+	enum gdi_shape shape;
+	COLORREF color;
+	int count;
+	XRectangle extents; /* of the pixels the run covers */
+	union {
+		XRectangle rects[GDI_BATCH_MAX];
+		XArc arcs[GDI_BATCH_MAX];
+	} u;
+};
+
+TAILQ_HEAD(w32x_dc_list, WndDC);
+
 struct WndDC {
 	HWND wnd;
+	Drawable drawable; /* window, or its back buffer while painting */
+
+	/* Memory DCs have no window, drawable or GC; they draw into the
+	 * selected bitmap with the software rasterizer (memdc.c). */
+	BOOL mem;
+	HBITMAP selectedBitmap;
 
-	int fgPixel;
+	/* Pending shapes, sent run by run in order; see graphics.c for how
+	 * shapes join earlier runs. */
+	struct gdi_batch runs[GDI_RUNS_MAX];
+	int nruns;
+	BOOL dirty; /* on the list of DCs with pending shapes */
+	struct w32x_dc_list *dirty_list; /* that of the thread which drew */
+	TAILQ_ENTRY(WndDC) dirty_entries;
+
+	COLORREF fgColor; /* color the GC foreground holds, or CLR_INVALID */
 	int bgPixel;
+	COLORREF textColor;
 	GC gc;
+
+	/* Clip in effect, NULL for none: the paint region installed by
+	 * BeginPaint, the region selected with SelectClipRgn, or both
+	 * intersected into clip_both. The serial changes whenever the clip
+	 * does. */
+	const struct w32x_region *clip;
+	unsigned int clip_serial;
+	const struct w32x_region *paint_clip;
+	struct w32x_region clip_rgn;
+	BOOL clip_selected;
+	struct w32x_region clip_both;
+
+	HPEN selectedPen;
+	HBRUSH selectedBrush;
+	HFONT selectedFont;
+
 #ifdef HAVE_XFT_H
-	XftDraw *xftDraw;
+	/* XftDraws for the drawables this DC has drawn text on, i.e. the
+	 * window and its back buffer (text.c) */
+	struct {
+		Drawable drawable;
+		XftDraw *draw;
+		unsigned int clip_serial;
+	} xft[2];
+	int xft_last; /* entry used most recently */
 #endif
-	struct GDIOBJ *selectedPen;
-	struct GDIOBJ *selectedBrush;
-	struct GDIOBJ *selectedFont;
 };
 
+/* Messages other threads posted or sent to a thread, see postq.c */
+struct w32x_postq {
+	struct postq_cell *cells;
+	atomic_uint enqueue_pos;
+	unsigned int dequeue_pos; /* only the owner dequeues */
+	atomic_int wake_pending;
+	int wake_fd;
+	_Atomic(struct w32x_sent *) sent_head;
+	atomic_uint users; /* other threads inside, POSTQ_CLOSED once torn down */
+};
+
+/*
+ * A message sent from another thread, see postq.c. Blocking sends keep
+ * the node on the sender's stack; SendMessageTimeout and SendNotifyMessage
+ * allocate it, and it is freed by whichever of sender and receiver lets
+ * go last.
+ */
+struct w32x_sent {
+	HWND hwnd;
+	UINT message;
+	WPARAM wParam;
+	LPARAM lParam;
+	LRESULT result;
+	atomic_int done;  /* futex word, set once result is valid */
+	atomic_int refs;  /* heap nodes only */
+	BOOL heap;
+	struct w32x_postq *reply_to; /* sender's queue, NULL if it has none */
+	LRESULT (*call)(HWND, WPARAM, LPARAM); /* run instead of the wndproc */
+	struct w32x_sent *next;
+};
+
+/*
+ * A thread with a message queue, see w32x.c. The queue itself is thread
+ * local; this is the part other threads reach through Wnd.owner.
+ */
+struct w32x_thread {
+	DWORD id;
+	struct w32x_postq postq;
+
+	/* X events for our windows that another thread read */
+	pthread_mutex_t inbox_lock;
+	XEvent *inbox;
+	unsigned int inbox_count;
+	unsigned int inbox_size;
+
+	LIST_ENTRY(w32x_thread) entries;
+};
+
+BOOL w32x_wndmap_insert(Window w, HWND hwnd);
+HWND w32x_wndmap_lookup(Window w);
+void w32x_wndmap_remove(Window w);
+HWND w32x_wndmap_owned(struct w32x_thread *t);
+void w32x_mouse_record(const XMotionEvent *e);
+WPARAM w32x_mouse_keys(unsigned int state);
+void w32x_keyboard_init(void);
+void w32x_keyboard_mapping(XMappingEvent *e);
+void w32x_keyboard_translate(const XKeyEvent *e, LPMSG msg);
+int w32x_keyboard_chars(const MSG *msg, WPARAM *chars, int max);
+void w32x_lock(void);
+void w32x_unlock(void);
+struct w32x_thread *w32x_current_thread(void);
+void w32x_dispatch_sent(void);
+LRESULT w32x_call_owner(HWND wnd, LRESULT (*call)(HWND, WPARAM, LPARAM),
+    WPARAM wParam, LPARAM lParam);
+int w32x_postq_init(struct w32x_postq *q);
+void w32x_postq_wake(struct w32x_postq *q);
+BOOL w32x_postq_push(struct w32x_postq *q, HWND hwnd, UINT message,
+    WPARAM wParam, LPARAM lParam);
+BOOL w32x_postq_pop(struct w32x_postq *q, LPMSG msg);
+void w32x_postq_ack(struct w32x_postq *q);
+BOOL w32x_postq_closed(struct w32x_postq *q);
+void w32x_postq_close(struct w32x_postq *q);
+void w32x_sent_push(struct w32x_postq *q, struct w32x_sent *node);
+BOOL w32x_sent_pending(struct w32x_postq *q);
+struct w32x_sent *w32x_sent_take(struct w32x_postq *q);
+void w32x_sent_complete(struct w32x_sent *node, LRESULT result);
+BOOL w32x_sent_wait(struct w32x_sent *node, int timeout, LRESULT *result);
+void w32x_timer_forget_window(HWND hwnd);
+void w32x_timer_exit(void);
+int w32x_timer_timeout(void);
+BOOL w32x_timer_ready(void);
+BOOL w32x_timer_get(LPMSG msg, HWND hwnd, BOOL remove);
+void w32x_color_init(void);
+unsigned long w32x_color_to_pixel(COLORREF cr);
+HGDIOBJ w32x_gdi_alloc(enum gdi_type type, void **objp);
+void *w32x_gdi_get(HGDIOBJ h, enum gdi_type type);
+enum gdi_type w32x_gdi_type(HGDIOBJ h);
+void w32x_gdi_set_stock(HGDIOBJ h);
+BOOL w32x_gdi_is_stock(HGDIOBJ h);
+BOOL w32x_gdi_is_selected(HGDIOBJ h);
+void w32x_gdi_select(HGDIOBJ selected, HGDIOBJ deselected);
+void w32x_gdi_free(HGDIOBJ h);
+void w32x_region_set_rect(struct w32x_region *r, int left, int top,
+    int right, int bottom);
+void w32x_region_trim(struct w32x_region *r);
+int w32x_region_combine(struct w32x_region *dest,
+    const struct w32x_region *a, const struct w32x_region *b, int mode);
+BOOL w32x_region_union_rect(struct w32x_region *r, const RECT *rc);
+BOOL w32x_region_subtract_rect(struct w32x_region *r, const RECT *rc);
+BOOL w32x_region_contains_point(const struct w32x_region *r, int x, int y);
+void w32x_region_set_gc_clip(GC gc, const struct w32x_region *r);
+const RECT *w32x_region_rects(const struct w32x_region *r, int *n);
+const struct w32x_font_metrics *w32x_font_metrics(struct gdi_font *font);
+const struct w32x_font_metrics *w32x_font_mem_metrics(struct gdi_font *font);
+XFontStruct *w32x_font_xfont(struct gdi_font *font);
+#ifdef HAVE_XFT_H
+XftFont *w32x_font_xft(struct gdi_font *font);
+FT_Face w32x_font_ft(struct gdi_font *font);
+void w32x_text_forget_font(XftFont *font);
+#endif
+void w32x_dc_forget_drawable(HDC hdc, Drawable drawable);
+const XRectangle *w32x_region_xrects(const struct w32x_region *r, int *n);
+void w32x_font_release(struct gdi_font *font);
 HDC w32x_CreateDC(void);
+void w32x_dc_begin_paint(HDC hdc, Drawable backbuf,
+    const struct w32x_region *clip, BOOL erase,
+    unsigned long bg_pixel, const RECT *box);
+void w32x_dc_end_paint(HDC hdc, const RECT *box);
+void w32x_dc_flush(HDC hdc);
+void w32x_gdi_flush_all(void);
+void w32x_dib_destroy(struct w32x_dib *dib);
+void w32x_dib_sync(void);
+void w32x_dib_surface(const struct w32x_dib *dib, struct w32x_surface *s);
+void w32x_mem_shape(HDC hdc, BOOL fill, enum gdi_shape shape,
+    COLORREF color, int x, int y, int width, int height);
+void w32x_mem_put_pixels(HDC hdc, int x, int y, int width, int height,
+    const uint32_t *src, int pitch);
+BOOL w32x_mem_text_out(HDC hdc, int x, int y, LPCWSTR s, int c);
+BOOL w32x_mem_text_extent(HDC hdc, LPCWSTR s, int c, LPSIZE size);
+HBITMAP w32x_stock_bitmap(void);
 WndClass *get_class_by_name(const char *name);
+void w32x_queue_paint(struct Wnd *wnd);
+void w32x_unqueue_paint(struct Wnd *wnd);
 
 #endif /* __W32X_PRIV_H__ */
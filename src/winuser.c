@@ -25,13 +25,19 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <config.h>
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <sys/param.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xresource.h>
+#ifdef HAVE_XFT_H
+#include <X11/Xft/Xft.h>
+#endif
 
 #include <windows.h>
 #include "w32x_priv.h"
@@ -39,7 +45,6 @@
 #define HWND_MAGIC 0x48574e44 /* 'HWND' */
 
 extern Display *disp;
-extern XContext ctxt;
 extern Atom WM_DELETE_WINDOW;
 
 /* internals */
@@ -58,16 +63,81 @@ static void w32x_get_parent_client_offset(HWND parent, int *x, int *y)
 	}
 }
 
+/*
+ * Return the window's back buffer, (re)creating it when the window has
+ * been resized beyond it, or has shrunk to well under it, since the last
+ * paint.
+ */
+static Pixmap
+w32x_get_backbuf(HWND wnd)
+{
+	int w = wnd->width > 0 ? wnd->width : 1;
+	int h = wnd->height > 0 ? wnd->height : 1;
+
+	if (wnd->backbuf != None && wnd->backbuf_stale) {
+		if (w > wnd->backbuf_width || h > wnd->backbuf_height ||
+		    w * h * 4 < wnd->backbuf_width * wnd->backbuf_height) {
+			w32x_dc_forget_drawable(wnd->hdc, wnd->backbuf);
+			XFreePixmap(disp, wnd->backbuf);
+			wnd->backbuf = None;
+		}
+	}
+	wnd->backbuf_stale = FALSE;
+
+	if (wnd->backbuf == None) {
+		wnd->backbuf = XCreatePixmap(disp, wnd->window, w, h,
+		    DefaultDepth(disp, DefaultScreen(disp)));
+		wnd->backbuf_width = w;
+		wnd->backbuf_height = h;
+	}
+	return wnd->backbuf;
+}
+
 HDC BeginPaint(HWND wnd, PAINTSTRUCT *lpPaint)
 {
+	struct w32x_region rgn;
+
 	lpPaint->hdc = GetDC(wnd);
-	lpPaint->fErase = FALSE;
+	if (lpPaint->hdc->drawable != wnd->window) {
+		/* Missing EndPaint from the last paint; present it now */
+		w32x_dc_end_paint(lpPaint->hdc, &wnd->paint_rgn.extents);
+	}
+
+	lpPaint->fErase = wnd->erase;
+	lpPaint->rcPaint = wnd->update.extents;
+
+	/* The damage is being handed to the caller, validate the window so
+	 * no further WM_PAINT is generated for it. The update region becomes
+	 * the paint region (kept as the clip until EndPaint), and the old
+	 * paint region is recycled as the new, empty, update region. */
+	rgn = wnd->paint_rgn;
+	wnd->paint_rgn = wnd->update;
+	wnd->update = rgn;
+	w32x_region_set_rect(&wnd->update, 0, 0, 0, 0);
+	wnd->erase = FALSE;
+	w32x_unqueue_paint(wnd);
+
+	w32x_dc_begin_paint(lpPaint->hdc, w32x_get_backbuf(wnd),
+	    &wnd->paint_rgn, lpPaint->fErase, wnd->background_pixel,
+	    &lpPaint->rcPaint);
 
 	SendMessage(wnd, WM_NCPAINT, 0, 0);
 
 	return lpPaint->hdc;
 }
 
+BOOL EndPaint(HWND wnd, const PAINTSTRUCT *lpPaint)
+{
+	HDC hdc = lpPaint->hdc;
+
+	if (hdc == NULL || hdc->drawable == wnd->window)
+		return TRUE;
+
+	w32x_dc_end_paint(hdc, &lpPaint->rcPaint);
+
+	return TRUE;
+}
+
 HWND
 CreateWindow(const char *lpClassName, const char *lpWindowName, DWORD dwStyle,
     int x, int y, int width, int height, HWND parent, HMENU menu,
@@ -88,6 +158,12 @@ HWND CreateWindowEx(DWORD dwExStyle, const char *lpClassName,
 
 	if (wc == NULL) {
 		/* Can't create window, no class */
+		SetLastError(ERROR_CANNOT_FIND_WND_CLASS);
+		return NULL;
+	}
+	if (disp == NULL) {
+		/* No display; only memory DCs can be drawn on */
+		SetLastError(ERROR_NOT_SUPPORTED);
 		return NULL;
 	}
 
@@ -117,18 +193,33 @@ HWND CreateWindowEx(DWORD dwExStyle, const char *lpClassName,
 	wnd->window = XCreateSimpleWindow(disp, parent_win,
 	    x, y, width, height, dwStyle & WS_BORDER ? 1 : 0,
 	    wc->border_pixel, wc->background_pixel);
+	wnd->background_pixel = wc->background_pixel;
+	wnd->hdc->wnd = wnd;
+	wnd->hdc->drawable = wnd->window;
+	w32x_region_set_rect(&wnd->update, 0, 0, 0, 0);
+	w32x_region_set_rect(&wnd->paint_rgn, 0, 0, 0, 0);
 	wnd->label = strdup(lpWindowName);
 	wnd->proc = wc->proc;
+	wnd->owner = w32x_current_thread();
+	wnd->compress = ECF_ALL;
 	wnd->parent = parent;
 	class_hint.res_name = wnd->label;
 	class_hint.res_class = wc->name;
 	XSetClassHint(disp, wnd->window, &class_hint);
 
-	XSaveContext(disp, wnd->window, ctxt, (XPointer)wnd);
+	if (!w32x_wndmap_insert(wnd->window, wnd)) {
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		XDestroyWindow(disp, wnd->window);
+		XFreeGC(disp, wnd->hdc->gc);
+		free(wnd->hdc);
+		free(wnd->label);
+		free(wnd);
+		return NULL;
+	}
 
 	XSelectInput(disp, wnd->window,
 	    ExposureMask | ButtonPressMask | ButtonReleaseMask | KeyPressMask |
-	    StructureNotifyMask);
+	    KeyReleaseMask | PointerMotionMask | StructureNotifyMask);
 
 	/* Parent will explicitly call ShowWindow when ready */
 	if (parent != NULL && (dwStyle & WS_VISIBLE))
@@ -146,7 +237,7 @@ HWND CreateWindowEx(DWORD dwExStyle, const char *lpClassName,
 
 	if (menu != NULL) {
 		/* XXX: Needs to be moved to menu.c */
-		CreateWindow("#32768", "Nothing", WS_CHILD | WS_VISIBLE, 0, 0, width,
+		wnd->menubar = CreateWindow("#32768", "Nothing", WS_CHILD | WS_VISIBLE, 0, 0, width,
 		    GetSystemMetrics(SM_CYMENU), wnd, NULL, hInst, NULL);
 	}
 
@@ -176,9 +267,9 @@ HDC GetDC(HWND hwnd)
 	return hwnd->hdc;
 }
 
-BOOL GetMenu(HWND hwnd)
+HMENU GetMenu(HWND hwnd)
 {
-	return hwnd->menu != NULL;
+	return hwnd->menu;
 }
 
 int GetSystemMetrics(int nIndex)
@@ -190,23 +281,55 @@ int GetSystemMetrics(int nIndex)
 	return 0;
 }
 
+/* Erase a pending background now, so BeginPaint does not erase again */
+static void
+erase_update(HWND hwnd)
+{
+	HDC hdc;
+
+	if (!hwnd->erase)
+		return;
+	hwnd->erase = FALSE;
+	hdc = GetDC(hwnd);
+	SendMessage(hwnd, WM_ERASEBKGND, (WPARAM)hdc, 0);
+	ReleaseDC(hwnd, hdc);
+}
+
 /*
  * Get a region to be updated (in the client coordinates?)
  */
 int
 GetUpdateRgn(HWND hwnd, HRGN rgn, BOOL erase)
 {
-	if (erase && hwnd->update != NULL &&
-	    NULLREGION != GetRgnBox(hwnd->update, NULL)) {
-		HDC hdc = GetDC(hwnd);
-		SendMessage(hwnd, WM_ERASEBKGND, (WPARAM)hdc, 0);
-		ReleaseDC(hwnd, hdc);
-	}
-	if (hwnd->update == NULL) {
-		SetRectRgn(rgn, 0, 0, 0, 0); /* XXX: Correct? */
-		return NULLREGION;
+	struct gdi_region *dest = w32x_gdi_get(rgn, GDI_TYPE_REGION);
+
+	if (dest == NULL)
+		return ERROR;
+
+	if (erase && hwnd->update.nrects > 0)
+		erase_update(hwnd);
+	return w32x_region_combine(&dest->region, &hwnd->update, NULL,
+	    RGN_COPY);
+}
+
+/*
+ * Get the bounding box of the region to be updated. Returns FALSE when
+ * the window needs no painting.
+ */
+BOOL
+GetUpdateRect(HWND hwnd, RECT *r, BOOL erase)
+{
+	if (hwnd->update.nrects == 0) {
+		if (r != NULL)
+			SetRectEmpty(r);
+		return FALSE;
 	}
-	return CombineRgn(rgn, hwnd->update, NULL, RGN_COPY);
+
+	if (erase)
+		erase_update(hwnd);
+	if (r != NULL)
+		*r = hwnd->update.extents;
+	return TRUE;
 }
 
 LONG GetWindowLong(HWND hWnd, int nIndex)
@@ -239,6 +362,41 @@ BOOL GetWindowRect(HWND wnd, LPRECT rect)
 	return TRUE;
 }
 
+/*
+ * Damage is accumulated into the window's update region in place, so
+ * invalidating does not allocate. Invalidating a rectangle inside the
+ * existing damage, or covering all of it, never leaves a simple update
+ * region.
+ *
+ * The update region and paint queue belong to the thread owning the
+ * window; other threads have it make the change for them.
+ */
+static LRESULT
+invalidate_rect(HWND hwnd, WPARAM erase, LPARAM lParam)
+{
+	const RECT *r = (const RECT *)lParam;
+	RECT client, damage;
+
+	GetClientRect(hwnd, &client);
+	/* A null rect value indicates that the entire client rect should be
+	 * invalidated. */
+	if (r == NULL) {
+		damage = client;
+	} else {
+		SetRect(&damage, MIN(r->left, r->right), MIN(r->top, r->bottom),
+		    MAX(r->left, r->right), MAX(r->top, r->bottom));
+		if (!IntersectRect(&damage, &client, &damage))
+			return TRUE;
+	}
+
+	if (!w32x_region_union_rect(&hwnd->update, &damage))
+		return FALSE;
+	if (erase)
+		hwnd->erase = TRUE;
+	w32x_queue_paint(hwnd);
+	return TRUE;
+}
+
 BOOL
 InvalidateRect(HWND hwnd, const RECT *r, BOOL erase)
 {
@@ -246,52 +404,76 @@ InvalidateRect(HWND hwnd, const RECT *r, BOOL erase)
 		fprintf(stderr, "InvalidateRect(NULL, ...) - Not currently supported\n");
 		return TRUE;
 	}
+	return (BOOL)w32x_call_owner(hwnd, invalidate_rect, erase, (LPARAM)r);
+}
 
-	hwnd->erase = erase;
-	/* A null rect value indicates that the entire client rect should be
-	 * invalidated. */
-	if (r == NULL) {
-		RECT client;
-		if (hwnd->update) {
-			DeleteObject(hwnd->update);
-		}
-		GetClientRect(hwnd, &client);
-		hwnd->update = CreateRectRgnIndirect(&client);
-		return TRUE;
-	}
-	RECT client;
-	RECT fixed = *r;
-	RECT fixed2;
-	HRGN fixedRgn;
-
-	if (fixed.left > fixed.right) {
-		fixed.left = r->right;
-		fixed.right = r->left;
+/* Once nothing is left to paint, the window leaves the paint queue. */
+static void
+validate_done(HWND hwnd)
+{
+	if (hwnd->update.nrects == 0) {
+		hwnd->erase = FALSE;
+		w32x_unqueue_paint(hwnd);
 	}
-	if (fixed.top > fixed.bottom) {
-		fixed.top = r->bottom;
-		fixed.bottom = r->top;
+}
+
+static LRESULT
+validate_rect(HWND hwnd, WPARAM wParam, LPARAM lParam)
+{
+	const RECT *r = (const RECT *)lParam;
+	RECT valid;
+
+	/* NULL validates the whole window */
+	if (r == NULL) {
+		w32x_region_set_rect(&hwnd->update, 0, 0, 0, 0);
+	} else {
+		SetRect(&valid, MIN(r->left, r->right), MIN(r->top, r->bottom),
+		    MAX(r->left, r->right), MAX(r->top, r->bottom));
+		if (!w32x_region_subtract_rect(&hwnd->update, &valid))
+			return FALSE;
 	}
-	GetClientRect(hwnd, &client);
-	if (!IntersectRect(&fixed2, &client, &fixed))
+	validate_done(hwnd);
+	return TRUE;
+}
+
+BOOL
+ValidateRect(HWND hwnd, const RECT *r)
+{
+	if (hwnd == NULL) {
+		fprintf(stderr, "ValidateRect(NULL, ...) - Not currently supported\n");
 		return TRUE;
-	fixedRgn = CreateRectRgnIndirect(&fixed2);
-	if (fixedRgn == NULL)
-		return FALSE;
-	if (hwnd->update == NULL) {
-		hwnd->update = fixedRgn;
-	} else {
-		CombineRgn(hwnd->update, hwnd->update,
-				 fixedRgn, RGN_OR);
-		DeleteObject(fixedRgn);
 	}
+	return (BOOL)w32x_call_owner(hwnd, validate_rect, 0, (LPARAM)r);
+}
+
+static LRESULT
+validate_rgn(HWND hwnd, WPARAM wParam, LPARAM lParam)
+{
+	struct gdi_region *valid;
+
+	if ((valid = w32x_gdi_get((HRGN)lParam, GDI_TYPE_REGION)) == NULL)
+		return FALSE;
+	if (w32x_region_combine(&hwnd->update, &hwnd->update, &valid->region,
+	    RGN_DIFF) == ERROR)
+		return FALSE;
+	validate_done(hwnd);
 	return TRUE;
 }
 
+BOOL
+ValidateRgn(HWND hwnd, HRGN rgn)
+{
+	if (rgn == NULL)
+		return ValidateRect(hwnd, NULL);
+	return (BOOL)w32x_call_owner(hwnd, validate_rgn, 0, (LPARAM)rgn);
+}
+
 int ReleaseDC(HWND hwnd, HDC hdc)
 {
-	/* This is currently a no-op until we have other types of DCs */
-	return 0;
+	/* Window DCs are private, so releasing one only sends what is
+	 * queued on it */
+	w32x_dc_flush(hdc);
+	return 1;
 }
 
 BOOL
@@ -301,13 +483,27 @@ SetMenu(HWND hwnd, HMENU menu)
 		return FALSE;
 	}
 	hwnd->menu = menu;
+	DrawMenuBar(hwnd);
 
 	return TRUE;
 }
 
+/* Repaint the menu bar after its menu has changed */
+BOOL
+DrawMenuBar(HWND hwnd)
+{
+	if (hwnd == NULL || hwnd->menubar == NULL) {
+		SetLastError(ERROR_INVALID_WINDOW_HANDLE);
+		return FALSE;
+	}
+	return InvalidateRect(hwnd->menubar, NULL, TRUE);
+}
+
 BOOL UpdateWindow(HWND hwnd)
 {
-	SendMessage(hwnd, WM_PAINT, 0, 0);
+	/* Paint now, bypassing the queue, but only if there is damage */
+	if (hwnd->paint.queued)
+		SendMessage(hwnd, WM_PAINT, 0, 0);
 
 	return TRUE;
 }
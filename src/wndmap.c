@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2018 Devin Smith <devin@devinsmith.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <config.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef HAVE_XFT_H
+#include <X11/Xft/Xft.h>
+#endif
+
+#include <windows.h>
+#include "w32x_priv.h"
+
+/*
+ * Window to HWND map.
+ *
+ * Every X event has to be mapped back to the Wnd it was sent to. This is
+ * an open addressing table with linear probing that only w32x uses, so
+ * the lookup takes the library lock rather than the display lock and
+ * shares no buckets with other XContext users.
+ *
+ * Window ids handed out by the server are mostly consecutive, which the
+ * multiplicative hash spreads over the table. The load is kept under one
+ * half so probe runs stay short, and removal shifts later entries of the
+ * run back instead of leaving tombstones, so lookups never slow down as
+ * windows come and go.
+ */
+
+#define WNDMAP_MIN_SIZE 64
+
+struct wndmap_entry {
+	Window window; /* None when the slot is empty */
+	HWND hwnd;
+};
+
+static struct wndmap_entry *table;
+static unsigned int table_mask; /* size - 1, the size is a power of two */
+static unsigned int table_count;
+
+static unsigned int
+wndmap_hash(Window w)
+{
+	/* Fibonacci hashing, the top bits are the best mixed */
+	return (unsigned int)(((uint64_t)w * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+static struct wndmap_entry *
+wndmap_find(Window w)
+{
+	unsigned int i = wndmap_hash(w) & table_mask;
+
+	while (table[i].window != w && table[i].window != None)
+		i = (i + 1) & table_mask;
+	return &table[i];
+}
+
+static BOOL
+wndmap_resize(unsigned int size)
+{
+	struct wndmap_entry *old = table, *e;
+	unsigned int i, old_size = table == NULL ? 0 : table_mask + 1;
+
+	table = calloc(size, sizeof(struct wndmap_entry));
+	if (table == NULL) {
+		table = old;
+		return FALSE;
+	}
+	table_mask = size - 1;
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i].window == None)
+			continue;
+		e = wndmap_find(old[i].window);
+		*e = old[i];
+	}
+	free(old);
+	return TRUE;
+}
+
+BOOL
+w32x_wndmap_insert(Window w, HWND hwnd)
+{
+	struct wndmap_entry *e;
+
+	w32x_lock();
+	if (table == NULL || (table_count + 1) * 2 > table_mask + 1) {
+		if (!wndmap_resize(table == NULL ? WNDMAP_MIN_SIZE :
+		    (table_mask + 1) * 2)) {
+			w32x_unlock();
+			return FALSE;
+		}
+	}
+
+	e = wndmap_find(w);
+	if (e->window == None)
+		table_count++;
+	e->window = w;
+	e->hwnd = hwnd;
+	w32x_unlock();
+	return TRUE;
+}
+
+HWND
+w32x_wndmap_lookup(Window w)
+{
+	HWND hwnd;
+
+	if (w == None)
+		return NULL;
+	w32x_lock();
+	hwnd = table == NULL ? NULL : wndmap_find(w)->hwnd;
+	w32x_unlock();
+	return hwnd;
+}
+
+/*
+ * One of the windows t owns, NULL once there are none. Children come
+ * before their parents, so a thread that exits can destroy its windows
+ * one at a time without X having destroyed any of them already.
+ */
+HWND
+w32x_wndmap_owned(struct w32x_thread *t)
+{
+	HWND hwnd, best = NULL;
+	unsigned int i;
+	int depth, best_depth = -1;
+
+	w32x_lock();
+	for (i = 0; table != NULL && i <= table_mask; i++) {
+		if (table[i].window == None || table[i].hwnd->owner != t)
+			continue;
+		depth = 0;
+		for (hwnd = table[i].hwnd->parent; hwnd != NULL;
+		    hwnd = hwnd->parent)
+			depth++;
+		if (depth > best_depth) {
+			best = table[i].hwnd;
+			best_depth = depth;
+		}
+	}
+	w32x_unlock();
+	return best;
+}
+
+void
+w32x_wndmap_remove(Window w)
+{
+	unsigned int i, j, home;
+
+	if (w == None)
+		return;
+	w32x_lock();
+	if (table == NULL) {
+		w32x_unlock();
+		return;
+	}
+
+	i = wndmap_find(w) - table;
+	if (table[i].window == None) {
+		w32x_unlock();
+		return;
+	}
+
+	/* Move back each later entry of the run that may no longer be
+	 * reachable from its home slot once slot i is empty */
+	for (j = (i + 1) & table_mask; table[j].window != None;
+	    j = (j + 1) & table_mask) {
+		home = wndmap_hash(table[j].window) & table_mask;
+		if (((j - home) & table_mask) >= ((j - i) & table_mask)) {
+			table[i] = table[j];
+			i = j;
+		}
+	}
+	table[i].window = None;
+	table[i].hwnd = NULL;
+	table_count--;
+	w32x_unlock();
+}
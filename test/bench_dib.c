@@ -0,0 +1,114 @@
+/*
+ * DIB upload throughput benchmark for w32x.
+ *
+ * Pushes full frames to a window with SetDIBitsToDevice, once from the
+ * bits of a DIB section (MIT-SHM when the server supports it) and once
+ * from plain client memory (XPutImage), and reports MB/s for each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <windows.h>
+
+#define FRAME_WIDTH 1024
+#define FRAME_HEIGHT 768
+#define FRAMES 200
+
+static LRESULT CALLBACK
+BenchWindowProc(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+	return DefWindowProc(wnd, msg, wParam, lParam);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+fill_frame(uint32_t *bits, int frame)
+{
+	int x, y;
+
+	for (y = 0; y < FRAME_HEIGHT; y++) {
+		for (x = 0; x < FRAME_WIDTH; x++) {
+			bits[y * FRAME_WIDTH + x] =
+			    RGB(x + frame, y + frame, frame * 3);
+		}
+	}
+}
+
+static void
+run(HDC hdc, const char *label, uint32_t *bits, const BITMAPINFO *bmi)
+{
+	double start, elapsed, mb;
+	int i;
+
+	start = now();
+	for (i = 0; i < FRAMES; i++) {
+		fill_frame(bits, i);
+		SetDIBitsToDevice(hdc, 0, 0, FRAME_WIDTH, FRAME_HEIGHT, 0, 0,
+		    0, FRAME_HEIGHT, bits, bmi, DIB_RGB_COLORS);
+		/* Wait for the server before touching the bits again */
+		GdiFlush();
+	}
+	elapsed = now() - start;
+
+	mb = (double)FRAME_WIDTH * FRAME_HEIGHT * 4 * FRAMES / (1024 * 1024);
+	printf("bench_dib: %-28s %4d frames in %.3f s, %.1f MB/s\n",
+	    label, FRAMES, elapsed, mb / elapsed);
+}
+
+int
+WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR pCmdLine,
+    int nCmdShow)
+{
+	HWND wnd;
+	HDC hdc;
+	HBITMAP dib;
+	WNDCLASS benchClass;
+	BITMAPINFO bmi;
+	void *dib_bits;
+	uint32_t *client_bits;
+
+	memset(&benchClass, 0, sizeof(WNDCLASS));
+	benchClass.lpszClassName = "BenchWindow";
+	benchClass.hbrBackground = (HBRUSH)(COLOR_BTNFACE + 1);
+	benchClass.lpfnWndProc = BenchWindowProc;
+	RegisterClass(&benchClass);
+
+	wnd = CreateWindow("BenchWindow", "bench_dib", WS_OVERLAPPEDWINDOW,
+	    0, 0, FRAME_WIDTH, FRAME_HEIGHT, NULL, NULL, hInstance, NULL);
+	ShowWindow(wnd, nCmdShow);
+	hdc = GetDC(wnd);
+
+	memset(&bmi, 0, sizeof(bmi));
+	bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	bmi.bmiHeader.biWidth = FRAME_WIDTH;
+	bmi.bmiHeader.biHeight = -FRAME_HEIGHT; /* top-down */
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+
+	dib = CreateDIBSection(hdc, &bmi, DIB_RGB_COLORS, &dib_bits, NULL, 0);
+	if (dib == NULL) {
+		fprintf(stderr, "bench_dib: CreateDIBSection failed\n");
+		return 1;
+	}
+	run(hdc, "DIB section (MIT-SHM)", dib_bits, &bmi);
+	DeleteObject(dib);
+
+	client_bits = malloc(FRAME_WIDTH * FRAME_HEIGHT * 4);
+	run(hdc, "client memory (XPutImage)", client_bits, &bmi);
+	free(client_bits);
+
+	ReleaseDC(wnd, hdc);
+	return 0;
+}
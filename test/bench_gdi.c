@@ -0,0 +1,103 @@
+/*
+ * GDI object allocation benchmark for w32x.
+ *
+ * Runs create/select/delete cycles for pens, brushes and regions against
+ * a window DC and checks that deleted handles are rejected afterwards.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <windows.h>
+
+#define CYCLES 1000000
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report(const char *what, double elapsed)
+{
+	printf("bench_gdi: %-8s %d cycles in %.3f s, %.1f ns/cycle\n", what,
+	    CYCLES, elapsed, elapsed * 1e9 / CYCLES);
+}
+
+int
+WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR pCmdLine,
+    int nCmdShow)
+{
+	HWND wnd;
+	WNDCLASS benchClass;
+	HDC hdc;
+	HPEN pen, old_pen;
+	HBRUSH brush, old_brush;
+	HRGN rgn;
+	double start;
+	int i;
+
+	memset(&benchClass, 0, sizeof(WNDCLASS));
+	benchClass.lpszClassName = "BenchWindow";
+	benchClass.hbrBackground = (HBRUSH)(COLOR_BTNFACE + 1);
+	benchClass.lpfnWndProc = DefWindowProc;
+	RegisterClass(&benchClass);
+
+	wnd = CreateWindow("BenchWindow", "bench_gdi", WS_OVERLAPPEDWINDOW,
+	    0, 0, 100, 100, NULL, NULL, hInstance, NULL);
+	hdc = GetDC(wnd);
+
+	start = now();
+	for (i = 0; i < CYCLES; i++) {
+		pen = CreatePen(PS_SOLID, 1, RGB(i & 0xff, 0, 0));
+		old_pen = SelectObject(hdc, pen);
+		SelectObject(hdc, old_pen);
+		DeleteObject(pen);
+	}
+	report("pen", now() - start);
+
+	start = now();
+	for (i = 0; i < CYCLES; i++) {
+		brush = CreateSolidBrush(RGB(0, i & 0xff, 0));
+		old_brush = SelectObject(hdc, brush);
+		SelectObject(hdc, old_brush);
+		DeleteObject(brush);
+	}
+	report("brush", now() - start);
+
+	start = now();
+	for (i = 0; i < CYCLES; i++) {
+		rgn = CreateRectRgn(0, 0, i & 0xff, 16);
+		DeleteObject(rgn);
+	}
+	report("region", now() - start);
+
+	/* Stale handles must fail cleanly, without touching freed memory */
+	pen = CreatePen(PS_SOLID, 1, RGB(0, 0, 0));
+	DeleteObject(pen);
+	old_pen = CreatePen(PS_SOLID, 1, RGB(0, 0, 0));
+	if (DeleteObject(pen) || SelectObject(hdc, pen) != NULL) {
+		printf("bench_gdi: stale pen handle was accepted\n");
+		return 1;
+	}
+	DeleteObject(old_pen);
+
+	brush = CreateSolidBrush(RGB(0, 0, 0));
+	old_brush = SelectObject(hdc, brush);
+	if (DeleteObject(brush)) {
+		printf("bench_gdi: selected brush was deleted\n");
+		return 1;
+	}
+	SelectObject(hdc, old_brush);
+	DeleteObject(brush);
+	printf("bench_gdi: stale and selected handles rejected\n");
+
+	ReleaseDC(wnd, hdc);
+	return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * Draw-call batching benchmark for w32x.
+ *
+ * Paints a 100x100 grid of cells that share their edges, a FillRect and a
+ * Rectangle per cell, and counts the X requests it took with XNextRequest.
+ * Drawn one request per call that is 20000 requests.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <X11/Xlib.h>
+
+#include <windows.h>
+
+#define CELLS 100
+#define CELL_SIZE 8
+#define ROUNDS 100
+
+extern Display *disp;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+paint_grid(HDC hdc, HBRUSH fill)
+{
+	RECT cell;
+	int x, y;
+
+	for (y = 0; y < CELLS; y++) {
+		for (x = 0; x < CELLS; x++) {
+			SetRect(&cell, x * CELL_SIZE, y * CELL_SIZE,
+			    (x + 1) * CELL_SIZE, (y + 1) * CELL_SIZE);
+			FillRect(hdc, &cell, fill);
+			Rectangle(hdc, cell.left, cell.top, cell.right,
+			    cell.bottom);
+		}
+	}
+	GdiFlush();
+}
+
+int
+WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR pCmdLine,
+    int nCmdShow)
+{
+	WNDCLASS benchClass;
+	HWND wnd;
+	HDC hdc;
+	HBRUSH fill, outline;
+	unsigned long before, requests;
+	double start, elapsed;
+	int i;
+
+	memset(&benchClass, 0, sizeof(WNDCLASS));
+	benchClass.lpszClassName = "BenchWindow";
+	benchClass.hbrBackground = (HBRUSH)(COLOR_BTNFACE + 1);
+	benchClass.lpfnWndProc = DefWindowProc;
+	RegisterClass(&benchClass);
+
+	wnd = CreateWindow("BenchWindow", "bench_grid", WS_OVERLAPPEDWINDOW,
+	    0, 0, CELLS * CELL_SIZE + 1, CELLS * CELL_SIZE + 1, NULL, NULL,
+	    hInstance, NULL);
+	if (wnd == NULL) {
+		fprintf(stderr, "bench_grid: cannot create window\n");
+		return 1;
+	}
+
+	hdc = GetDC(wnd);
+	fill = CreateSolidBrush(RGB(0xff, 0xff, 0xe0));
+	outline = CreateSolidBrush(RGB(0x40, 0x40, 0x40));
+	SelectObject(hdc, outline);
+
+	/* Settle the GC and colors before counting */
+	paint_grid(hdc, fill);
+	XSync(disp, False);
+
+	before = XNextRequest(disp);
+	paint_grid(hdc, fill);
+	requests = XNextRequest(disp) - before;
+	printf("bench_grid: %dx%d grid in %lu requests (%d unbatched)\n",
+	    CELLS, CELLS, requests, 2 * CELLS * CELLS);
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++)
+		paint_grid(hdc, fill);
+	XSync(disp, False);
+	elapsed = now() - start;
+	printf("bench_grid: %d grids in %.3f s, %.2f ms each\n", ROUNDS,
+	    elapsed, elapsed * 1e3 / ROUNDS);
+
+	ReleaseDC(wnd, hdc);
+	DeleteObject(fill);
+	DeleteObject(outline);
+	DestroyWindow(wnd);
+	return 0;
+}
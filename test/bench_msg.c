@@ -0,0 +1,82 @@
+/*
+ * Message queue throughput benchmark for w32x.
+ *
+ * Posts messages to a window in batches and measures how many per second
+ * make it through GetMessage/DispatchMessage.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <windows.h>
+
+#define BENCH_MSG (WM_USER + 1)
+#define TOTAL_MESSAGES 10000000
+#define BATCH_SIZE 1000
+
+static unsigned long received;
+
+static LRESULT CALLBACK
+BenchWindowProc(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+	switch (msg) {
+	case BENCH_MSG:
+		received++;
+		break;
+	default:
+		return DefWindowProc(wnd, msg, wParam, lParam);
+	}
+	return 0;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR pCmdLine,
+    int nCmdShow)
+{
+	HWND wnd;
+	WNDCLASS benchClass;
+	MSG msg;
+	unsigned long posted, i;
+	double start, elapsed;
+
+	memset(&benchClass, 0, sizeof(WNDCLASS));
+	benchClass.lpszClassName = "BenchWindow";
+	benchClass.hbrBackground = (HBRUSH)(COLOR_BTNFACE + 1);
+	benchClass.lpfnWndProc = BenchWindowProc;
+	RegisterClass(&benchClass);
+
+	/* The window is never mapped, so no X events compete with the
+	 * posted messages. */
+	wnd = CreateWindow("BenchWindow", "bench_msg", WS_OVERLAPPEDWINDOW,
+	    0, 0, 100, 100, NULL, NULL, hInstance, NULL);
+
+	posted = 0;
+	start = now();
+	while (posted < TOTAL_MESSAGES) {
+		for (i = 0; i < BATCH_SIZE; i++) {
+			PostMessage(wnd, BENCH_MSG, i, 0);
+		}
+		posted += BATCH_SIZE;
+
+		while (received < posted && GetMessage(&msg, NULL, 0, 0)) {
+			DispatchMessage(&msg);
+		}
+	}
+	elapsed = now() - start;
+
+	printf("bench_msg: %lu messages in %.3f s, %.0f messages/s\n",
+	    received, elapsed, received / elapsed);
+
+	return 0;
+}
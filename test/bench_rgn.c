@@ -0,0 +1,181 @@
+/*
+ * Region operation benchmark for w32x.
+ *
+ * Runs the same region operations through HRGNs and through Xlib
+ * Regions, which HRGNs used to wrap, and prints the time per operation
+ * for each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#include <windows.h>
+
+#define ITERATIONS 100000
+#define GRID 16 /* cells per side of the staircase region */
+#define CELL 8
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report(const char *op, double w32x, double xlib)
+{
+	printf("bench_rgn: %-12s w32x %8.1f ns  xlib %8.1f ns  (%.1fx)\n", op,
+	    w32x * 1e9 / ITERATIONS, xlib * 1e9 / ITERATIONS, xlib / w32x);
+}
+
+/* A staircase of cells, which has one band per row */
+static void
+build_w32x(HRGN rgn)
+{
+	HRGN cell = CreateRectRgn(0, 0, 0, 0);
+	int x, y;
+
+	SetRectRgn(rgn, 0, 0, 0, 0);
+	for (y = 0; y < GRID; y++) {
+		for (x = 0; x <= y; x += 2) {
+			SetRectRgn(cell, x * CELL, y * CELL, (x + 1) * CELL,
+			    (y + 1) * CELL);
+			CombineRgn(rgn, rgn, cell, RGN_OR);
+		}
+	}
+	DeleteObject(cell);
+}
+
+static void
+build_xlib(Region rgn)
+{
+	XRectangle cell;
+	int x, y;
+
+	for (y = 0; y < GRID; y++) {
+		for (x = 0; x <= y; x += 2) {
+			cell.x = x * CELL;
+			cell.y = y * CELL;
+			cell.width = CELL;
+			cell.height = CELL;
+			XUnionRectWithRegion(&cell, rgn, rgn);
+		}
+	}
+}
+
+int
+WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR pCmdLine,
+    int nCmdShow)
+{
+	HRGN stairs, rect, dest;
+	Region xstairs, xrect, xdest;
+	XRectangle r;
+	double start, w32x;
+	int i;
+
+	stairs = CreateRectRgn(0, 0, 0, 0);
+	build_w32x(stairs);
+	rect = CreateRectRgn(20, 20, 100, 100);
+	dest = CreateRectRgn(0, 0, 0, 0);
+
+	xstairs = XCreateRegion();
+	build_xlib(xstairs);
+	xrect = XCreateRegion();
+	r.x = 20;
+	r.y = 20;
+	r.width = 80;
+	r.height = 80;
+	XUnionRectWithRegion(&r, xrect, xrect);
+	xdest = XCreateRegion();
+
+	start = now();
+	for (i = 0; i < ITERATIONS; i++) {
+		HRGN tmp = CreateRectRgn(0, 0, 10, 10);
+		DeleteObject(tmp);
+	}
+	w32x = now() - start;
+	start = now();
+	for (i = 0; i < ITERATIONS; i++) {
+		Region tmp = XCreateRegion();
+		r.x = r.y = 0;
+		r.width = r.height = 10;
+		XUnionRectWithRegion(&r, tmp, tmp);
+		XDestroyRegion(tmp);
+	}
+	report("create", w32x, now() - start);
+
+	start = now();
+	for (i = 0; i < ITERATIONS; i++)
+		CombineRgn(dest, stairs, NULL, RGN_COPY);
+	w32x = now() - start;
+	start = now();
+	for (i = 0; i < ITERATIONS; i++) {
+		Region empty = XCreateRegion();
+		XUnionRegion(xstairs, empty, xdest);
+		XDestroyRegion(empty);
+	}
+	report("copy", w32x, now() - start);
+
+	start = now();
+	for (i = 0; i < ITERATIONS; i++)
+		CombineRgn(dest, stairs, rect, RGN_AND);
+	w32x = now() - start;
+	start = now();
+	for (i = 0; i < ITERATIONS; i++)
+		XIntersectRegion(xstairs, xrect, xdest);
+	report("intersect", w32x, now() - start);
+
+	start = now();
+	for (i = 0; i < ITERATIONS; i++)
+		CombineRgn(dest, stairs, rect, RGN_OR);
+	w32x = now() - start;
+	start = now();
+	for (i = 0; i < ITERATIONS; i++)
+		XUnionRegion(xstairs, xrect, xdest);
+	report("union", w32x, now() - start);
+
+	start = now();
+	for (i = 0; i < ITERATIONS; i++)
+		CombineRgn(dest, stairs, rect, RGN_DIFF);
+	w32x = now() - start;
+	start = now();
+	for (i = 0; i < ITERATIONS; i++)
+		XSubtractRegion(xstairs, xrect, xdest);
+	report("subtract", w32x, now() - start);
+
+	start = now();
+	for (i = 0; i < ITERATIONS; i++)
+		CombineRgn(dest, stairs, rect, RGN_XOR);
+	w32x = now() - start;
+	start = now();
+	for (i = 0; i < ITERATIONS; i++)
+		XXorRegion(xstairs, xrect, xdest);
+	report("xor", w32x, now() - start);
+
+	/* What region_get_complexity used to do on every CombineRgn */
+	start = now();
+	for (i = 0; i < ITERATIONS; i++)
+		GetRgnBox(stairs, NULL);
+	w32x = now() - start;
+	start = now();
+	for (i = 0; i < ITERATIONS; i++) {
+		XClipBox(xstairs, &r);
+		XRectInRegion(xstairs, r.x, r.y, r.width, r.height);
+	}
+	report("complexity", w32x, now() - start);
+
+	DeleteObject(stairs);
+	DeleteObject(rect);
+	DeleteObject(dest);
+	XDestroyRegion(xstairs);
+	XDestroyRegion(xrect);
+	XDestroyRegion(xdest);
+	return 0;
+}
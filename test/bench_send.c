@@ -0,0 +1,161 @@
+/*
+ * Cross-thread SendMessage benchmark for w32x.
+ *
+ * A worker thread sends messages to a window owned by the UI thread and
+ * waits for each result, measuring the round-trip latency of
+ * SendMessage and SendMessageTimeout. SendNotifyMessage throughput is
+ * measured as well, and so is InvalidateRect from the worker, which has
+ * to leave the damage with the UI thread for it to paint.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <windows.h>
+
+#define BENCH_SEND (WM_USER + 1)
+#define BENCH_NOTIFY (WM_USER + 2)
+#define BENCH_DONE (WM_USER + 3)
+#define ROUND_TRIPS 200000
+#define NOTIFIES 1000000
+#define INVALIDATES 200000
+
+static HWND wnd;
+static unsigned long notified;
+static unsigned long painted;
+static RECT damage; /* what the last WM_PAINT was for */
+
+static LRESULT CALLBACK
+BenchWindowProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+	switch (msg) {
+	case BENCH_SEND:
+		return wParam + 1;
+	case BENCH_NOTIFY:
+		notified++;
+		break;
+	case BENCH_DONE:
+		/* Paint what the worker invalidated before quitting */
+		UpdateWindow(hwnd);
+		PostQuitMessage(0);
+		break;
+	case WM_PAINT: {
+		PAINTSTRUCT ps;
+
+		BeginPaint(hwnd, &ps);
+		damage = ps.rcPaint;
+		painted++;
+		EndPaint(hwnd, &ps);
+		break;
+	}
+	default:
+		return DefWindowProc(hwnd, msg, wParam, lParam);
+	}
+	return 0;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+worker(void *arg)
+{
+	DWORD_PTR result;
+	unsigned long i, errors = 0;
+	double start, elapsed;
+	RECT r;
+
+	start = now();
+	for (i = 0; i < ROUND_TRIPS; i++) {
+		if (SendMessage(wnd, BENCH_SEND, i, 0) != (LRESULT)i + 1)
+			errors++;
+	}
+	elapsed = now() - start;
+	printf("bench_send: SendMessage %d round trips in %.3f s, "
+	    "%.2f us each\n", ROUND_TRIPS, elapsed, elapsed * 1e6 / ROUND_TRIPS);
+
+	start = now();
+	for (i = 0; i < ROUND_TRIPS; i++) {
+		if (!SendMessageTimeout(wnd, BENCH_SEND, i, 0, SMTO_NORMAL,
+		    1000, &result) || result != i + 1)
+			errors++;
+	}
+	elapsed = now() - start;
+	printf("bench_send: SendMessageTimeout %d round trips in %.3f s, "
+	    "%.2f us each\n", ROUND_TRIPS, elapsed, elapsed * 1e6 / ROUND_TRIPS);
+
+	start = now();
+	for (i = 0; i < NOTIFIES; i++)
+		SendNotifyMessage(wnd, BENCH_NOTIFY, i, 0);
+	/* Handled in order, so this returns once all of them are */
+	SendMessage(wnd, BENCH_SEND, 0, 0);
+	elapsed = now() - start;
+	printf("bench_send: SendNotifyMessage %d messages in %.3f s, "
+	    "%.0f messages/s\n", NOTIFIES, elapsed, NOTIFIES / elapsed);
+
+	start = now();
+	for (i = 0; i < INVALIDATES; i++) {
+		SetRect(&r, i % 90, i % 90, i % 90 + 10, i % 90 + 10);
+		if (!InvalidateRect(wnd, &r, FALSE))
+			errors++;
+	}
+	elapsed = now() - start;
+	printf("bench_send: InvalidateRect %d calls in %.3f s, "
+	    "%.2f us each\n", INVALIDATES, elapsed,
+	    elapsed * 1e6 / INVALIDATES);
+
+	if (errors != 0)
+		printf("bench_send: %lu wrong results\n", errors);
+	PostMessage(wnd, BENCH_DONE, 0, 0);
+	return NULL;
+}
+
+int
+WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR pCmdLine,
+    int nCmdShow)
+{
+	WNDCLASS benchClass;
+	pthread_t thread;
+	RECT client, expect;
+	MSG msg;
+
+	memset(&benchClass, 0, sizeof(WNDCLASS));
+	benchClass.lpszClassName = "BenchWindow";
+	benchClass.hbrBackground = (HBRUSH)(COLOR_BTNFACE + 1);
+	benchClass.lpfnWndProc = BenchWindowProc;
+	RegisterClass(&benchClass);
+
+	/* The window is never mapped, so no X events compete with the
+	 * sent messages. */
+	wnd = CreateWindow("BenchWindow", "bench_send", WS_OVERLAPPEDWINDOW,
+	    0, 0, 100, 100, NULL, NULL, hInstance, NULL);
+
+	if (pthread_create(&thread, NULL, worker, NULL) != 0) {
+		fprintf(stderr, "bench_send: cannot create thread\n");
+		return 1;
+	}
+
+	while (GetMessage(&msg, NULL, 0, 0))
+		DispatchMessage(&msg);
+	pthread_join(thread, NULL);
+
+	if (notified != NOTIFIES)
+		printf("bench_send: %lu of %d notifications\n", notified,
+		    NOTIFIES);
+	/* The damage spans the diagonal the worker invalidated */
+	GetClientRect(wnd, &client);
+	SetRect(&expect, 0, 0, 99, 99);
+	IntersectRect(&expect, &expect, &client);
+	if (painted == 0 || !EqualRect(&damage, &expect))
+		printf("bench_send: worker damage was not painted\n");
+	return 0;
+}
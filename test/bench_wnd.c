@@ -0,0 +1,149 @@
+/*
+ * Event dispatch benchmark for w32x.
+ *
+ * Creates a large number of windows, feeds button events addressed to
+ * random ones back into the Xlib queue and measures how many per second
+ * make it through GetMessage/DispatchMessage. It also times the Window to
+ * HWND lookup on its own against the XContext lookup it replaced.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef HAVE_XFT_H
+#include <X11/Xft/Xft.h>
+#endif
+
+#include <windows.h>
+#include "../src/w32x_priv.h"
+
+#define WINDOWS 50000
+#define TOTAL_EVENTS 2000000
+#define BATCH_SIZE 1000
+
+extern Display *disp;
+
+static unsigned long received;
+static HWND wnds[WINDOWS];
+static Window xwins[WINDOWS];
+
+static LRESULT CALLBACK
+BenchWindowProc(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+	switch (msg) {
+	case WM_LBUTTONDOWN:
+		received++;
+		break;
+	default:
+		return DefWindowProc(wnd, msg, wParam, lParam);
+	}
+	return 0;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Cheap random window index, the same sequence every run */
+static unsigned int
+next_index(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 8) % WINDOWS;
+}
+
+int
+WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR pCmdLine,
+    int nCmdShow)
+{
+	HWND top;
+	WNDCLASS benchClass;
+	XContext ctxt;
+	XPointer p;
+	XEvent ev;
+	MSG msg;
+	unsigned long posted, i, found;
+	unsigned int seed;
+	double start, elapsed, w32x;
+
+	memset(&benchClass, 0, sizeof(WNDCLASS));
+	benchClass.lpszClassName = "BenchWindow";
+	benchClass.hbrBackground = (HBRUSH)(COLOR_BTNFACE + 1);
+	benchClass.lpfnWndProc = BenchWindowProc;
+	RegisterClass(&benchClass);
+
+	/* None of the windows are mapped, so the server sends no events of
+	 * its own. */
+	top = CreateWindow("BenchWindow", "bench_wnd", WS_OVERLAPPEDWINDOW,
+	    0, 0, 100, 100, NULL, NULL, hInstance, NULL);
+	start = now();
+	for (i = 0; i < WINDOWS; i++) {
+		wnds[i] = CreateWindow("BenchWindow", "child", WS_CHILD,
+		    0, 0, 10, 10, top, NULL, hInstance, NULL);
+		xwins[i] = wnds[i]->window;
+	}
+	XSync(disp, False);
+	elapsed = now() - start;
+	printf("bench_wnd: created %d windows in %.3f s\n", WINDOWS, elapsed);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.xbutton.type = ButtonPress;
+	ev.xbutton.display = disp;
+	ev.xbutton.button = 1;
+
+	seed = 1;
+	posted = 0;
+	start = now();
+	while (posted < TOTAL_EVENTS) {
+		for (i = 0; i < BATCH_SIZE; i++) {
+			ev.xbutton.window = xwins[next_index(&seed)];
+			XPutBackEvent(disp, &ev);
+		}
+		posted += BATCH_SIZE;
+
+		while (received < posted && GetMessage(&msg, NULL, 0, 0))
+			DispatchMessage(&msg);
+	}
+	elapsed = now() - start;
+	printf("bench_wnd: %lu events in %.3f s, %.0f events/s\n",
+	    received, elapsed, received / elapsed);
+
+	/* The lookup alone, against an XContext holding the same windows */
+	ctxt = XUniqueContext();
+	for (i = 0; i < WINDOWS; i++)
+		XSaveContext(disp, xwins[i], ctxt, (XPointer)wnds[i]);
+
+	seed = 1;
+	found = 0;
+	start = now();
+	for (i = 0; i < TOTAL_EVENTS; i++)
+		found += w32x_wndmap_lookup(xwins[next_index(&seed)]) != NULL;
+	w32x = now() - start;
+
+	seed = 1;
+	start = now();
+	for (i = 0; i < TOTAL_EVENTS; i++) {
+		found += XFindContext(disp, xwins[next_index(&seed)], ctxt,
+		    &p) == 0;
+	}
+	elapsed = now() - start;
+
+	printf("bench_wnd: lookup w32x %.1f ns  xcontext %.1f ns  (%.1fx, "
+	    "%lu found)\n", w32x * 1e9 / TOTAL_EVENTS,
+	    elapsed * 1e9 / TOTAL_EVENTS, elapsed / w32x, found);
+
+	for (i = 0; i < WINDOWS; i++)
+		DestroyWindow(wnds[i]);
+	DestroyWindow(top);
+	return 0;
+}
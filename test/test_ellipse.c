@@ -0,0 +1,153 @@
+/*
+ * Ellipse test for w32x memory DCs.
+ *
+ * Draws ellipses of every size up to MAX_SIZE into a memory DC, with the
+ * pen and brush in different colors, and checks the pixels: nothing is
+ * drawn outside the bounding box, every fill pixel has the outline on all
+ * four sides, and no row or column has a gap in it. Needs no display.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <windows.h>
+
+#define MAX_SIZE 40
+#define ORIGIN 2
+#define SIDE (MAX_SIZE + 2 * ORIGIN)
+
+#define BACKGROUND 0x000000
+#define PEN 0xff0000
+#define BRUSH 0x0000ff
+
+static uint32_t pixels[SIDE][SIDE];
+
+/* Whether the run from x, y in steps of dx, dy meets the outline */
+static int
+outline_towards(int x, int y, int dx, int dy)
+{
+	for (x += dx, y += dy; x >= 0 && x < SIDE && y >= 0 && y < SIDE;
+	    x += dx, y += dy) {
+		if (pixels[y][x] == PEN)
+			return 1;
+	}
+	return 0;
+}
+
+/* Whether pixels count steps apart from x, y are drawn without gaps */
+static int
+no_gaps(int x, int y, int dx, int dy, int count)
+{
+	int i, first = -1, last = -1;
+
+	for (i = 0; i < count; i++) {
+		if (pixels[y + i * dy][x + i * dx] != BACKGROUND) {
+			if (first == -1)
+				first = i;
+			last = i;
+		}
+	}
+	for (i = first; i >= 0 && i <= last; i++) {
+		if (pixels[y + i * dy][x + i * dx] == BACKGROUND)
+			return 0;
+	}
+	return 1;
+}
+
+static int
+check(int w, int h)
+{
+	int x, y, inside;
+
+	for (y = 0; y < SIDE; y++) {
+		for (x = 0; x < SIDE; x++) {
+			inside = x >= ORIGIN && x < ORIGIN + w &&
+			    y >= ORIGIN && y < ORIGIN + h;
+			if (!inside && pixels[y][x] != BACKGROUND) {
+				printf("test_ellipse: %dx%d: pixel %d,%d "
+				    "outside the box\n", w, h, x, y);
+				return 0;
+			}
+			if (pixels[y][x] == BRUSH &&
+			    (!outline_towards(x, y, -1, 0) ||
+			    !outline_towards(x, y, 1, 0) ||
+			    !outline_towards(x, y, 0, -1) ||
+			    !outline_towards(x, y, 0, 1))) {
+				printf("test_ellipse: %dx%d: fill pixel %d,%d "
+				    "outside the outline\n", w, h, x, y);
+				return 0;
+			}
+		}
+	}
+	for (y = 0; y < SIDE; y++) {
+		if (!no_gaps(0, y, 1, 0, SIDE)) {
+			printf("test_ellipse: %dx%d: gap in row %d\n", w, h, y);
+			return 0;
+		}
+	}
+	for (x = 0; x < SIDE; x++) {
+		if (!no_gaps(x, 0, 0, 1, SIDE)) {
+			printf("test_ellipse: %dx%d: gap in column %d\n", w, h,
+			    x);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int
+WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR pCmdLine,
+    int nCmdShow)
+{
+	BITMAPINFO bmi;
+	HDC hdc;
+	HBITMAP bitmap;
+	HBRUSH background;
+	RECT all;
+	int w, h, failed = 0;
+
+	hdc = CreateCompatibleDC(NULL);
+	bitmap = CreateCompatibleBitmap(hdc, SIDE, SIDE);
+	if (hdc == NULL || bitmap == NULL) {
+		fprintf(stderr, "test_ellipse: cannot create memory DC\n");
+		return 1;
+	}
+	SelectObject(hdc, bitmap);
+	SelectObject(hdc, CreatePen(PS_SOLID, 1, RGB(0xff, 0, 0)));
+	SelectObject(hdc, CreateSolidBrush(RGB(0, 0, 0xff)));
+	background = CreateSolidBrush(RGB(0, 0, 0));
+	SetRect(&all, 0, 0, SIDE, SIDE);
+
+	memset(&bmi, 0, sizeof(bmi));
+	bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+	bmi.bmiHeader.biWidth = SIDE;
+	bmi.bmiHeader.biHeight = -SIDE;
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+
+	for (h = 1; h <= MAX_SIZE; h++) {
+		for (w = 1; w <= MAX_SIZE; w++) {
+			FillRect(hdc, &all, background);
+			Ellipse(hdc, ORIGIN, ORIGIN, ORIGIN + w, ORIGIN + h);
+			if (GetDIBits(hdc, bitmap, 0, SIDE, pixels, &bmi,
+			    DIB_RGB_COLORS) != SIDE) {
+				fprintf(stderr, "test_ellipse: GetDIBits "
+				    "failed\n");
+				return 1;
+			}
+			if (!check(w, h))
+				failed++;
+		}
+	}
+
+	if (failed != 0) {
+		printf("test_ellipse: %d of %d ellipses wrong\n", failed,
+		    MAX_SIZE * MAX_SIZE);
+		return 1;
+	}
+	printf("test_ellipse: %d ellipses ok\n", MAX_SIZE * MAX_SIZE);
+	return 0;
+}
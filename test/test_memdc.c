@@ -0,0 +1,231 @@
+/*
+ * Pixel test for w32x memory DCs.
+ *
+ * Checks the pixels FillRect, Rectangle, a selected clip region and
+ * TextOut leave in a memory DC against the rules window DCs follow: a
+ * fill covers right - left by bottom - top pixels, while an outline is
+ * drawn as X draws it, one pixel wider and higher. Needs no display.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <windows.h>
+
+#define MAX_SIZE 12
+#define ORIGIN 3
+#define SIDE 48
+
+#define BACKGROUND 0x000000
+#define COLOR 0x0000ff
+
+static uint32_t pixels[SIDE][SIDE];
+static BITMAPINFO bmi;
+static HBITMAP bitmap;
+static HBRUSH background;
+static RECT all;
+
+static int
+read_pixels(HDC hdc)
+{
+	if (GetDIBits(hdc, bitmap, 0, SIDE, pixels, &bmi,
+	    DIB_RGB_COLORS) != SIDE) {
+		fprintf(stderr, "test_memdc: GetDIBits failed\n");
+		exit(1);
+	}
+	return 1;
+}
+
+static int
+in_rect(const RECT *rc, int x, int y)
+{
+	return x >= rc->left && x < rc->right && y >= rc->top &&
+	    y < rc->bottom;
+}
+
+/* Pixels inside the rule are COLOR, the others untouched */
+static int
+check(const char *what, int w, int h, int (*rule)(int, int, int, int))
+{
+	uint32_t want;
+	int x, y;
+
+	for (y = 0; y < SIDE; y++) {
+		for (x = 0; x < SIDE; x++) {
+			want = rule(x - ORIGIN, y - ORIGIN, w, h) ? COLOR :
+			    BACKGROUND;
+			if (pixels[y][x] != want) {
+				printf("test_memdc: %s %dx%d: pixel %d,%d is "
+				    "%06x, not %06x\n", what, w, h, x, y,
+				    pixels[y][x], want);
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+static int
+fill_rule(int x, int y, int w, int h)
+{
+	return x >= 0 && x < w && y >= 0 && y < h;
+}
+
+static int
+frame_rule(int x, int y, int w, int h)
+{
+	return x >= 0 && x <= w && y >= 0 && y <= h &&
+	    (x == 0 || x == w || y == 0 || y == h);
+}
+
+static int
+test_rects(HDC hdc, HBRUSH brush)
+{
+	RECT rc;
+	int w, h, failed = 0;
+
+	for (h = 1; h <= MAX_SIZE; h++) {
+		for (w = 1; w <= MAX_SIZE; w++) {
+			SetRect(&rc, ORIGIN, ORIGIN, ORIGIN + w, ORIGIN + h);
+			FillRect(hdc, &all, background);
+			FillRect(hdc, &rc, brush);
+			read_pixels(hdc);
+			if (!check("FillRect", w, h, fill_rule))
+				failed++;
+
+			FillRect(hdc, &all, background);
+			Rectangle(hdc, rc.left, rc.top, rc.right, rc.bottom);
+			read_pixels(hdc);
+			if (!check("Rectangle", w, h, frame_rule))
+				failed++;
+		}
+	}
+	return failed;
+}
+
+/* A fill through an L shaped clip region reaches exactly the region */
+static int
+test_clip(HDC hdc, HBRUSH brush)
+{
+	RECT a = { 5, 4, 30, 12 }, b = { 5, 12, 14, 40 };
+	HRGN rgn, other;
+	int x, y, failed = 0;
+
+	rgn = CreateRectRgnIndirect(&a);
+	other = CreateRectRgnIndirect(&b);
+	CombineRgn(rgn, rgn, other, RGN_OR);
+
+	FillRect(hdc, &all, background);
+	SelectClipRgn(hdc, rgn);
+	FillRect(hdc, &all, brush);
+	SelectClipRgn(hdc, NULL);
+	read_pixels(hdc);
+	for (y = 0; y < SIDE; y++) {
+		for (x = 0; x < SIDE; x++) {
+			if ((pixels[y][x] == COLOR) !=
+			    (in_rect(&a, x, y) || in_rect(&b, x, y))) {
+				printf("test_memdc: clip: pixel %d,%d wrong\n",
+				    x, y);
+				failed = 1;
+			}
+		}
+	}
+
+	/* With the region deselected the whole bitmap is drawn on */
+	FillRect(hdc, &all, brush);
+	read_pixels(hdc);
+	for (y = 0; y < SIDE; y++) {
+		for (x = 0; x < SIDE; x++) {
+			if (pixels[y][x] != COLOR) {
+				printf("test_memdc: clip: pixel %d,%d still "
+				    "clipped\n", x, y);
+				return 1;
+			}
+		}
+	}
+
+	DeleteObject(other);
+	DeleteObject(rgn);
+	return failed;
+}
+
+/* Text leaves ink only inside the box GetTextExtentPoint32 reports */
+static int
+test_text(HDC hdc)
+{
+	static const char text[] = "Hello";
+	RECT box;
+	SIZE size;
+	int x, y, ink = 0;
+
+	SelectObject(hdc, GetStockObject(SYSTEM_FONT));
+	SetTextColor(hdc, RGB(0, 0, 0xff));
+	FillRect(hdc, &all, background);
+	if (!GetTextExtentPoint32(hdc, text, strlen(text), &size) ||
+	    !TextOut(hdc, ORIGIN, ORIGIN, text, strlen(text))) {
+		printf("test_memdc: no font, text skipped\n");
+		return 0;
+	}
+	read_pixels(hdc);
+
+	SetRect(&box, ORIGIN, ORIGIN, ORIGIN + size.cx, ORIGIN + size.cy);
+	for (y = 0; y < SIDE; y++) {
+		for (x = 0; x < SIDE; x++) {
+			if (pixels[y][x] == BACKGROUND)
+				continue;
+			ink++;
+			if (!in_rect(&box, x, y)) {
+				printf("test_memdc: text: ink at %d,%d outside "
+				    "%ldx%ld\n", x, y, (long)size.cx,
+				    (long)size.cy);
+				return 1;
+			}
+		}
+	}
+	if (ink == 0) {
+		printf("test_memdc: text: nothing drawn\n");
+		return 1;
+	}
+	return 0;
+}
+
+int
+WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR pCmdLine,
+    int nCmdShow)
+{
+	HBRUSH brush;
+	HDC hdc;
+	int failed;
+
+	hdc = CreateCompatibleDC(NULL);
+	bitmap = CreateCompatibleBitmap(hdc, SIDE, SIDE);
+	if (hdc == NULL || bitmap == NULL) {
+		fprintf(stderr, "test_memdc: cannot create memory DC\n");
+		return 1;
+	}
+	SelectObject(hdc, bitmap);
+	brush = CreateSolidBrush(RGB(0, 0, 0xff));
+	SelectObject(hdc, brush);
+	background = CreateSolidBrush(RGB(0, 0, 0));
+	SetRect(&all, 0, 0, SIDE, SIDE);
+
+	bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+	bmi.bmiHeader.biWidth = SIDE;
+	bmi.bmiHeader.biHeight = -SIDE;
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+
+	failed = test_rects(hdc, brush);
+	failed += test_clip(hdc, brush);
+	failed += test_text(hdc);
+
+	if (failed != 0) {
+		printf("test_memdc: %d checks failed\n", failed);
+		return 1;
+	}
+	printf("test_memdc: ok\n");
+	return 0;
+}